@@ -1,11 +1,142 @@
 #include "svc.h"
 
+// Tracing records begin and end events of the API calls and their phases into one ring buffer
+// per thread. A thread only ever writes its own ring, so recording takes no lock. Rings are
+// kept for the whole process: a thread that exits hands its ring to the next thread that traces.
+// While tracing is off, every traced scope costs two well predicted branches: one on
+// trace_enabled when it begins, and one on the scope's own active flag when it ends.
+#define TRACE_ARG_LEN 64
+// Argument value that is not recorded.
+#define TRACE_NONE -1
+
+typedef struct trace_event{
+	// Position of the event in its ring plus one, 0 while it is written.
+	atomic_ulong seq;
+	const char *name;
+	uint64_t ts;
+	int tid;
+	char phase;
+	long files;
+	long bytes;
+	// Argument of the call: a path, a branch name, a commit id or a message.
+	char arg[TRACE_ARG_LEN];
+}trace_event_t;
+
+typedef struct trace_ring{
+	struct trace_ring *next;
+	atomic_int owned;
+	size_t cap;
+	atomic_ulong head;
+	// First event that has not been written out yet, only used by svc_trace_stop().
+	unsigned long tail;
+	trace_event_t *events;
+}trace_ring_t;
+
+// A traced scope. The end event is recorded when the variable goes out of scope, files and
+// bytes can be updated before that.
+typedef struct trace_scope{
+	const char *name;
+	int active;
+	long files;
+	long bytes;
+}trace_scope_t;
+
+static atomic_int trace_enabled;
+static _Atomic(trace_ring_t *) trace_rings;
+static atomic_size_t trace_ring_cap;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static __thread trace_ring_t *trace_thread_ring;
+static __thread int trace_tid;
+
+static uint64_t trace_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Hand the ring of an exiting thread to the next one.
+static void trace_release_ring(void *ring) {
+	atomic_store(&((trace_ring_t *)ring)->owned, 0);
+}
+
+static void trace_create_key(void) {
+	pthread_key_create(&trace_key, trace_release_ring);
+}
+
+// The calling thread's ring: a released one if there is one, otherwise a new one.
+static trace_ring_t *trace_claim_ring(void) {
+	pthread_once(&trace_key_once, trace_create_key);
+	trace_ring_t *ring = atomic_load(&trace_rings);
+	for (; ring != NULL; ring = ring->next) {
+		int owned = 0;
+		if (atomic_compare_exchange_strong(&ring->owned, &owned, 1)) {
+			break;
+		}
+	}
+	if (ring == NULL) {
+		ring = (trace_ring_t *)calloc(1, sizeof(trace_ring_t));
+		ring->cap = atomic_load(&trace_ring_cap);
+		ring->events = (trace_event_t *)calloc(ring->cap, sizeof(trace_event_t));
+		atomic_init(&ring->owned, 1);
+		atomic_init(&ring->head, 0);
+		ring->next = atomic_load(&trace_rings);
+		while (!atomic_compare_exchange_weak(&trace_rings, &ring->next, ring)) {
+		}
+	}
+	pthread_setspecific(trace_key, ring);
+	trace_tid = syscall(SYS_gettid);
+	return ring;
+}
+
+static void trace_record(const char *name, char phase, const char *arg, long files, long bytes) {
+	if (trace_thread_ring == NULL) {
+		trace_thread_ring = trace_claim_ring();
+	}
+	trace_ring_t *ring = trace_thread_ring;
+	unsigned long pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	trace_event_t *event = &ring->events[pos % ring->cap];
+	
+	atomic_store_explicit(&event->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	event->name = name;
+	event->ts = trace_now();
+	event->tid = trace_tid;
+	event->phase = phase;
+	event->files = files;
+	event->bytes = bytes;
+	event->arg[0] = '\0';
+	if (arg != NULL) {
+		strncpy(event->arg, arg, TRACE_ARG_LEN - 1);
+		event->arg[TRACE_ARG_LEN - 1] = '\0';
+	}
+	atomic_store_explicit(&event->seq, pos + 1, memory_order_release);
+	atomic_store_explicit(&ring->head, pos + 1, memory_order_release);
+}
+
+static inline trace_scope_t trace_scope_begin(const char *name, const char *arg, long files, long bytes) {
+	trace_scope_t scope = {name, 0, files, bytes};
+	if (__builtin_expect(atomic_load_explicit(&trace_enabled, memory_order_relaxed), 0)) {
+		scope.active = 1;
+		trace_record(name, 'B', arg, files, bytes);
+	}
+	return scope;
+}
+
+static inline void trace_scope_end(trace_scope_t *scope) {
+	if (__builtin_expect(scope->active, 0)) {
+		trace_record(scope->name, 'E', NULL, scope->files, scope->bytes);
+	}
+}
+
+// Trace the rest of the enclosing block as name. The scope is called trace_scope.
+#define TRACE_SCOPE(name, arg, files, bytes) trace_scope_t trace_scope __attribute__ ((cleanup(trace_scope_end))) = trace_scope_begin(name, arg, files, bytes)
+
 static commit_node_t *commit_node_init() {
 	commit_node_t *node = (commit_node_t*)malloc(sizeof(commit_node_t));
 	node->branch_name =  (char*)malloc(sizeof(char) * BRANCH_NAME_LEN);
 	strcpy(node->branch_name, "master");
-	node->message = NULL;
-	node->commit_id = NULL;
+	node->commit_seq = COMMIT_NONE;
 	node->tracked_files = NULL;
 	node->n_tracked_files = 0;
 	node->n_next_commit = 0;
@@ -15,58 +146,664 @@ static commit_node_t *commit_node_init() {
 	return node;
 }
 
-static unsigned char *file_content_copy(char *file_name) {
-	if (file_name == NULL) {
+// FNV-1a hash of a path, used to index the hash cache and the in-memory working tree.
+static uint64_t path_hash(const char *file_name) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (const unsigned char *ptr = (const unsigned char *)file_name; *ptr != '\0'; ptr++) {
+		hash ^= *ptr;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// The working tree is read and written through a svc_fs_t. The default backend is the current
+// directory of the process.
+static int posix_fs_stat(void *ctx, const char *path, struct stat *st) {
+	return (stat(path, st) == 0) ? 0 : -1;
+}
+
+static int posix_fs_open(void *ctx, const char *path, int for_write) {
+	if (for_write == 0) {
+		return open(path, O_RDONLY | O_CLOEXEC);
+	}
+	
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0 && errno == ENOENT && path[0] != '\0') {
+		char *dir_name = strdup(path);
+		for (char *sep = strchr(dir_name + 1, '/'); sep != NULL; sep = strchr(sep + 1, '/')) {
+			*sep = '\0';
+			mkdir(dir_name, 0755);
+			*sep = '/';
+		}
+		free(dir_name);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	}
+	return fd;
+}
+
+static ssize_t posix_fs_read(void *ctx, int handle, void *buf, size_t len) {
+	for (;;) {
+		ssize_t n_read = read(handle, buf, len);
+		if (n_read >= 0 || errno != EINTR) {
+			return n_read;
+		}
+	}
+}
+
+static ssize_t posix_fs_write(void *ctx, int handle, const void *buf, size_t len) {
+	for (;;) {
+		ssize_t n_written = write(handle, buf, len);
+		if (n_written >= 0 || errno != EINTR) {
+			return n_written;
+		}
+	}
+}
+
+static int posix_fs_close(void *ctx, int handle) {
+	return close(handle);
+}
+
+static int posix_fs_unlink(void *ctx, const char *path) {
+	return unlink(path);
+}
+
+struct posix_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+// Directories are read with getdents64 in large batches, the entry types come with the names.
+static int posix_fs_list(void *ctx, const char *dir, svc_fs_entry_callback_t entry, void *arg) {
+	int dir_fd = openat(AT_FDCWD, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd < 0) {
+		return -1;
+	}
+	
+	char dents[65536];
+	for (;;) {
+		long n_bytes = syscall(SYS_getdents64, dir_fd, dents, sizeof(dents));
+		if (n_bytes == 0) {
+			break;
+		}
+		// A read error is not the end of the directory, the listing would be cut short.
+		if (n_bytes < 0) {
+			close(dir_fd);
+			return -1;
+		}
+		for (long pos = 0; pos < n_bytes;) {
+			struct posix_dirent64 *dent = (struct posix_dirent64 *)(dents + pos);
+			pos += dent->d_reclen;
+			if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0) {
+				continue;
+			}
+			
+			unsigned char type = dent->d_type;
+			if (type == DT_UNKNOWN) {
+				struct stat st;
+				if (fstatat(dir_fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+					continue;
+				}
+				type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_LNK);
+			}
+			entry(arg, dent->d_name, (type == DT_DIR) ? SVC_FS_DIR : ((type == DT_REG) ? SVC_FS_FILE : SVC_FS_OTHER));
+		}
+	}
+	close(dir_fd);
+	
+	return 0;
+}
+
+static const svc_fs_t posix_fs = {
+	NULL,
+	posix_fs_stat,
+	posix_fs_open,
+	posix_fs_read,
+	posix_fs_write,
+	posix_fs_close,
+	posix_fs_unlink,
+	posix_fs_list,
+	SVC_FS_LOCAL
+};
+
+const svc_fs_t *svc_fs_posix(void) {
+	return &posix_fs;
+}
+
+// In-memory working tree. Files and directories are nodes of an open addressing table by path,
+// at most half full, and each directory links its entries. Directories are created for the files
+// below them and go away with their last entry. An unlinked file stays alive until its last
+// handle is closed. Timestamps come from a counter that advances on every change, so the hash
+// cache notices each change without waiting for the clock.
+typedef struct memfs_node{
+	char *path;
+	// Last component of the path.
+	const char *name;
+	uint64_t hash;
+	int is_dir;
+	struct memfs_node *parent;
+	struct memfs_node *prev_sibling;
+	struct memfs_node *next_sibling;
+	struct memfs_node *children;
+	unsigned char *data;
+	size_t len;
+	size_t cap;
+	ino_t ino;
+	struct timespec mtime;
+	// Open handles, plus one while the node is in the table.
+	int refs;
+}memfs_node_t;
+
+typedef struct memfs_handle{
+	// NULL while the handle is free.
+	memfs_node_t *file;
+	size_t pos;
+	// Next free handle, or -1.
+	int next_free;
+}memfs_handle_t;
+
+typedef struct memfs_entry{
+	char *name;
+	svc_fs_type_t type;
+}memfs_entry_t;
+
+typedef struct memfs{
+	// Returned by svc_fs_memory_create(), its ctx points back at the memfs.
+	svc_fs_t fs;
+	pthread_mutex_t lock;
+	memfs_node_t **nodes;
+	size_t n_nodes;
+	size_t nodes_cap;
+	// The top directory, its path is "".
+	memfs_node_t *root;
+	memfs_handle_t *handles;
+	int handles_cap;
+	int free_handle;
+	unsigned long clock;
+	ino_t next_ino;
+}memfs_t;
+
+// Paths are used without a "./" prefix, and "." is the top directory "".
+static const char *memfs_path(const char *path) {
+	while (path[0] == '.' && path[1] == '/') {
+		path += 2;
+	}
+	return (strcmp(path, ".") == 0) ? "" : path;
+}
+
+// Find the table slot of the path, or the empty slot where it belongs.
+static size_t memfs_slot(memfs_t *memfs, const char *path, uint64_t hash) {
+	size_t slot_idx = hash & (memfs->nodes_cap - 1);
+	while (memfs->nodes[slot_idx] != NULL && strcmp(memfs->nodes[slot_idx]->path, path) != 0) {
+		slot_idx = (slot_idx + 1) & (memfs->nodes_cap - 1);
+	}
+	return slot_idx;
+}
+
+static memfs_node_t *memfs_find(memfs_t *memfs, const char *path) {
+	return memfs->nodes[memfs_slot(memfs, path, path_hash(path))];
+}
+
+static void memfs_touch(memfs_t *memfs, memfs_node_t *node) {
+	memfs->clock++;
+	node->mtime.tv_sec = memfs->clock / 1000000000;
+	node->mtime.tv_nsec = memfs->clock % 1000000000;
+}
+
+// Create a node for the path (taken over) in the directory parent.
+static memfs_node_t *memfs_add_node(memfs_t *memfs, memfs_node_t *parent, char *path, int is_dir) {
+	if ((memfs->n_nodes + 1) * 2 > memfs->nodes_cap) {
+		size_t new_cap = memfs->nodes_cap * 2;
+		memfs_node_t **new_nodes = (memfs_node_t **)calloc(new_cap, sizeof(memfs_node_t *));
+		for (size_t old_idx = 0; old_idx < memfs->nodes_cap; old_idx++) {
+			memfs_node_t *old_node = memfs->nodes[old_idx];
+			if (old_node == NULL) {
+				continue;
+			}
+			size_t new_idx = old_node->hash & (new_cap - 1);
+			while (new_nodes[new_idx] != NULL) {
+				new_idx = (new_idx + 1) & (new_cap - 1);
+			}
+			new_nodes[new_idx] = old_node;
+		}
+		free(memfs->nodes);
+		memfs->nodes = new_nodes;
+		memfs->nodes_cap = new_cap;
+	}
+	
+	memfs_node_t *node = (memfs_node_t *)calloc(1, sizeof(memfs_node_t));
+	node->path = path;
+	char *slash = strrchr(path, '/');
+	node->name = (slash == NULL) ? path : slash + 1;
+	node->hash = path_hash(path);
+	node->is_dir = is_dir;
+	node->ino = ++memfs->next_ino;
+	node->refs = 1;
+	memfs_touch(memfs, node);
+	memfs->nodes[memfs_slot(memfs, path, node->hash)] = node;
+	memfs->n_nodes++;
+	
+	node->parent = parent;
+	if (parent != NULL) {
+		node->next_sibling = parent->children;
+		if (parent->children != NULL) {
+			parent->children->prev_sibling = node;
+		}
+		parent->children = node;
+	}
+	return node;
+}
+
+static void memfs_release(memfs_node_t *node) {
+	node->refs--;
+	if (node->refs == 0) {
+		free(node->path);
+		free(node->data);
+		free(node);
+	}
+}
+
+// Take the node out of the table and its directory.
+static void memfs_remove_node(memfs_t *memfs, memfs_node_t *node) {
+	// Shift the following entries of the probe run back, so that no lookup stops at the hole.
+	size_t mask = memfs->nodes_cap - 1;
+	size_t hole_idx = memfs_slot(memfs, node->path, node->hash);
+	memfs->nodes[hole_idx] = NULL;
+	for (size_t slot_idx = (hole_idx + 1) & mask; memfs->nodes[slot_idx] != NULL; slot_idx = (slot_idx + 1) & mask) {
+		size_t home_idx = memfs->nodes[slot_idx]->hash & mask;
+		if (((slot_idx - home_idx) & mask) >= ((slot_idx - hole_idx) & mask)) {
+			memfs->nodes[hole_idx] = memfs->nodes[slot_idx];
+			memfs->nodes[slot_idx] = NULL;
+			hole_idx = slot_idx;
+		}
+	}
+	memfs->n_nodes--;
+	
+	if (node->prev_sibling != NULL) {
+		node->prev_sibling->next_sibling = node->next_sibling;
+	}else {
+		node->parent->children = node->next_sibling;
+	}
+	if (node->next_sibling != NULL) {
+		node->next_sibling->prev_sibling = node->prev_sibling;
+	}
+	node->parent = NULL;
+	node->prev_sibling = NULL;
+	node->next_sibling = NULL;
+}
+
+// Find the directory of the first dir_len bytes of path, creating it and its parents if needed.
+// Return NULL if a file is in the way.
+static memfs_node_t *memfs_dir(memfs_t *memfs, const char *path, size_t dir_len) {
+	if (dir_len == 0) {
+		return memfs->root;
+	}
+	
+	char *dir_name = strndup(path, dir_len);
+	memfs_node_t *dir = memfs_find(memfs, dir_name);
+	if (dir != NULL) {
+		free(dir_name);
+		return (dir->is_dir == 1) ? dir : NULL;
+	}
+	
+	char *slash = strrchr(dir_name, '/');
+	memfs_node_t *parent = memfs_dir(memfs, dir_name, (slash == NULL) ? 0 : (size_t)(slash - dir_name));
+	if (parent == NULL) {
+		free(dir_name);
+		return NULL;
+	}
+	return memfs_add_node(memfs, parent, dir_name, 1);
+}
+
+static memfs_handle_t *memfs_handle(memfs_t *memfs, int handle) {
+	if (handle < 0 || handle >= memfs->handles_cap || memfs->handles[handle].file == NULL) {
 		return NULL;
 	}
+	return &memfs->handles[handle];
+}
+
+static int memfs_stat(void *ctx, const char *path, struct stat *st) {
+	memfs_t *memfs = (memfs_t *)ctx;
+	path = memfs_path(path);
+	memset(st, 0, sizeof(struct stat));
+	
+	pthread_mutex_lock(&memfs->lock);
+	memfs_node_t *node = memfs_find(memfs, path);
+	if (node != NULL) {
+		st->st_mode = (node->is_dir == 1) ? (S_IFDIR | 0755) : (S_IFREG | 0644);
+		st->st_nlink = 1;
+		st->st_ino = node->ino;
+		st->st_size = node->len;
+		st->st_mtim = node->mtime;
+		st->st_ctim = node->mtime;
+	}
+	pthread_mutex_unlock(&memfs->lock);
+	
+	return (node != NULL) ? 0 : -1;
+}
+
+static int memfs_open(void *ctx, const char *path, int for_write) {
+	memfs_t *memfs = (memfs_t *)ctx;
+	path = memfs_path(path);
+	
+	pthread_mutex_lock(&memfs->lock);
+	memfs_node_t *file = memfs_find(memfs, path);
+	if (file == NULL && for_write == 1) {
+		const char *slash = strrchr(path, '/');
+		memfs_node_t *parent = memfs_dir(memfs, path, (slash == NULL) ? 0 : (size_t)(slash - path));
+		if (parent != NULL) {
+			file = memfs_add_node(memfs, parent, strdup(path), 0);
+		}
+	}
+	if (file == NULL || file->is_dir == 1) {
+		pthread_mutex_unlock(&memfs->lock);
+		return -1;
+	}
+	if (for_write == 1) {
+		file->len = 0;
+		memfs_touch(memfs, file);
+	}
+	
+	if (memfs->free_handle < 0) {
+		int new_cap = (memfs->handles_cap == 0) ? 64 : memfs->handles_cap * 2;
+		memfs->handles = (memfs_handle_t *)realloc(memfs->handles, sizeof(memfs_handle_t) * new_cap);
+		for (int handle = new_cap - 1; handle >= memfs->handles_cap; handle--) {
+			memfs->handles[handle].file = NULL;
+			memfs->handles[handle].next_free = memfs->free_handle;
+			memfs->free_handle = handle;
+		}
+		memfs->handles_cap = new_cap;
+	}
+	int handle = memfs->free_handle;
+	memfs->free_handle = memfs->handles[handle].next_free;
+	memfs->handles[handle].file = file;
+	memfs->handles[handle].pos = 0;
+	file->refs++;
+	pthread_mutex_unlock(&memfs->lock);
+	
+	return handle;
+}
+
+static ssize_t memfs_read(void *ctx, int handle, void *buf, size_t len) {
+	memfs_t *memfs = (memfs_t *)ctx;
+	pthread_mutex_lock(&memfs->lock);
+	memfs_handle_t *open_file = memfs_handle(memfs, handle);
+	if (open_file == NULL) {
+		pthread_mutex_unlock(&memfs->lock);
+		return -1;
+	}
 	
-	FILE * fptr;
-	unsigned char *file_content = NULL;
-	unsigned int file_content_len = 0;
+	memfs_node_t *file = open_file->file;
+	size_t n_read = 0;
+	// The file may have been truncated through another handle.
+	if (open_file->pos < file->len) {
+		n_read = file->len - open_file->pos;
+		if (n_read > len) {
+			n_read = len;
+		}
+		memcpy(buf, file->data + open_file->pos, n_read);
+		open_file->pos += n_read;
+	}
+	pthread_mutex_unlock(&memfs->lock);
 	
-	fptr = fopen(file_name, "r");
+	return n_read;
+}
+
+static ssize_t memfs_write(void *ctx, int handle, const void *buf, size_t len) {
+	memfs_t *memfs = (memfs_t *)ctx;
+	pthread_mutex_lock(&memfs->lock);
+	memfs_handle_t *open_file = memfs_handle(memfs, handle);
+	if (open_file == NULL) {
+		pthread_mutex_unlock(&memfs->lock);
+		return -1;
+	}
 	
-	if (fptr == NULL) {
-    	return NULL;
+	memfs_node_t *file = open_file->file;
+	size_t end = open_file->pos + len;
+	if (end > file->cap) {
+		size_t new_cap = (file->cap == 0) ? 64 : file->cap;
+		while (new_cap < end) {
+			new_cap *= 2;
+		}
+		file->data = (unsigned char *)realloc(file->data, new_cap);
+		file->cap = new_cap;
+	}
+	// Writing past the end leaves a hole of zeros.
+	if (open_file->pos > file->len) {
+		memset(file->data + file->len, 0, open_file->pos - file->len);
+	}
+	if (len > 0) {
+		memcpy(file->data + open_file->pos, buf, len);
+	}
+	open_file->pos = end;
+	if (end > file->len) {
+		file->len = end;
 	}
+	memfs_touch(memfs, file);
+	pthread_mutex_unlock(&memfs->lock);
 	
-	// Find number of characters in the file.
-	fseek(fptr, 0, SEEK_END);
-	file_content_len = ftell(fptr);
-	fseek(fptr, 0, SEEK_SET);	
+	return len;
+}
+
+static int memfs_close(void *ctx, int handle) {
+	memfs_t *memfs = (memfs_t *)ctx;
+	pthread_mutex_lock(&memfs->lock);
+	memfs_handle_t *open_file = memfs_handle(memfs, handle);
+	if (open_file == NULL) {
+		pthread_mutex_unlock(&memfs->lock);
+		return -1;
+	}
 	
-	file_content = (unsigned char*)malloc(sizeof(unsigned char) * file_content_len + 1);	
+	memfs_release(open_file->file);
+	open_file->file = NULL;
+	open_file->next_free = memfs->free_handle;
+	memfs->free_handle = handle;
+	pthread_mutex_unlock(&memfs->lock);
 	
-	if (file_content == NULL) {
-    	return NULL;
+	return 0;
+}
+
+static int memfs_unlink(void *ctx, const char *path) {
+	memfs_t *memfs = (memfs_t *)ctx;
+	path = memfs_path(path);
+	
+	pthread_mutex_lock(&memfs->lock);
+	memfs_node_t *file = memfs_find(memfs, path);
+	if (file == NULL || file->is_dir == 1) {
+		pthread_mutex_unlock(&memfs->lock);
+		return -1;
+	}
+	
+	memfs_node_t *dir = file->parent;
+	memfs_remove_node(memfs, file);
+	memfs_release(file);
+	// Directories only exist for the files below them.
+	while (dir != memfs->root && dir->children == NULL) {
+		memfs_node_t *parent = dir->parent;
+		memfs_remove_node(memfs, dir);
+		memfs_release(dir);
+		dir = parent;
+	}
+	pthread_mutex_unlock(&memfs->lock);
+	
+	return 0;
+}
+
+static int memfs_list(void *ctx, const char *dir, svc_fs_entry_callback_t entry, void *arg) {
+	memfs_t *memfs = (memfs_t *)ctx;
+	dir = memfs_path(dir);
+	
+	// The names are collected first, entry may call back into the file system.
+	pthread_mutex_lock(&memfs->lock);
+	memfs_node_t *dir_node = memfs_find(memfs, dir);
+	if (dir_node == NULL || dir_node->is_dir == 0) {
+		pthread_mutex_unlock(&memfs->lock);
+		return -1;
+	}
+	memfs_entry_t *entries = NULL;
+	size_t n_entries = 0;
+	size_t entries_cap = 0;
+	for (memfs_node_t *child = dir_node->children; child != NULL; child = child->next_sibling) {
+		if (n_entries == entries_cap) {
+			entries_cap = (entries_cap == 0) ? 64 : entries_cap * 2;
+			entries = (memfs_entry_t *)realloc(entries, sizeof(memfs_entry_t) * entries_cap);
+		}
+		entries[n_entries].name = strdup(child->name);
+		entries[n_entries].type = (child->is_dir == 1) ? SVC_FS_DIR : SVC_FS_FILE;
+		n_entries++;
+	}
+	pthread_mutex_unlock(&memfs->lock);
+	
+	for (size_t entry_idx = 0; entry_idx < n_entries; entry_idx++) {
+		entry(arg, entries[entry_idx].name, entries[entry_idx].type);
+		free(entries[entry_idx].name);
+	}
+	free(entries);
+	
+	return 0;
+}
+
+// Create an empty in-memory working tree for svc_init_ex(). Files are put into it through its
+// functions. Free it with svc_fs_memory_free() after the projects using it are cleaned up.
+svc_fs_t *svc_fs_memory_create(void) {
+	memfs_t *memfs = (memfs_t *)malloc(sizeof(memfs_t));
+	memfs->fs.ctx = memfs;
+	memfs->fs.stat = memfs_stat;
+	memfs->fs.open = memfs_open;
+	memfs->fs.read = memfs_read;
+	memfs->fs.write = memfs_write;
+	memfs->fs.close = memfs_close;
+	memfs->fs.unlink = memfs_unlink;
+	memfs->fs.list = memfs_list;
+	memfs->fs.flags = 0;
+	pthread_mutex_init(&memfs->lock, NULL);
+	memfs->nodes_cap = 64;
+	memfs->nodes = (memfs_node_t **)calloc(memfs->nodes_cap, sizeof(memfs_node_t *));
+	memfs->n_nodes = 0;
+	memfs->handles = NULL;
+	memfs->handles_cap = 0;
+	memfs->free_handle = -1;
+	memfs->clock = 0;
+	memfs->next_ino = 0;
+	memfs->root = memfs_add_node(memfs, NULL, strdup(""), 1);
+	return &memfs->fs;
+}
+
+void svc_fs_memory_free(svc_fs_t *fs) {
+	if (fs == NULL) {
+		return;
+	}
+	
+	memfs_t *memfs = (memfs_t *)fs->ctx;
+	for (int handle = 0; handle < memfs->handles_cap; handle++) {
+		if (memfs->handles[handle].file != NULL) {
+			memfs_release(memfs->handles[handle].file);
+		}
+	}
+	for (size_t slot_idx = 0; slot_idx < memfs->nodes_cap; slot_idx++) {
+		if (memfs->nodes[slot_idx] != NULL) {
+			memfs_release(memfs->nodes[slot_idx]);
+		}
+	}
+	free(memfs->handles);
+	free(memfs->nodes);
+	pthread_mutex_destroy(&memfs->lock);
+	free(memfs);
+}
+
+// Read the whole file from the working tree. Its length is stored in content_len, and the content
+// is followed by a null byte. If st is not NULL, the stat of the file is stored there.
+// Return NULL if it is not a regular file or can not be read.
+static unsigned char *fs_read_file(const svc_fs_t *fs, const char *file_name, struct stat *st, size_t *content_len) {
+	*content_len = 0;
+	struct stat file_st;
+	if (st == NULL) {
+		st = &file_st;
+	}
+	if (fs->stat(fs->ctx, file_name, st) != 0 || !S_ISREG(st->st_mode)) {
+		return NULL;
+	}
+	int handle = fs->open(fs->ctx, file_name, 0);
+	if (handle < 0) {
+		return NULL;
+	}
+	
+	unsigned char *content = (unsigned char *)malloc(st->st_size + 1);
+	if (content == NULL) {
+		fs->close(fs->ctx, handle);
+		return NULL;
+	}
+	while (*content_len < st->st_size) {
+		ssize_t n_read = fs->read(fs->ctx, handle, content + *content_len, st->st_size - *content_len);
+		if (n_read <= 0) {
+			break;
+		}
+		*content_len += n_read;
 	}
+	fs->close(fs->ctx, handle);
+	content[*content_len] = '\0';
 	
-	fread(file_content, sizeof(unsigned char), file_content_len, fptr);
+	return content;
+}
+
+// Write the content to the file of the working tree, creating its directories if needed.
+static int fs_write_file(const svc_fs_t *fs, const char *file_name, const unsigned char *content, size_t content_len) {
+	int handle = fs->open(fs->ctx, file_name, 1);
+	if (handle < 0) {
+		return -1;
+	}
 	
-	fclose(fptr);
+	size_t n_written = 0;
+	while (n_written < content_len) {
+		ssize_t n_bytes = fs->write(fs->ctx, handle, content + n_written, content_len - n_written);
+		if (n_bytes <= 0) {
+			break;
+		}
+		n_written += n_bytes;
+	}
+	fs->close(fs->ctx, handle);
 	
-	return file_content;	
+	return (n_written == content_len) ? 0 : -1;
 }
 
-static tracked_file_t *tracked_files_copy(size_t size, tracked_file_t *src_files) {
+// Read the whole file. Its length is stored in content_len, and the content is followed by a null byte.
+static unsigned char *file_content_copy(project_t *project, char *file_name, size_t *content_len) {
+	*content_len = 0;
+	if (file_name == NULL) {
+		return NULL;
+	}
+	return fs_read_file(&project->fs, file_name, NULL, content_len);
+}
+
+static tracked_file_t *tracked_files_copy(project_t *project, size_t size, tracked_file_t *src_files) {
+	TRACE_SCOPE("tracked_files_copy", NULL, size, 0);
 	tracked_file_t *new_files = malloc(sizeof(tracked_file_t) * size);
 	
 	for (int file_idx = 0; file_idx < size; file_idx++) {
 		new_files[file_idx].file_name = malloc(sizeof(char) * FILE_NAME_LEN);
 		strcpy(new_files[file_idx].file_name, src_files[file_idx].file_name);
-		new_files[file_idx].content = file_content_copy(new_files[file_idx].file_name);
+		new_files[file_idx].content = file_content_copy(project, new_files[file_idx].file_name, &new_files[file_idx].content_len);
 		memcpy(&new_files[file_idx].hash, &src_files[file_idx].hash, sizeof(new_files[file_idx].hash));
+		new_files[file_idx].fingerprint = src_files[file_idx].fingerprint;
+		new_files[file_idx].content_state = CONTENT_HEAP;
+		new_files[file_idx].spill_offset = -1;
+		new_files[file_idx].lru_prev = NULL;
+		new_files[file_idx].lru_next = NULL;
+		new_files[file_idx].pins = 0;
+		new_files[file_idx].base = NULL;
+		trace_scope.bytes += new_files[file_idx].content_len;
 	}
 	
 	return new_files;
 }
 
-static commit_node_t *node_copy(commit_node_t *src_node) {
+static commit_node_t *node_copy(project_t *project, commit_node_t *src_node) {
 	commit_node_t *new_node = (commit_node_t *)malloc(sizeof(commit_node_t));
 	new_node->branch_name = src_node->branch_name;
-	new_node->message = NULL;
-	new_node->commit_id = NULL;
-	new_node->tracked_files = tracked_files_copy(src_node->n_tracked_files, src_node->tracked_files);
+	new_node->commit_seq = COMMIT_NONE;
+	new_node->tracked_files = tracked_files_copy(project, src_node->n_tracked_files, src_node->tracked_files);
 	new_node->n_tracked_files = src_node->n_tracked_files;
 	new_node->n_next_commit = 0;
 	new_node->prev = src_node;
@@ -75,13 +812,12 @@ static commit_node_t *node_copy(commit_node_t *src_node) {
 	return new_node;
 }
 
-static commit_node_t *branch_node_copy(commit_node_t *src_node, char *branch_name) {
+static commit_node_t *branch_node_copy(project_t *project, commit_node_t *src_node, char *branch_name) {
 	commit_node_t *new_node = (commit_node_t *)malloc(sizeof(commit_node_t));
 	new_node->branch_name = malloc(sizeof(char) * BRANCH_NAME_LEN);
 	strcpy(new_node->branch_name, branch_name);
-	new_node->message = NULL;
-	new_node->commit_id = NULL;
-	new_node->tracked_files = tracked_files_copy(src_node->n_tracked_files, src_node->tracked_files);
+	new_node->commit_seq = COMMIT_NONE;
+	new_node->tracked_files = tracked_files_copy(project, src_node->n_tracked_files, src_node->tracked_files);
 	new_node->n_tracked_files = src_node->n_tracked_files;
 	new_node->n_next_commit = 0;
 	new_node->prev = src_node;
@@ -90,801 +826,6673 @@ static commit_node_t *branch_node_copy(commit_node_t *src_node, char *branch_nam
 	return new_node;
 }
 
+// Readers (get_commit, get_prev_commits, print_commit, list_branches) may run on other threads
+// while a single writer commits. They pin the current epoch in a reader slot and only look at
+// the published snapshot. The writer never changes anything a snapshot can see: it appends past
+// the published length, or copies into a bigger table and retires the old one. Retired memory is
+// freed once every pinned reader entered after it was retired.
+
+// Pin the current epoch. Return the reader slot that has to be passed to epoch_exit().
+static int epoch_enter(project_t *project) {
+	for (;;) {
+		for (int slot_idx = 0; slot_idx < EPOCH_MAX_READERS; slot_idx++) {
+			unsigned long idle = 0;
+			unsigned long epoch = atomic_load(&project->global_epoch);
+			if (atomic_compare_exchange_strong(&project->reader_epoch[slot_idx], &idle, epoch)) {
+				return slot_idx;
+			}
+		}
+		// Every slot is in use, wait for a reader to leave.
+		sched_yield();
+	}
+}
+
+static void epoch_exit(project_t *project, int slot_idx) {
+	atomic_store(&project->reader_epoch[slot_idx], 0);
+}
+
+// Free retired memory that no pinned reader can still see.
+static void epoch_reclaim(project_t *project) {
+	// Oldest epoch still pinned by a reader. 0 means no reader is active.
+	unsigned long min_epoch = 0;
+	for (int slot_idx = 0; slot_idx < EPOCH_MAX_READERS; slot_idx++) {
+		unsigned long epoch = atomic_load(&project->reader_epoch[slot_idx]);
+		if (epoch != 0 && (min_epoch == 0 || epoch < min_epoch)) {
+			min_epoch = epoch;
+		}
+	}
+	
+	size_t n_kept = 0;
+	for (int retired_idx = 0; retired_idx < project->n_retired; retired_idx++) {
+		if (min_epoch == 0 || project->retired[retired_idx].epoch < min_epoch) {
+			free(project->retired[retired_idx].ptr);
+		}else {
+			project->retired[n_kept++] = project->retired[retired_idx];
+		}
+	}
+	project->n_retired = n_kept;
+	if (project->n_retired == 0) {
+		free(project->retired);
+		project->retired = NULL;
+	}
+}
+
+// Hand memory that readers may still see to the reclaimer.
+static void epoch_retire(project_t *project, void *ptr) {
+	if (ptr == NULL) {
+		return;
+	}
+	
+	project->n_retired++;
+	if (project->n_retired == 1) {
+		project->retired = (retired_item_t *)malloc(sizeof(retired_item_t) * project->n_retired);
+	}else {
+		project->retired = (retired_item_t *)realloc(project->retired, sizeof(retired_item_t) * project->n_retired);
+	}
+	project->retired[project->n_retired - 1].ptr = ptr;
+	project->retired[project->n_retired - 1].epoch = atomic_load(&project->global_epoch);
+}
+
+// Publish the writer's commit and branch tables as a new snapshot for the readers.
+static void publish_snapshot(project_t *project) {
+	project_snapshot_t *snapshot = (project_snapshot_t *)malloc(sizeof(project_snapshot_t));
+	snapshot->commits = project->commits;
+	snapshot->n_total_commit = project->n_total_commit;
+	snapshot->commit_index = project->commit_index;
+	snapshot->commit_index_cap = project->commit_index_cap;
+	snapshot->branch_table = project->branch_table;
+	snapshot->n_total_branch = project->n_total_branch;
+	
+	project_snapshot_t *old_snapshot = atomic_exchange(&project->snapshot, snapshot);
+	epoch_retire(project, old_snapshot);
+	atomic_fetch_add(&project->global_epoch, 1);
+	epoch_reclaim(project);
+}
+
+// Make room for one more entry in a table that readers may be looking at.
+// A full table is copied into one twice the size and the old one is retired.
+static void *grow_table(project_t *project, void *table, size_t n_items, size_t *capacity, size_t item_size) {
+	if (n_items < *capacity) {
+		return table;
+	}
+	
+	*capacity = (*capacity == 0) ? 16 : *capacity * 2;
+	void *new_table = malloc(item_size * *capacity);
+	if (n_items > 0) {
+		memcpy(new_table, table, item_size * n_items);
+	}
+	epoch_retire(project, table);
+	
+	return new_table;
+}
+
 void *svc_init(void) {
+	return svc_init_ex(NULL);
+}
+
+// Like svc_init(), but the working tree is read and written through fs, which is copied.
+// If fs is NULL, the working tree is the current directory (svc_fs_posix()).
+void *svc_init_ex(const svc_fs_t *fs) {
+	TRACE_SCOPE("svc_init", NULL, TRACE_NONE, TRACE_NONE);
 	project_t *project = (project_t*)malloc(sizeof(project_t));
 	project->current_node = commit_node_init();
 	project->head = NULL;
 	project->root_node = project->current_node;
-	project->commit_table = NULL;
+	memset(&project->commits, 0, sizeof(project->commits));
 	project->n_total_commit = 0;
+	project->commit_index = NULL;
+	project->commit_index_cap = 0;
+	project->retired = NULL;
+	project->n_retired = 0;
+	atomic_init(&project->snapshot, NULL);
+	atomic_init(&project->global_epoch, 1);
+	for (int slot_idx = 0; slot_idx < EPOCH_MAX_READERS; slot_idx++) {
+		atomic_init(&project->reader_epoch[slot_idx], 0);
+	}
 	project->n_total_branch = 1;
-	project->branch_table = (branch_table_t *)malloc(sizeof(branch_table_t) * project->n_total_branch);
+	project->branch_table_cap = 16;
+	project->branch_table = (branch_table_t *)malloc(sizeof(branch_table_t) * project->branch_table_cap);
 	project->branch_table[0].branch_name = project->root_node->branch_name;
 	project->branch_table[0].branch_address = project->root_node;
+	publish_snapshot(project);
+	project->memory_budget = 0;
+	project->resident_bytes = 0;
+	project->content_pins = 0;
+	project->n_file_pins = 0;
+	project->spill_fd = -1;
+	project->spill_end = 0;
+	project->lru_head = NULL;
+	project->lru_tail = NULL;
+	project->path_logs = NULL;
+	project->n_path_logs = 0;
+	project->path_logs_cap = 0;
+	project->hash_cache = NULL;
+	project->n_hash_cache = 0;
+	project->hash_cache_cap = 0;
+	project->watch_fd = -1;
+	project->watch_dirs = NULL;
+	project->n_watch_dirs = 0;
+	project->watch_wd_index = NULL;
+	project->watch_name_index = NULL;
+	project->watch_index_cap = 0;
+	project->dirty_files = NULL;
+	project->n_dirty_files = 0;
+	project->dirty_index = NULL;
+	project->dirty_index_cap = 0;
+	project->watch_overflow = 0;
+	project->staging_index = NULL;
+	project->staging_index_cap = 0;
+	project->head_index = NULL;
+	project->head_index_cap = 0;
+	project->n_staging_changed = 0;
+	project->staging_synced = 0;
+	project->journal = NULL;
+	project->in_memory = 0;
+	project->commit_queue = NULL;
+	project->squash_names = NULL;
+	project->n_squash_names = 0;
+	project->fs = (fs == NULL) ? posix_fs : *fs;
 	return project;
 }
 
-// Clean up file's name and its content.
-static void cleanup_files(size_t size, tracked_file_t *src_files) {
-	for (int file_idx = 0; file_idx < size; file_idx++) {
-		free(src_files[file_idx].file_name);
-		free(src_files[file_idx].content);
+// Wait until every commit queued by svc_commit_async() is made. Calls that look at the commits
+// or the head wait first, so they see the project as if the commits had been made synchronously.
+// The commit thread itself, e.g. in a callback, does not wait for its own queue.
+static void commit_queue_wait(project_t *project) {
+	commit_queue_t *queue = project->commit_queue;
+	if (queue == NULL || pthread_equal(pthread_self(), queue->thread)) {
+		return;
 	}
+	pthread_mutex_lock(&queue->lock);
+	while (queue->next_job < queue->n_jobs || queue->running) {
+		pthread_cond_wait(&queue->idle, &queue->lock);
+	}
+	pthread_mutex_unlock(&queue->lock);
 }
 
-// Clean up branches.
+// Calls that only change the staging area (svc_add, svc_rm, svc_add_tree) or the bookkeeping
+// around it run while commits are queued, but not while the commit thread adds one.
+// With a journal the records have to stay in call order, so the queue is drained instead.
+static void commit_queue_lock(project_t *project) {
+	commit_queue_t *queue = project->commit_queue;
+	if (queue == NULL || pthread_equal(pthread_self(), queue->thread)) {
+		return;
+	}
+	if (project->journal != NULL) {
+		commit_queue_wait(project);
+	}
+	pthread_mutex_lock(&queue->write_lock);
+}
+
+static void commit_queue_unlock(project_t *project) {
+	commit_queue_t *queue = project->commit_queue;
+	if (queue == NULL || pthread_equal(pthread_self(), queue->thread)) {
+		return;
+	}
+	pthread_mutex_unlock(&queue->write_lock);
+}
+
+// Make the queued commits and stop the commit thread.
+static void commit_queue_close(project_t *project) {
+	commit_queue_t *queue = project->commit_queue;
+	if (queue == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&queue->lock);
+	queue->stop = 1;
+	pthread_cond_signal(&queue->wake);
+	pthread_mutex_unlock(&queue->lock);
+	pthread_join(queue->thread, NULL);
+	
+	pthread_mutex_destroy(&queue->write_lock);
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->wake);
+	pthread_cond_destroy(&queue->idle);
+	free(queue->jobs);
+	free(queue);
+	project->commit_queue = NULL;
+}
+
+// Stored content of committed files is kept under a memory budget. The least recently used
+// content is written to an append-only spill file and dropped from the heap. On the next access
+// it is mapped back in from the spill file. Only committed files are managed: the staging area
+// is always in memory, and its tracked file array moves when files are added or removed.
+
+// Page aligned start of the mapping that holds a mapped file's content.
+static unsigned char *content_map_base(tracked_file_t *file, size_t *map_len) {
+	off_t page_size = sysconf(_SC_PAGESIZE);
+	off_t delta = file->spill_offset % page_size;
+	*map_len = delta + file->content_len + 1;
+	return file->content - delta;
+}
+
+// Release the memory that holds the file's content, however it is stored.
+static void content_release(tracked_file_t *file) {
+	if (file->content_state == CONTENT_MAPPED) {
+		size_t map_len;
+		unsigned char *base = content_map_base(file, &map_len);
+		munmap(base, map_len);
+	}else if (file->content_state == CONTENT_HEAP) {
+		free(file->content);
+	}
+	file->content = NULL;
+}
+
+static void lru_unlink(project_t *project, tracked_file_t *file) {
+	if (file->lru_prev != NULL) {
+		file->lru_prev->lru_next = file->lru_next;
+	}else {
+		project->lru_head = file->lru_next;
+	}
+	if (file->lru_next != NULL) {
+		file->lru_next->lru_prev = file->lru_prev;
+	}else {
+		project->lru_tail = file->lru_prev;
+	}
+	file->lru_prev = NULL;
+	file->lru_next = NULL;
+}
+
+static void lru_push_front(project_t *project, tracked_file_t *file) {
+	file->lru_prev = NULL;
+	file->lru_next = project->lru_head;
+	if (project->lru_head != NULL) {
+		project->lru_head->lru_prev = file;
+	}
+	project->lru_head = file;
+	if (project->lru_tail == NULL) {
+		project->lru_tail = file;
+	}
+}
+
+// Move the least recently used content out of memory. Return -1 if it could not be spilled.
+static int content_evict(project_t *project, tracked_file_t *file) {
+	if (file->content_state == CONTENT_HEAP) {
+		// Content that was never spilled is appended to the spill file, with its null byte.
+		size_t pos = 0;
+		while (pos < file->content_len + 1) {
+			ssize_t n_written = pwrite(project->spill_fd, file->content + pos, file->content_len + 1 - pos, project->spill_end + pos);
+			if (n_written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			pos += n_written;
+		}
+		file->spill_offset = project->spill_end;
+		project->spill_end += file->content_len + 1;
+	}
+	
+	content_release(file);
+	file->content_state = CONTENT_SPILLED;
+	lru_unlink(project, file);
+	project->resident_bytes -= file->content_len + 1;
+	return 0;
+}
+
+// Spill content until the resident content fits the budget again. The content of keep, if it
+// is not NULL, stays in memory even if it alone is over the budget.
+static void content_enforce_budget_keep(project_t *project, tracked_file_t *keep) {
+	if (project->memory_budget == 0 || project->content_pins > 0) {
+		return;
+	}
+	while (project->resident_bytes > project->memory_budget && project->lru_tail != NULL && project->lru_tail != keep) {
+		if (content_evict(project, project->lru_tail) != 0) {
+			// The spill file is not usable, keep everything in memory.
+			break;
+		}
+	}
+}
+
+static void content_enforce_budget(project_t *project) {
+	content_enforce_budget_keep(project, NULL);
+}
+
+// The file that holds a file's content: the file itself, or the committed file it shares it with.
+static tracked_file_t *content_owner(tracked_file_t *file) {
+	return (file->base == NULL) ? file : file->base;
+}
+
+// Return the content of a file, mapping it back in if it was spilled, and mark it recently used.
+// The returned content itself is never spilled by this call. It stays valid until the budget is
+// enforced again, so a caller that holds it across another content_get() has to pin, see
+// content_pin().
+static unsigned char *content_get(project_t *project, tracked_file_t *file) {
+	file = content_owner(file);
+	if (file->content_state == CONTENT_SPILLED) {
+		off_t page_size = sysconf(_SC_PAGESIZE);
+		off_t delta = file->spill_offset % page_size;
+		unsigned char *base = mmap(NULL, delta + file->content_len + 1, PROT_READ, MAP_PRIVATE, project->spill_fd, file->spill_offset - delta);
+		if (base == MAP_FAILED) {
+			return NULL;
+		}
+		file->content = base + delta;
+		file->content_state = CONTENT_MAPPED;
+		project->resident_bytes += file->content_len + 1;
+		lru_push_front(project, file);
+		content_enforce_budget_keep(project, file);
+	}else if (file->content != NULL && project->lru_head != file && (file->lru_prev != NULL || file->lru_next != NULL)) {
+		lru_unlink(project, file);
+		lru_push_front(project, file);
+	}
+	
+	return file->content;
+}
+
+// While pinned, no content is spilled, so pointers from content_get() stay valid.
+static void content_pin(project_t *project) {
+	project->content_pins++;
+}
+
+static void content_unpin(project_t *project) {
+	project->content_pins--;
+	content_enforce_budget(project);
+}
+
+// Keep one file's content in memory, while the budget is still enforced on the others. The
+// content is taken off the LRU list, so it is never chosen for spilling. Pins are counted.
+static void content_pin_file(project_t *project, tracked_file_t *file) {
+	if (file->pins == 0 && (file->lru_prev != NULL || file->lru_next != NULL || project->lru_head == file)) {
+		lru_unlink(project, file);
+	}
+	file->pins++;
+	project->n_file_pins++;
+}
+
+static void content_unpin_file(project_t *project, tracked_file_t *file) {
+	file->pins--;
+	project->n_file_pins--;
+	// Committed content in memory is always on the LRU list when it is not pinned.
+	if (file->pins == 0 && file->content != NULL && file->content_state != CONTENT_SPILLED) {
+		lru_push_front(project, file);
+		content_enforce_budget(project);
+	}
+}
+
+// Put the contents of a newly committed node under the memory budget.
+static void content_track_node(project_t *project, commit_node_t *node) {
+	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+		tracked_file_t *file = &node->tracked_files[file_idx];
+		if (file->content == NULL || file->content_state != CONTENT_HEAP) {
+			continue;
+		}
+		lru_push_front(project, file);
+		project->resident_bytes += file->content_len + 1;
+	}
+	content_enforce_budget(project);
+}
+
+// Drop the content of a committed file that is going away, and stop counting it against the budget.
+static void content_forget(project_t *project, tracked_file_t *file) {
+	if (file->lru_prev != NULL || file->lru_next != NULL || project->lru_head == file) {
+		lru_unlink(project, file);
+		project->resident_bytes -= file->content_len + 1;
+	}
+	content_release(file);
+}
+
+// A range of the spill file, see spill_release().
+typedef struct spill_range{
+	off_t offset;
+	off_t len;
+}spill_range_t;
+
+static int compare_spill_range(const void *pa, const void *pb) {
+	const spill_range_t *p1 = (const spill_range_t *)pa;
+	const spill_range_t *p2 = (const spill_range_t *)pb;
+	return (p1->offset > p2->offset) - (p1->offset < p2->offset);
+}
+
+// Give the space of spilled contents that are gone back to the file system. The file keeps its
+// size and offsets. A punched range only frees the blocks it covers whole, so ranges next to each
+// other are punched together, and small contents free their blocks as a run.
+static void spill_release(project_t *project, spill_range_t *ranges, size_t n_ranges) {
+	if (project->spill_fd < 0 || n_ranges == 0) {
+		return;
+	}
+	qsort(ranges, n_ranges, sizeof(spill_range_t), compare_spill_range);
+	size_t range_idx = 0;
+	while (range_idx < n_ranges) {
+		off_t offset = ranges[range_idx].offset;
+		off_t end = offset + ranges[range_idx].len;
+		for (range_idx++; range_idx < n_ranges && ranges[range_idx].offset == end; range_idx++) {
+			end += ranges[range_idx].len;
+		}
+		syscall(SYS_fallocate, project->spill_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, end - offset);
+	}
+}
+
+// Limit the memory used by the stored content of committed files to budget bytes.
+// Cold content is spilled to a file created (and unlinked right away) in spill_dir,
+// or in /tmp if spill_dir is NULL. A budget of 0 means no limit.
+// Return 0, or -1 if the spill file could not be created.
+int svc_set_memory_budget(void *helper, size_t budget, char *spill_dir) {
+	TRACE_SCOPE("svc_set_memory_budget", spill_dir, TRACE_NONE, (long)budget);
+	project_t *project = (project_t*)helper;
+	commit_queue_lock(project);
+	
+	if (budget > 0 && project->spill_fd < 0) {
+		char spill_path[FILE_NAME_LEN + 32];
+		snprintf(spill_path, sizeof(spill_path), "%s/svc-spill-XXXXXX", spill_dir == NULL ? "/tmp" : spill_dir);
+		project->spill_fd = mkstemp(spill_path);
+		if (project->spill_fd < 0) {
+			commit_queue_unlock(project);
+			return -1;
+		}
+		unlink(spill_path);
+	}
+	
+	project->memory_budget = budget;
+	content_enforce_budget(project);
+	commit_queue_unlock(project);
+	return 0;
+}
+
+// Mutating operations are appended to the journal as records of a 16 byte header followed by
+// the payload: arguments, each as a 4 byte length followed by the bytes (strings with their null
+// byte), and fixed size integers. Every integer is in host byte order. The checksum covers the
+// payload, the op and the length, so a torn or damaged record ends the replay.
+#define JOURNAL_MAGIC 0x4a435653u
+#define JOURNAL_VERSION 2
+#define JOURNAL_HEADER_LEN 16
+#define JOURNAL_NULL_ARG 0xFFFFFFFFu
+
+typedef struct journal_header {
+	uint32_t len;
+	uint16_t op;
+	uint16_t flags;
+	uint64_t checksum;
+}journal_header_t;
+
+// Defined with the file hashes below.
+static uint64_t fingerprint_content(const unsigned char *content, size_t content_len, unsigned int *hash);
+static int watch_set(project_t *project, int enable);
+static int stage_add(void *helper, char *file_name);
+static int stage_rm(void *helper, char *file_name);
+static svc_add_result_t *stage_add_tree(void *helper, char *dir, char **filter, int *n_results);
+
+static uint64_t journal_checksum(const unsigned char *payload, uint32_t len, uint16_t op) {
+	unsigned int hash;
+	return fingerprint_content(payload, len, &hash) ^ (((uint64_t)op << 32) | len);
+}
+
+// Write the whole buffer, continuing after short writes. Return 0, or -1 if writing failed.
+static int write_all(int fd, const unsigned char *data, size_t data_len) {
+	size_t pos = 0;
+	while (pos < data_len) {
+		ssize_t n_written = write(fd, data + pos, data_len - pos);
+		if (n_written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		pos += n_written;
+	}
+	return 0;
+}
+
+// Write a batch of records and make it durable.
+static int journal_write_batch(journal_t *journal, const unsigned char *data, size_t data_len) {
+	if (write_all(journal->fd, data, data_len) != 0 || fdatasync(journal->fd) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+// Group commit: the flusher takes everything appended within the latency window as one batch,
+// so any number of records costs one write() and one fdatasync().
+static void *journal_flusher(void *arg) {
+	journal_t *journal = (journal_t *)arg;
+	
+	pthread_mutex_lock(&journal->lock);
+	while (journal->stop == 0 || journal->pending_len > 0) {
+		if (journal->pending_len == 0) {
+			pthread_cond_wait(&journal->wake, &journal->lock);
+			continue;
+		}
+		
+		// Let more records join the batch, unless a caller is waiting for it.
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += journal->window_us / 1000000;
+		deadline.tv_nsec += (journal->window_us % 1000000) * 1000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while (journal->stop == 0 && journal->sync_requested == 0) {
+			if (pthread_cond_timedwait(&journal->wake, &journal->lock, &deadline) == ETIMEDOUT) {
+				break;
+			}
+		}
+		
+		unsigned char *batch = journal->pending;
+		size_t batch_len = journal->pending_len;
+		size_t batch_cap = journal->pending_cap;
+		unsigned long batch_end = journal->appended;
+		journal->pending = journal->spare;
+		journal->pending_cap = journal->spare_cap;
+		journal->pending_len = 0;
+		journal->sync_requested = 0;
+		pthread_mutex_unlock(&journal->lock);
+		
+		int result = journal_write_batch(journal, batch, batch_len);
+		
+		pthread_mutex_lock(&journal->lock);
+		journal->spare = batch;
+		journal->spare_cap = batch_cap;
+		if (result != 0) {
+			journal->error = 1;
+		}
+		journal->durable = batch_end;
+		pthread_cond_broadcast(&journal->synced);
+	}
+	pthread_mutex_unlock(&journal->lock);
+	
+	return NULL;
+}
+
+static void journal_put(journal_t *journal, const void *data, size_t data_len) {
+	if (journal->pending_len + data_len > journal->pending_cap) {
+		journal->pending_cap = (journal->pending_cap == 0) ? 4096 : journal->pending_cap;
+		while (journal->pending_len + data_len > journal->pending_cap) {
+			journal->pending_cap *= 2;
+		}
+		journal->pending = (unsigned char *)realloc(journal->pending, journal->pending_cap);
+	}
+	memcpy(journal->pending + journal->pending_len, data, data_len);
+	journal->pending_len += data_len;
+}
+
+static void journal_put_u32(journal_t *journal, uint32_t value) {
+	journal_put(journal, &value, sizeof(value));
+}
+
+static void journal_put_u64(journal_t *journal, uint64_t value) {
+	journal_put(journal, &value, sizeof(value));
+}
+
+static void journal_put_bytes(journal_t *journal, const void *data, size_t data_len) {
+	journal_put_u32(journal, data_len);
+	journal_put(journal, data, data_len);
+}
+
+static void journal_put_arg(journal_t *journal, const char *arg) {
+	if (arg == NULL) {
+		journal_put_u32(journal, JOURNAL_NULL_ARG);
+		return;
+	}
+	journal_put_bytes(journal, arg, strlen(arg) + 1);
+}
+
+// Start a record. Return NULL if operations are not being logged.
+// Everything up to journal_end() is appended under the journal's lock.
+static journal_t *journal_begin(project_t *project) {
+	journal_t *journal = project->journal;
+	if (journal == NULL || journal->paused > 0) {
+		return NULL;
+	}
+	
+	pthread_mutex_lock(&journal->lock);
+	journal->record_start = journal->pending_len;
+	journal_header_t header = {0, 0, 0, 0};
+	journal_put(journal, &header, sizeof(header));
+	return journal;
+}
+
+// Finish the record and hand it to the flusher. With no latency window it is synced right away.
+static void journal_end(journal_t *journal, journal_op_t op) {
+	journal_header_t header;
+	unsigned char *record = journal->pending + journal->record_start;
+	header.len = journal->pending_len - journal->record_start - JOURNAL_HEADER_LEN;
+	header.op = op;
+	header.flags = 0;
+	header.checksum = journal_checksum(record + JOURNAL_HEADER_LEN, header.len, header.op);
+	memcpy(record, &header, sizeof(header));
+	journal->appended++;
+	
+	if (journal->has_flusher == 0) {
+		if (journal_write_batch(journal, journal->pending, journal->pending_len) != 0) {
+			journal->error = 1;
+		}
+		journal->pending_len = 0;
+		journal->durable = journal->appended;
+	}else if (journal->record_start == 0) {
+		// The flusher sleeps while there is nothing pending.
+		pthread_cond_signal(&journal->wake);
+	}
+	pthread_mutex_unlock(&journal->lock);
+}
+
+// Log an operation whose payload is just its string arguments.
+static void journal_log_args(project_t *project, journal_op_t op, int n_args, char **args) {
+	journal_t *journal = journal_begin(project);
+	if (journal == NULL) {
+		return;
+	}
+	for (int arg_idx = 0; arg_idx < n_args; arg_idx++) {
+		journal_put_arg(journal, args[arg_idx]);
+	}
+	journal_end(journal, op);
+}
+
+static void journal_pause(project_t *project) {
+	if (project->journal != NULL) {
+		project->journal->paused++;
+	}
+}
+
+static void journal_resume(project_t *project) {
+	if (project->journal != NULL) {
+		project->journal->paused--;
+	}
+}
+
+// Make everything logged so far durable. Return 0, or -1 if writing the journal failed.
+int svc_journal_sync(void *helper) {
+	TRACE_SCOPE("svc_journal_sync", NULL, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_wait(project);
+	journal_t *journal = project->journal;
+	if (journal == NULL) {
+		return -1;
+	}
+	
+	pthread_mutex_lock(&journal->lock);
+	unsigned long target = journal->appended;
+	if (journal->durable < target) {
+		journal->sync_requested = 1;
+		pthread_cond_signal(&journal->wake);
+		while (journal->durable < target) {
+			pthread_cond_wait(&journal->synced, &journal->lock);
+		}
+	}
+	int result = (journal->error == 0) ? 0 : -1;
+	pthread_mutex_unlock(&journal->lock);
+	
+	return result;
+}
+
+// Flush what is pending, stop the flusher and close the journal.
+static void journal_close(project_t *project) {
+	journal_t *journal = project->journal;
+	if (journal == NULL) {
+		return;
+	}
+	
+	if (journal->has_flusher) {
+		pthread_mutex_lock(&journal->lock);
+		journal->stop = 1;
+		pthread_cond_signal(&journal->wake);
+		pthread_mutex_unlock(&journal->lock);
+		pthread_join(journal->flusher, NULL);
+	}
+	close(journal->fd);
+	pthread_mutex_destroy(&journal->lock);
+	pthread_cond_destroy(&journal->wake);
+	pthread_cond_destroy(&journal->synced);
+	free(journal->pending);
+	free(journal->spare);
+	free(journal);
+	project->journal = NULL;
+}
+
+// Clean up file's name and its content.
+static void cleanup_files(size_t size, tracked_file_t *src_files) {
+	for (int file_idx = 0; file_idx < size; file_idx++) {
+		free(src_files[file_idx].file_name);
+		content_release(&src_files[file_idx]);
+	}
+}
+
+// Clean up branches.
 static void cleanup_branch(void *helper) {
 	project_t *project = (project_t*)helper;
 	commit_node_t *current_node = NULL;
-	commit_node_t *prev_node = NULL;
-	commit_node_t * temp_node = NULL;
-	// Total number of previous commits before staging area.
-	size_t n_prev_node = 0;
 	
 	// Find the branch's root node from the branch table.
 	for (int branch_idx = 0; branch_idx < project->n_total_branch; branch_idx++) {
 		current_node = project->branch_table[branch_idx].branch_address;
 		
 		// Move to the staging area
-		while (current_node->commit_id != NULL) {
+		while (current_node->commit_seq != COMMIT_NONE) {
 			if (current_node->next[0] != NULL) {
-				n_prev_node++;
 				current_node = current_node->next[0];
 			}
 		}
 		
-		// The latest commit node in the branch.
-		prev_node = current_node->prev; 
-		
 		// Free staging area.
 		free(current_node->branch_name);
 		cleanup_files(current_node->n_tracked_files, current_node->tracked_files);
 		free(current_node->tracked_files);
+		free(current_node->actions);
 		free(current_node);
-		
-		// Free every commit nodes in the branch.
-		for (int node_idx = 0; node_idx < n_prev_node; node_idx++) {
-			temp_node = prev_node->prev;
-			cleanup_files(prev_node->n_tracked_files, prev_node->tracked_files);
-			free(prev_node->tracked_files);
-			free(prev_node->actions);
-			free(prev_node->next);
-			free(prev_node->message);
-			free(prev_node->commit_id);
-			free(prev_node);
-			prev_node = temp_node;
+	}
+	
+	// Free every commit node. After svc_reset() a staging area's previous node is not
+	// necessarily the one before it in its branch, so they are taken from the commit metadata.
+	for (uint32_t commit_idx = 0; commit_idx < project->n_total_commit; commit_idx++) {
+		current_node = project->commits.nodes[commit_idx];
+		cleanup_files(current_node->n_tracked_files, current_node->tracked_files);
+		free(current_node->tracked_files);
+		free(current_node->next);
+		free(current_node);
+	}
+}
+
+void cleanup(void *helper) {
+	TRACE_SCOPE("cleanup", NULL, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_close(project);
+	watch_set(project, 0);
+	journal_close(project);
+	cleanup_branch(helper);
+	if (project->spill_fd >= 0) {
+		close(project->spill_fd);
+	}
+	// No reader can be active any more, so everything retired can go.
+	epoch_reclaim(project);
+	free(project->retired);
+	free(atomic_load(&project->snapshot));
+	for (int log_idx = 0; log_idx < project->path_logs_cap; log_idx++) {
+		free(project->path_logs[log_idx].file_name);
+		free(project->path_logs[log_idx].commits);
+	}
+	free(project->path_logs);
+	for (int cache_idx = 0; cache_idx < project->hash_cache_cap; cache_idx++) {
+		free(project->hash_cache[cache_idx].file_name);
+	}
+	free(project->hash_cache);
+	free(project->dirty_index);
+	free(project->staging_index);
+	free(project->head_index);
+	for (size_t name_idx = 0; name_idx < project->n_squash_names; name_idx++) {
+		free(project->squash_names[name_idx]);
+	}
+	free(project->squash_names);
+	free(project->commits.ids);
+	free(project->commits.parents);
+	free(project->commits.branches);
+	free(project->commits.message_offs);
+	free(project->commits.action_starts);
+	free(project->commits.action_counts);
+	free(project->commits.path_blooms);
+	free(project->commits.nodes);
+	free(project->commits.seqs);
+	free(project->commits.messages);
+	free(project->commits.actions);
+	for (size_t chunk_idx = 0; chunk_idx < project->commits.n_hex_chunks; chunk_idx++) {
+		free(project->commits.hex_chunks[chunk_idx]);
+	}
+	free(project->commits.hex_chunks);
+	free(project->commit_index);
+	free(project->branch_table);
+	free(project);
+}
+
+// Find the hash cache slot of the path, or the empty slot where it belongs.
+static hash_cache_entry_t *hash_cache_slot(hash_cache_entry_t *cache, size_t cap, const char *file_name) {
+	size_t slot_idx = path_hash(file_name) & (cap - 1);
+	while (cache[slot_idx].file_name != NULL && strcmp(cache[slot_idx].file_name, file_name) != 0) {
+		slot_idx = (slot_idx + 1) & (cap - 1);
+	}
+	return &cache[slot_idx];
+}
+
+// Put a file of the array into its path index. The index must have room for it.
+static void file_index_insert(size_t *index, size_t index_cap, const tracked_file_t *files, size_t file_idx) {
+	size_t slot_idx = path_hash(files[file_idx].file_name) & (index_cap - 1);
+	while (index[slot_idx] != 0) {
+		slot_idx = (slot_idx + 1) & (index_cap - 1);
+	}
+	index[slot_idx] = file_idx + 1;
+}
+
+// Index of a tracked file array by path: an open addressing table at most half full, whose slots
+// hold the file index plus one (0 marks an empty slot).
+static void file_index_build(size_t **index, size_t *index_cap, const tracked_file_t *files, size_t n_files) {
+	size_t cap = 64;
+	while (cap < n_files * 2) {
+		cap *= 2;
+	}
+	if (cap != *index_cap) {
+		free(*index);
+		*index = (size_t *)malloc(sizeof(size_t) * cap);
+		*index_cap = cap;
+	}
+	memset(*index, 0, sizeof(size_t) * cap);
+	for (size_t file_idx = 0; file_idx < n_files; file_idx++) {
+		file_index_insert(*index, cap, files, file_idx);
+	}
+}
+
+// Find the file with the path in an indexed array, or return NULL.
+static tracked_file_t *file_index_find(const size_t *index, size_t index_cap, tracked_file_t *files, const char *file_name) {
+	if (index_cap == 0) {
+		return NULL;
+	}
+	size_t slot_idx = path_hash(file_name) & (index_cap - 1);
+	while (index[slot_idx] != 0) {
+		tracked_file_t *file = &files[index[slot_idx] - 1];
+		if (strcmp(file->file_name, file_name) == 0) {
+			return file;
+		}
+		slot_idx = (slot_idx + 1) & (index_cap - 1);
+	}
+	return NULL;
+}
+
+// Check if a staged file is not in the head with the same content. Needs staging_sync().
+static int staging_file_changed(project_t *project, const tracked_file_t *file) {
+	commit_node_t *head = project->head;
+	if (head == NULL) {
+		return 1;
+	}
+	const tracked_file_t *head_file = file_index_find(project->head_index, project->head_index_cap, head->tracked_files, file->file_name);
+	return head_file == NULL || head_file->fingerprint != file->fingerprint || head_file->hash != file->hash;
+}
+
+// The staging area files or the head changed in a way staging_sync() can not see by itself
+// (files replaced in place), so rebuild the indexes on the next use.
+static void staging_invalidate(project_t *project) {
+	project->staging_synced = 0;
+}
+
+// Bring the path indexes and the changed count up to date with the staging area and the head.
+// They are only rebuilt after the file list or the head changed, refresh_hashes() keeps the
+// count current as files change.
+static void staging_sync(project_t *project) {
+	commit_node_t *node = project->current_node;
+	commit_node_t *head = project->head;
+	if (project->staging_synced == 1 && project->synced_node == node && project->synced_head == head &&
+	   project->synced_files == node->tracked_files && project->synced_n_files == node->n_tracked_files
+	){
+		return;
+	}
+	
+	file_index_build(&project->staging_index, &project->staging_index_cap, node->tracked_files, node->n_tracked_files);
+	if (head != NULL) {
+		file_index_build(&project->head_index, &project->head_index_cap, head->tracked_files, head->n_tracked_files);
+	}
+	project->n_staging_changed = 0;
+	for (size_t file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+		project->n_staging_changed += staging_file_changed(project, &node->tracked_files[file_idx]);
+	}
+	project->staging_synced = 1;
+	project->synced_node = node;
+	project->synced_head = head;
+	project->synced_files = node->tracked_files;
+	project->synced_n_files = node->n_tracked_files;
+}
+
+// Put the file just appended to the staging area into the indexes, so adding files one by one
+// does not rebuild them every time. Needs staging_sync() before the file was appended.
+static void staging_sync_appended(project_t *project) {
+	commit_node_t *node = project->current_node;
+	size_t file_idx = node->n_tracked_files - 1;
+	if (project->staging_synced == 0 || project->synced_node != node || project->synced_n_files != file_idx ||
+	   node->n_tracked_files * 2 > project->staging_index_cap
+	){
+		staging_invalidate(project);
+		return;
+	}
+	file_index_insert(project->staging_index, project->staging_index_cap, node->tracked_files, file_idx);
+	project->n_staging_changed += staging_file_changed(project, &node->tracked_files[file_idx]);
+	project->synced_files = node->tracked_files;
+	project->synced_n_files = node->n_tracked_files;
+}
+
+// Return the cached hash if the file has not changed since it was hashed, otherwise -1.
+static long hash_cache_lookup(project_t *project, char *file_name, struct stat *st, uint64_t *fingerprint) {
+	if (project->hash_cache_cap == 0) {
+		return -1;
+	}
+	
+	hash_cache_entry_t *entry = hash_cache_slot(project->hash_cache, project->hash_cache_cap, file_name);
+	if (entry->file_name == NULL ||
+	   entry->dev != st->st_dev || entry->ino != st->st_ino || entry->size != st->st_size ||
+	   entry->mtime.tv_sec != st->st_mtim.tv_sec || entry->mtime.tv_nsec != st->st_mtim.tv_nsec ||
+	   entry->ctime.tv_sec != st->st_ctim.tv_sec || entry->ctime.tv_nsec != st->st_ctim.tv_nsec
+	){
+		return -1;
+	}
+	
+	*fingerprint = entry->fingerprint;
+	return entry->hash;
+}
+
+// Remember the hash of a file together with its stat information.
+static void hash_cache_store(project_t *project, char *file_name, struct stat *st, unsigned int hash, uint64_t fingerprint) {
+	// A file changed within the last couple of seconds may change again without a visible
+	// timestamp change (coarse file system clocks), so it is not trusted yet.
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (now.tv_sec - st->st_mtim.tv_sec < 2 || now.tv_sec - st->st_ctim.tv_sec < 2) {
+		return;
+	}
+	
+	// Keep the table at most half full.
+	if ((project->n_hash_cache + 1) * 2 > project->hash_cache_cap) {
+		size_t new_cap = (project->hash_cache_cap == 0) ? 64 : project->hash_cache_cap * 2;
+		hash_cache_entry_t *new_cache = (hash_cache_entry_t *)calloc(new_cap, sizeof(hash_cache_entry_t));
+		for (int cache_idx = 0; cache_idx < project->hash_cache_cap; cache_idx++) {
+			if (project->hash_cache[cache_idx].file_name != NULL) {
+				*hash_cache_slot(new_cache, new_cap, project->hash_cache[cache_idx].file_name) = project->hash_cache[cache_idx];
+			}
+		}
+		free(project->hash_cache);
+		project->hash_cache = new_cache;
+		project->hash_cache_cap = new_cap;
+	}
+	
+	hash_cache_entry_t *entry = hash_cache_slot(project->hash_cache, project->hash_cache_cap, file_name);
+	if (entry->file_name == NULL) {
+		entry->file_name = strdup(file_name);
+		project->n_hash_cache++;
+	}
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->size = st->st_size;
+	entry->mtime = st->st_mtim;
+	entry->ctime = st->st_ctim;
+	entry->hash = hash;
+	entry->fingerprint = fingerprint;
+}
+
+#define FP_PRIME1 11400714785074694791ULL
+#define FP_PRIME2 14029467366897019727ULL
+#define FP_PRIME3 1609587929392839161ULL
+#define FP_PRIME4 9650029242287828579ULL
+#define FP_PRIME5 2870177450012600261ULL
+
+static uint64_t fp_rotl(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t fp_round(uint64_t acc, uint64_t input) {
+	acc += input * FP_PRIME2;
+	acc = fp_rotl(acc, 31);
+	return acc * FP_PRIME1;
+}
+
+static uint64_t fp_merge(uint64_t acc, uint64_t lane) {
+	acc ^= fp_round(0, lane);
+	return acc * FP_PRIME1 + FP_PRIME4;
+}
+
+// Compute the 64 bit fingerprint (XXH64) of the content and, in the same pass, add its bytes
+// to the legacy hash. The legacy hash is a plain sum modulo 2000000000, so the bytes are summed
+// in 64 bits and reduced once at the end.
+static uint64_t fingerprint_content(const unsigned char *content, size_t content_len, unsigned int *hash) {
+	const unsigned char *ptr = content;
+	const unsigned char *end = content + content_len;
+	uint64_t byte_sum = 0;
+	uint64_t fingerprint;
+	
+	if (content_len >= 32) {
+		// Four independent lanes over 32 byte stripes.
+		uint64_t lane1 = FP_PRIME1 + FP_PRIME2;
+		uint64_t lane2 = FP_PRIME2;
+		uint64_t lane3 = 0;
+		uint64_t lane4 = -FP_PRIME1;
+		for (; ptr + 32 <= end; ptr += 32) {
+			uint64_t words[4];
+			memcpy(words, ptr, 32);
+			lane1 = fp_round(lane1, words[0]);
+			lane2 = fp_round(lane2, words[1]);
+			lane3 = fp_round(lane3, words[2]);
+			lane4 = fp_round(lane4, words[3]);
+			for (int byte_idx = 0; byte_idx < 32; byte_idx++) {
+				byte_sum += ptr[byte_idx];
+			}
+		}
+		fingerprint = fp_rotl(lane1, 1) + fp_rotl(lane2, 7) + fp_rotl(lane3, 12) + fp_rotl(lane4, 18);
+		fingerprint = fp_merge(fingerprint, lane1);
+		fingerprint = fp_merge(fingerprint, lane2);
+		fingerprint = fp_merge(fingerprint, lane3);
+		fingerprint = fp_merge(fingerprint, lane4);
+	}else {
+		fingerprint = FP_PRIME5;
+	}
+	fingerprint += content_len;
+	
+	for (; ptr + 8 <= end; ptr += 8) {
+		uint64_t word;
+		memcpy(&word, ptr, 8);
+		fingerprint ^= fp_round(0, word);
+		fingerprint = fp_rotl(fingerprint, 27) * FP_PRIME1 + FP_PRIME4;
+		for (int byte_idx = 0; byte_idx < 8; byte_idx++) {
+			byte_sum += ptr[byte_idx];
+		}
+	}
+	if (ptr + 4 <= end) {
+		uint32_t word;
+		memcpy(&word, ptr, 4);
+		fingerprint ^= (uint64_t)word * FP_PRIME1;
+		fingerprint = fp_rotl(fingerprint, 23) * FP_PRIME2 + FP_PRIME3;
+		for (int byte_idx = 0; byte_idx < 4; byte_idx++) {
+			byte_sum += ptr[byte_idx];
+		}
+		ptr += 4;
+	}
+	for (; ptr < end; ptr++) {
+		fingerprint ^= *ptr * FP_PRIME5;
+		fingerprint = fp_rotl(fingerprint, 11) * FP_PRIME1;
+		byte_sum += *ptr;
+	}
+	
+	fingerprint ^= fingerprint >> 33;
+	fingerprint *= FP_PRIME2;
+	fingerprint ^= fingerprint >> 29;
+	fingerprint *= FP_PRIME3;
+	fingerprint ^= fingerprint >> 32;
+	
+	*hash = (*hash + byte_sum) % 2000000000;
+	return fingerprint;
+}
+
+// Hash of a file with the given path and content, see hash_file().
+static int content_hash(const char *file_path, const unsigned char *content, size_t content_len, uint64_t *fingerprint) {
+	// Calculate hash value of the file_path.
+	unsigned int file_path_len = strlen(file_path);
+	unsigned int hash = 0;
+	for (int i = 0; i < file_path_len; i++) {
+        hash += file_path[i];
+        hash = (hash % 1000);
+
+	}
+	
+	// Calculate hash value and fingerprint of the file content.
+	*fingerprint = fingerprint_content(content, content_len, &hash);
+	return hash;
+}
+
+// Read the file and compute its hash (see hash_file()) and content fingerprint.
+static int compute_file_hash(const svc_fs_t *fs, char *file_path, uint64_t *fingerprint) {
+	TRACE_SCOPE("compute_file_hash", file_path, TRACE_NONE, TRACE_NONE);
+	*fingerprint = 0;
+	
+	// Make sure that characters in the file always treated as unsigned value. (e.g. special characters)
+	size_t file_content_len;
+	unsigned char *file_content = fs_read_file(fs, file_path, NULL, &file_content_len);
+	
+	// If no file exists at the given path, return -2
+	if (file_content == NULL) {
+		return -2;
+	}
+	
+	int hash = content_hash(file_path, file_content, file_content_len, fingerprint);
+	trace_scope.bytes = file_content_len;
+	
+	free(file_content);
+	
+	return hash;
+}
+
+// Same as hash_file(), but also return the content fingerprint of the file (0 on error).
+static int hash_file_ex(void *helper, char *file_path, uint64_t *fingerprint) {
+	*fingerprint = 0;
+	
+	// If file_path is NULL, return -1.
+	if (file_path == NULL) {
+		return -1;
+	}
+	
+	project_t *project = (project_t*)helper;
+	if (project == NULL) {
+		return compute_file_hash(&posix_fs, file_path, fingerprint);
+	}
+	
+	// If no file exists at the given path, return -2
+	struct stat st;
+	if (project->fs.stat(project->fs.ctx, file_path, &st) != 0) {
+		return -2;
+	}
+	
+	// Files that did not change since they were last hashed are not read again.
+	long cached_hash = hash_cache_lookup(project, file_path, &st, fingerprint);
+	if (cached_hash >= 0) {
+		return cached_hash;
+	}
+	
+	int hash = compute_file_hash(&project->fs, file_path, fingerprint);
+	if (hash >= 0) {
+		hash_cache_store(project, file_path, &st, hash, *fingerprint);
+	}
+	
+	return hash;
+}
+
+int hash_file(void *helper, char *file_path) {
+	TRACE_SCOPE("hash_file", file_path, TRACE_NONE, TRACE_NONE);
+	// The commit thread does not use the hash cache, so this does not wait for queued commits.
+	uint64_t fingerprint;
+	return hash_file_ex(helper, file_path, &fingerprint);
+}
+
+// Forget every dirty path collected from the watch events.
+static void clear_dirty_files(project_t *project) {
+	for (int dirty_idx = 0; dirty_idx < project->n_dirty_files; dirty_idx++) {
+		free(project->dirty_files[dirty_idx]);
+	}
+	free(project->dirty_files);
+	if (project->n_dirty_files > 0) {
+		memset(project->dirty_index, 0, sizeof(size_t) * project->dirty_index_cap);
+	}
+	project->dirty_files = NULL;
+	project->n_dirty_files = 0;
+}
+
+// Put the path into the dirty set unless it is already there.
+// Too many dirty paths make the set slower than a full scan, so give up and mark overflow.
+static void add_dirty_file(project_t *project, char *file_name) {
+	if (project->watch_overflow == 1) {
+		return;
+	}
+	
+	// Keep the set at most half full.
+	if ((project->n_dirty_files + 1) * 2 > project->dirty_index_cap) {
+		size_t new_cap = (project->dirty_index_cap == 0) ? 64 : project->dirty_index_cap * 2;
+		free(project->dirty_index);
+		project->dirty_index = (size_t *)calloc(new_cap, sizeof(size_t));
+		project->dirty_index_cap = new_cap;
+		for (size_t dirty_idx = 0; dirty_idx < project->n_dirty_files; dirty_idx++) {
+			size_t slot_idx = path_hash(project->dirty_files[dirty_idx]) & (new_cap - 1);
+			while (project->dirty_index[slot_idx] != 0) {
+				slot_idx = (slot_idx + 1) & (new_cap - 1);
+			}
+			project->dirty_index[slot_idx] = dirty_idx + 1;
+		}
+	}
+	
+	size_t slot_idx = path_hash(file_name) & (project->dirty_index_cap - 1);
+	while (project->dirty_index[slot_idx] != 0) {
+		if (strcmp(project->dirty_files[project->dirty_index[slot_idx] - 1], file_name) == 0) {
+			return;
+		}
+		slot_idx = (slot_idx + 1) & (project->dirty_index_cap - 1);
+	}
+	
+	if (project->n_dirty_files == WATCH_DIRTY_MAX) {
+		clear_dirty_files(project);
+		project->watch_overflow = 1;
+		return;
+	}
+	
+	project->n_dirty_files++;
+	if (project->n_dirty_files == 1) {
+		project->dirty_files = (char **)malloc(sizeof(char *) * project->n_dirty_files);
+	}else {
+		project->dirty_files = (char **)realloc(project->dirty_files, sizeof(char *) * project->n_dirty_files);
+	}
+	project->dirty_files[project->n_dirty_files - 1] = strdup(file_name);
+	project->dirty_index[slot_idx] = project->n_dirty_files;
+}
+
+static size_t watch_wd_slot(int wd, size_t cap) {
+	return (size_t)(((uint64_t)(uint32_t)wd * 0x9E3779B97F4A7C15ULL) >> 32) & (cap - 1);
+}
+
+// First entry of watch_dirs with the wd, or -1.
+static int watch_wd_find(project_t *project, int wd) {
+	if (project->watch_index_cap == 0) {
+		return -1;
+	}
+	size_t slot_idx = watch_wd_slot(wd, project->watch_index_cap);
+	while (project->watch_wd_index[slot_idx] != 0) {
+		size_t dir_idx = project->watch_wd_index[slot_idx] - 1;
+		if (project->watch_dirs[dir_idx].wd == wd) {
+			return dir_idx;
+		}
+		slot_idx = (slot_idx + 1) & (project->watch_index_cap - 1);
+	}
+	return -1;
+}
+
+// Entry of watch_dirs with the dir_name, or -1.
+static int watch_name_find(project_t *project, const char *dir_name) {
+	if (project->watch_index_cap == 0) {
+		return -1;
+	}
+	size_t slot_idx = path_hash(dir_name) & (project->watch_index_cap - 1);
+	while (project->watch_name_index[slot_idx] != 0) {
+		size_t dir_idx = project->watch_name_index[slot_idx] - 1;
+		if (strcmp(project->watch_dirs[dir_idx].dir_name, dir_name) == 0) {
+			return dir_idx;
+		}
+		slot_idx = (slot_idx + 1) & (project->watch_index_cap - 1);
+	}
+	return -1;
+}
+
+// Put an entry of watch_dirs into the indexes. Only the first entry of a wd goes into the wd index.
+static void watch_index_insert(project_t *project, size_t dir_idx) {
+	size_t cap = project->watch_index_cap;
+	if (watch_wd_find(project, project->watch_dirs[dir_idx].wd) < 0) {
+		size_t slot_idx = watch_wd_slot(project->watch_dirs[dir_idx].wd, cap);
+		while (project->watch_wd_index[slot_idx] != 0) {
+			slot_idx = (slot_idx + 1) & (cap - 1);
+		}
+		project->watch_wd_index[slot_idx] = dir_idx + 1;
+	}
+	size_t slot_idx = path_hash(project->watch_dirs[dir_idx].dir_name) & (cap - 1);
+	while (project->watch_name_index[slot_idx] != 0) {
+		slot_idx = (slot_idx + 1) & (cap - 1);
+	}
+	project->watch_name_index[slot_idx] = dir_idx + 1;
+}
+
+// Register an inotify watch on the directory that contains the given file.
+static void watch_add_dir(project_t *project, char *file_name) {
+	if (project->watch_fd < 0) {
+		return;
+	}
+	
+	// Directory part of the path as it is spelled, with its slash.
+	char dir_name[FILE_NAME_LEN];
+	char *slash = strrchr(file_name, '/');
+	size_t dir_len = (slash == NULL) ? 0 : slash - file_name + 1;
+	memcpy(dir_name, file_name, dir_len);
+	dir_name[dir_len] = '\0';
+	if (watch_name_find(project, dir_name) >= 0) {
+		return;
+	}
+	
+	// inotify gives every spelling of a directory the same wd.
+	char watch_path[FILE_NAME_LEN];
+	if (dir_len == 0) {
+		strcpy(watch_path, ".");
+	}else if (dir_len == 1) {
+		strcpy(watch_path, "/");
+	}else {
+		memcpy(watch_path, dir_name, dir_len - 1);
+		watch_path[dir_len - 1] = '\0';
+	}
+	int wd = inotify_add_watch(project->watch_fd, watch_path, IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+	// Without a watch this directory can not be trusted, so fall back to a full scan.
+	if (wd < 0) {
+		project->watch_overflow = 1;
+		return;
+	}
+	
+	project->n_watch_dirs++;
+	if (project->n_watch_dirs == 1) {
+		project->watch_dirs = (watch_dir_t *)malloc(sizeof(watch_dir_t) * project->n_watch_dirs);
+	}else {
+		project->watch_dirs = (watch_dir_t *)realloc(project->watch_dirs, sizeof(watch_dir_t) * project->n_watch_dirs);
+	}
+	size_t dir_idx = project->n_watch_dirs - 1;
+	project->watch_dirs[dir_idx].wd = wd;
+	project->watch_dirs[dir_idx].dir_name = strdup(dir_name);
+	project->watch_dirs[dir_idx].next_same_wd = -1;
+	int first_idx = watch_wd_find(project, wd);
+	if (first_idx >= 0) {
+		project->watch_dirs[dir_idx].next_same_wd = project->watch_dirs[first_idx].next_same_wd;
+		project->watch_dirs[first_idx].next_same_wd = dir_idx;
+	}
+	
+	if (project->n_watch_dirs * 2 > project->watch_index_cap) {
+		size_t cap = (project->watch_index_cap == 0) ? 64 : project->watch_index_cap * 2;
+		free(project->watch_wd_index);
+		free(project->watch_name_index);
+		project->watch_wd_index = (size_t *)calloc(cap, sizeof(size_t));
+		project->watch_name_index = (size_t *)calloc(cap, sizeof(size_t));
+		project->watch_index_cap = cap;
+		for (size_t index_idx = 0; index_idx < project->n_watch_dirs; index_idx++) {
+			watch_index_insert(project, index_idx);
+		}
+	}else {
+		watch_index_insert(project, dir_idx);
+	}
+}
+
+// Read every pending inotify event and move the touched paths into the dirty set.
+static void drain_watch_events(project_t *project) {
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	
+	for (;;) {
+		ssize_t len = read(project->watch_fd, buf, sizeof(buf));
+		if (len <= 0) {
+			// EAGAIN means the queue is empty. Anything else leaves the state unknown.
+			if (len < 0 && errno != EAGAIN && errno != EINTR) {
+				project->watch_overflow = 1;
+			}
+			if (len < 0 && errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		
+		for (char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+			const struct inotify_event *event = (struct inotify_event *)ptr;
+			
+			// Lost events or a watched directory that went away, the next check must scan everything.
+			if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+				project->watch_overflow = 1;
+				continue;
+			}
+			if (event->len == 0) {
+				continue;
+			}
+			
+			// The file is dirty under every spelling of its directory.
+			for (int dir_idx = watch_wd_find(project, event->wd); dir_idx >= 0; dir_idx = project->watch_dirs[dir_idx].next_same_wd) {
+				char file_name[FILE_NAME_LEN];
+				snprintf(file_name, FILE_NAME_LEN, "%s%s", project->watch_dirs[dir_idx].dir_name, event->name);
+				add_dirty_file(project, file_name);
+			}
+		}
+	}
+}
+
+int svc_watch(void *helper, int enable) {
+	TRACE_SCOPE("svc_watch", NULL, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_lock(project);
+	int result = watch_set(project, enable);
+	commit_queue_unlock(project);
+	return result;
+}
+
+// svc_watch() without the write lock.
+static int watch_set(project_t *project, int enable) {
+	if (enable == 0) {
+		if (project->watch_fd >= 0) {
+			close(project->watch_fd);
+		}
+		for (int dir_idx = 0; dir_idx < project->n_watch_dirs; dir_idx++) {
+			free(project->watch_dirs[dir_idx].dir_name);
+		}
+		free(project->watch_dirs);
+		free(project->watch_wd_index);
+		free(project->watch_name_index);
+		clear_dirty_files(project);
+		project->watch_fd = -1;
+		project->watch_dirs = NULL;
+		project->n_watch_dirs = 0;
+		project->watch_wd_index = NULL;
+		project->watch_name_index = NULL;
+		project->watch_index_cap = 0;
+		project->watch_overflow = 0;
+		return 0;
+	}
+	
+	if (project->watch_fd >= 0) {
+		return 0;
+	}
+	
+	// inotify only sees the local working tree, other backends keep scanning every file.
+	if ((project->fs.flags & SVC_FS_LOCAL) == 0) {
+		return -1;
+	}
+	
+	// If inotify is not available, return -1 and keep scanning every file.
+	project->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (project->watch_fd < 0) {
+		return -1;
+	}
+	
+	commit_node_t *node = project->current_node;
+	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+		watch_add_dir(project, node->tracked_files[file_idx].file_name);
+	}
+	// Changes made before the watches existed are unknown, so the first check scans everything.
+	project->watch_overflow = 1;
+	
+	return 0;
+}
+
+// Re-hash a staged file. If its hash changed, its content is read again, so the staged content
+// is always the one its hash was computed from, whether or not the file ends up committed as
+// modified (it may be back to the content of the head, see svc_checkout()).
+static void refresh_file(project_t *project, tracked_file_t *file) {
+	unsigned int old_hash = file->hash;
+	uint64_t old_fingerprint = file->fingerprint;
+	file->hash = hash_file_ex(project, file->file_name, &file->fingerprint);
+	if (file->hash != old_hash || file->fingerprint != old_fingerprint) {
+		free(file->content);
+		file->content = file_content_copy(project, file->file_name, &file->content_len);
+		file->base = NULL;
+	}
+}
+
+// Re-hash the tracked files of the current node that may have changed on disk.
+// Without watch mode (or after lost events) every file is re-hashed.
+static void refresh_hashes(project_t *project) {
+	commit_node_t *node = project->current_node;
+	
+	if (project->watch_fd >= 0) {
+		drain_watch_events(project);
+	}
+	
+	if (project->watch_fd < 0 || project->watch_overflow == 1) {
+		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+			refresh_file(project, &node->tracked_files[file_idx]);
+		}
+		clear_dirty_files(project);
+		project->watch_overflow = 0;
+		staging_invalidate(project);
+		return;
+	}
+	
+	// Only the dirty files are looked up and re-hashed, and the changed count follows them.
+	staging_sync(project);
+	for (int dirty_idx = 0; dirty_idx < project->n_dirty_files; dirty_idx++) {
+		tracked_file_t *file = file_index_find(project->staging_index, project->staging_index_cap, node->tracked_files, project->dirty_files[dirty_idx]);
+		if (file == NULL) {
+			continue;
+		}
+		project->n_staging_changed -= staging_file_changed(project, file);
+		refresh_file(project, file);
+		project->n_staging_changed += staging_file_changed(project, file);
+	}
+	clear_dirty_files(project);
+}
+
+// Check if there is a change in tracked files.
+// Return 1 if there is a change (addition, deletion, modification).
+// Return 0 if there is no change .
+static int check_change(void *helper) {
+	project_t *project = (project_t*)helper;
+	commit_node_t *node = project->current_node;
+	commit_node_t *head = project->head;
+	TRACE_SCOPE("check_change", NULL, node->n_tracked_files, TRACE_NONE);
+	
+	// In watch mode only dirty files are re-hashed, so keep the dirty set drained even before the first commit.
+	// While commits are replayed in memory, the hashes come from the stored files and not from the working tree.
+	if ((head != NULL || project->watch_fd >= 0) && project->in_memory == 0) {
+		refresh_hashes(project);
+	}else if (project->in_memory == 1) {
+		staging_invalidate(project);
+	}
+	
+	if (head != NULL) {
+		// A different number of files is always a change.
+		if (node->n_tracked_files != head->n_tracked_files) {
+			return 1;
+		}
+		
+		// With as many files, every file in the head with the same content means no change.
+		staging_sync(project);
+		return (project->n_staging_changed > 0) ? 1 : 0;
+	}
+	// Otherwise, return 1
+	return 1;
+}
+
+// Check if the file is locally (or manually) removed from SVC. 
+// check_change() has just refreshed the hashes, so a missing file carries the hash_file() error code.
+static void check_local_deletion(void *helper) {
+	project_t *project = (project_t*)helper;
+	commit_node_t *node = project->current_node;
+	TRACE_SCOPE("check_local_deletion", NULL, node->n_tracked_files, TRACE_NONE);
+	
+	int file_idx = 0;
+	while (file_idx < node->n_tracked_files) {
+		// In watch mode, files that were not reported missing still exist.
+		if (project->watch_fd >= 0 && node->tracked_files[file_idx].hash != (unsigned int)-2) {
+			file_idx++;
+			continue;
+		}
+		int handle = project->fs.open(project->fs.ctx, node->tracked_files[file_idx].file_name, 0);
+		// If the file does not exist at the given path, remove it from the SVC.
+		if (handle < 0) {
+			// svc_rm() shifts the remaining files down, so stay on the same index.
+			svc_rm(helper, node->tracked_files[file_idx].file_name);
+			continue;
+		}
+		project->fs.close(project->fs.ctx, handle);
+		file_idx++;
+	}
+}
+
+static int compare_status_entry(const void *pa, const void *pb) {
+	return strcmp(((const svc_status_entry_t *)pa)->file_name, ((const svc_status_entry_t *)pb)->file_name);
+}
+
+// Find the changes of the tracked files relative to the head without committing: files added to or
+// removed from SVC, files whose content changed, and tracked files that were deleted on disk.
+// Hashes come from the hash cache (or the watch's dirty set), so unchanged files are only stat'ed.
+// The entries are stored in out in file name order and their number in n_out. The entries and
+// their file names are one allocation, free() it once. Return 0, or -1 if out or n_out is NULL.
+// Like svc_commit(), this must be called from the writer's thread.
+int svc_status(void *helper, svc_status_entry_t **out, int *n_out) {
+	TRACE_SCOPE("svc_status", NULL, TRACE_NONE, TRACE_NONE);
+	commit_queue_wait((project_t*)helper);
+	if (out == NULL || n_out == NULL) {
+		return -1;
+	}
+	
+	project_t *project = (project_t*)helper;
+	commit_node_t *node = project->current_node;
+	commit_node_t *head = project->head;
+	size_t n_head_files = (head == NULL) ? 0 : head->n_tracked_files;
+	refresh_hashes(project);
+	
+	staging_sync(project);
+	
+	// Head files matched by a tracked file, the others were removed.
+	unsigned char *matched = (unsigned char *)calloc(n_head_files + 1, 1);
+	size_t n_entries = 0;
+	svc_status_entry_t *entries = (svc_status_entry_t *)malloc(sizeof(svc_status_entry_t) * (node->n_tracked_files + n_head_files + 1));
+	
+	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+		tracked_file_t *file = &node->tracked_files[file_idx];
+		tracked_file_t *head_file = NULL;
+		if (n_head_files > 0) {
+			head_file = file_index_find(project->head_index, project->head_index_cap, head->tracked_files, file->file_name);
+			if (head_file != NULL) {
+				matched[head_file - head->tracked_files] = 1;
+			}
+		}
+		
+		// refresh_hashes() leaves the hash_file() error code in the hash of a missing file.
+		svc_status_type_t status = 0;
+		if (file->hash == (unsigned int)-2) {
+			status = STATUS_DELETED;
+		}else if (head_file == NULL) {
+			status = STATUS_ADDED;
+		}else if (head_file->fingerprint != file->fingerprint || head_file->hash != file->hash) {
+			status = STATUS_MODIFIED;
+		}
+		if (status != 0) {
+			entries[n_entries].file_name = file->file_name;
+			entries[n_entries].status = status;
+			n_entries++;
+		}
+	}
+	for (size_t head_file_idx = 0; head_file_idx < n_head_files; head_file_idx++) {
+		if (matched[head_file_idx] == 0) {
+			entries[n_entries].file_name = head->tracked_files[head_file_idx].file_name;
+			entries[n_entries].status = STATUS_REMOVED;
+			n_entries++;
+		}
+	}
+	free(matched);
+	qsort(entries, n_entries, sizeof(svc_status_entry_t), compare_status_entry);
+	
+	// Copy the names behind the entries, they must not change with the staging area.
+	size_t names_len = 0;
+	for (size_t entry_idx = 0; entry_idx < n_entries; entry_idx++) {
+		names_len += strlen(entries[entry_idx].file_name) + 1;
+	}
+	*out = (svc_status_entry_t *)malloc(sizeof(svc_status_entry_t) * n_entries + names_len + 1);
+	char *names = (char *)(*out + n_entries);
+	for (size_t entry_idx = 0; entry_idx < n_entries; entry_idx++) {
+		(*out)[entry_idx].file_name = names;
+		(*out)[entry_idx].status = entries[entry_idx].status;
+		strcpy(names, entries[entry_idx].file_name);
+		names += strlen(entries[entry_idx].file_name) + 1;
+	}
+	free(entries);
+	*n_out = n_entries;
+	
+	return 0;
+}
+
+// Determine if the change is addition, deletion or modification.
+static void determine_action(void *helper) {
+	project_t *project = (project_t*)helper;
+	commit_node_t *node = project->current_node;
+	commit_node_t *head = project->head;
+	TRACE_SCOPE("determine_action", NULL, node->n_tracked_files, TRACE_NONE);
+	
+	// If head is NULL, it means initial commit.
+	// Every tracked files will be determined as addition.
+	if (head == NULL) {
+		node->n_actions = node->n_tracked_files;
+		node->actions = (action_info_t*)malloc(sizeof(action_info_t) * node->n_actions);
+		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+			node->actions[file_idx].file_name = node->tracked_files[file_idx].file_name;
+			node->actions[file_idx].action = ACTION_ADD;
+			node->actions[file_idx].hash = node->tracked_files[file_idx].hash;
+			node->actions[file_idx].old_hash = 0;
+		}
+	}else {
+		// Head files that are still tracked, the others were removed. Replayed commits set the
+		// files without check_change(), so the indexes are rebuilt.
+		staging_invalidate(project);
+		staging_sync(project);
+		unsigned char *matched = (unsigned char *)calloc(head->n_tracked_files + 1, 1);
+		// Check and determine if the file is added or modified in SVC.
+		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+			tracked_file_t *head_file = file_index_find(project->head_index, project->head_index_cap, head->tracked_files, node->tracked_files[file_idx].file_name);
+			if (head_file != NULL) {
+				matched[head_file - head->tracked_files] = 1;
+				// check_change() already refreshed the hash of every file that may have been modified.
+				unsigned int new_hash = node->tracked_files[file_idx].hash;
+				// If the content fingerprints are equal, there was no modification.
+				if (node->tracked_files[file_idx].fingerprint == head_file->fingerprint) {
+					continue;
+				}
+				node->n_actions++;
+				
+				if (node->n_actions == 1) {
+					node->actions = (action_info_t*)malloc(sizeof(action_info_t) * node->n_actions);
+				}else {
+					node->actions = (action_info_t*)realloc(node->actions, sizeof(action_info_t) * node->n_actions);
+				}
+				// refresh_hashes() already took the new content along with the new hash.
+				node->tracked_files[file_idx].hash = new_hash;
+				node->actions[node->n_actions - 1].file_name = node->tracked_files[file_idx].file_name;
+				node->actions[node->n_actions - 1].action = ACTION_MODIFY;
+				node->actions[node->n_actions - 1].hash = node->tracked_files[file_idx].hash;
+				node->actions[node->n_actions - 1].old_hash = head_file->hash;
+				continue;
+			}
+			node->n_actions++;
+			
+			if (node->n_actions == 1) {
+				node->actions = (action_info_t*)malloc(sizeof(action_info_t) * node->n_actions);
+			}else {
+				node->actions = (action_info_t*)realloc(node->actions, sizeof(action_info_t) * node->n_actions);
+			}
+			node->actions[node->n_actions - 1].file_name = node->tracked_files[file_idx].file_name;
+			node->actions[node->n_actions - 1].action = ACTION_ADD;
+			node->actions[node->n_actions - 1].hash = node->tracked_files[file_idx].hash;
+			node->actions[node->n_actions - 1].old_hash = 0;
+		}
+		// Check and determine if the file is removed from SVC.
+		for (int head_file_idx = 0; head_file_idx < head->n_tracked_files; head_file_idx++) {
+			if (matched[head_file_idx] == 0) {
+				node->n_actions++;
+				
+				if (node->n_actions == 1) {
+					node->actions = (action_info_t*)malloc(sizeof(action_info_t) * node->n_actions);
+				}else {
+					node->actions = (action_info_t*)realloc(node->actions, sizeof(action_info_t) * node->n_actions);
+				}
+				node->actions[node->n_actions - 1].file_name = head->tracked_files[head_file_idx].file_name;
+				node->actions[node->n_actions - 1].action = ACTION_REMOVE;
+				node->actions[node->n_actions - 1].hash = head->tracked_files[head_file_idx].hash;
+				node->actions[node->n_actions - 1].old_hash = 0;
+			}
+		}
+		free(matched);
+	}
+}
+
+// Comparator function for qsort in order to sort file names by increasing alphabetical order.
+static int compare_str(const void *pa, const void * pb) {
+	const action_info_t *p1 = (action_info_t *) pa;
+	const action_info_t *p2 = (action_info_t *) pb;
+	unsigned int p1_ascii = tolower(p1->file_name[0]);
+	unsigned int p2_ascii = tolower(p2->file_name[0]);
+	
+ 	if (p1_ascii < p2_ascii){
+		return -1;	
+	} 
+  	if (p1_ascii == p2_ascii){
+		return 0;
+	} 
+  	if (p1_ascii > p2_ascii){
+		return 1;
+	} 
+	
+	return 0;
+}
+
+// Largest commit id commit_id_of() gives for a commit with actions.
+#define COMMIT_ID_MAX 15485863
+
+// Calculate commit id from the message and the actions, which are sorted by file name.
+static unsigned int commit_id_of(char *message, action_info_t *actions, size_t n_actions) {
+	unsigned int commit_id = 0;
+	unsigned int message_len = strlen(message);
+		
+	// Calculate commit_id from message.
+	for (int i = 0; i < message_len; i++) {
+        commit_id += message[i];
+        commit_id = (commit_id % 1000);
+	}
+	
+	// Calculate commit_id from action array.
+	for (int action_idx = 0; action_idx < n_actions; action_idx++) {
+		if(actions[action_idx].action == ACTION_ADD){
+			commit_id += 376591;
+		}
+		if (actions[action_idx].action == ACTION_REMOVE) {
+			commit_id += 85973;
+		}
+		if (actions[action_idx].action == ACTION_MODIFY) {
+			commit_id += 9573681;
+		}
+		unsigned int file_path_len = strlen(actions[action_idx].file_name);
+		for (int file_idx = 0; file_idx < file_path_len; file_idx++) {
+			commit_id *= (actions[action_idx].file_name[file_idx] % 37);
+			commit_id = (commit_id % COMMIT_ID_MAX) + 1;
+		}
+	}
+	
+	return commit_id;
+}
+
+// Calculate commit id of the staging area.
+static unsigned int get_commit_id(void *helper, char *message) {
+	project_t *project = (project_t*)helper;
+	commit_node_t *node = project->current_node;
+	TRACE_SCOPE("get_commit_id", NULL, node->n_actions, TRACE_NONE);
+	
+	// Sort file names by increasing alphabetical order.
+	qsort(node->actions, node->n_actions, sizeof(action_info_t), compare_str);
+	
+	return commit_id_of(message, node->actions, node->n_actions);
+}
+
+// Slot of a commit id in the commit id index.
+static size_t commit_id_slot(uint32_t commit_id, size_t cap) {
+	return (size_t)(((uint64_t)commit_id * 0x9E3779B97F4A7C15ULL) >> 32) & (cap - 1);
+}
+
+// Put a commit into the commit id index, unless an earlier commit has the same id.
+// Slots hold the commit index plus one, 0 marks an empty slot.
+static void commit_index_insert(atomic_uint *index, size_t cap, uint32_t *ids, uint32_t commit_idx) {
+	size_t slot_idx = commit_id_slot(ids[commit_idx], cap);
+	for (;;) {
+		unsigned int slot = atomic_load(&index[slot_idx]);
+		if (slot == 0) {
+			atomic_store(&index[slot_idx], commit_idx + 1);
+			return;
+		}
+		if (ids[slot - 1] == ids[commit_idx]) {
+			return;
+		}
+		slot_idx = (slot_idx + 1) & (cap - 1);
+	}
+}
+
+// The id tried after commit_id when it is taken, see commit_staging().
+static uint32_t commit_id_next(uint32_t commit_id) {
+	return (commit_id % COMMIT_ID_MAX) + 1;
+}
+
+// Position of the first commit with the id in the writer's commit id index, or COMMIT_NONE.
+static uint32_t commit_index_find(project_t *project, uint32_t commit_id) {
+	size_t cap = project->commit_index_cap;
+	if (cap == 0) {
+		return COMMIT_NONE;
+	}
+	size_t index_idx = commit_id_slot(commit_id, cap);
+	unsigned int slot;
+	for (size_t n_probed = 0; n_probed < cap && (slot = atomic_load(&project->commit_index[index_idx])) != 0; n_probed++) {
+		if (slot <= project->n_total_commit && project->commits.ids[slot - 1] == commit_id) {
+			return slot - 1;
+		}
+		index_idx = (index_idx + 1) & (cap - 1);
+	}
+	return COMMIT_NONE;
+}
+
+// Write a commit id as a null terminated hex string of COMMIT_ID_LEN bytes, like "%06x".
+static void commit_id_to_hex(uint32_t commit_id, char *hex) {
+	static const char digits[] = "0123456789abcdef";
+	for (int digit_idx = COMMIT_ID_LEN - 2; digit_idx >= 0; digit_idx--) {
+		hex[digit_idx] = digits[commit_id & 0xf];
+		commit_id >>= 4;
+	}
+	hex[COMMIT_ID_LEN - 1] = '\0';
+}
+
+// Parse a hex commit id. Return -1 unless it is in the form svc_commit() returns.
+static int commit_id_from_hex(const char *hex, uint32_t *commit_id) {
+	*commit_id = 0;
+	for (int digit_idx = 0; digit_idx < COMMIT_ID_LEN - 1; digit_idx++) {
+		char digit = hex[digit_idx];
+		if (digit >= '0' && digit <= '9') {
+			*commit_id = (*commit_id << 4) | (digit - '0');
+		}else if (digit >= 'a' && digit <= 'f') {
+			*commit_id = (*commit_id << 4) | (digit - 'a' + 10);
+		}else {
+			return -1;
+		}
+	}
+	return (hex[COMMIT_ID_LEN - 1] == '\0') ? 0 : -1;
+}
+
+// Hex id of a commit. The string stays valid as long as the commit, also across svc_squash_before().
+static char *commit_hex(commit_meta_t *meta, uint32_t commit_idx) {
+	uint32_t seq = meta->seqs[commit_idx];
+	return meta->hex_chunks[seq / COMMIT_HEX_CHUNK - meta->hex_chunk_base] + (seq % COMMIT_HEX_CHUNK) * COMMIT_ID_LEN;
+}
+
+// Position of a node's commit in the metadata of n_commits commits, COMMIT_NONE for a staging
+// area or a commit the metadata does not have. Until a squash, the sequence number is the position,
+// and after one that only dropped older commits it is off by the first sequence number.
+static uint32_t node_commit_idx(commit_meta_t *meta, size_t n_commits, commit_node_t *node) {
+	uint32_t seq = node->commit_seq;
+	if (seq == COMMIT_NONE || n_commits == 0 || seq < meta->seqs[0]) {
+		return COMMIT_NONE;
+	}
+	uint32_t guess = seq - meta->seqs[0];
+	if (guess < n_commits && meta->seqs[guess] == seq) {
+		return guess;
+	}
+	
+	size_t low = 0;
+	size_t high = n_commits;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (meta->seqs[mid] < seq) {
+			low = mid + 1;
+		}else {
+			high = mid;
+		}
+	}
+	return (low < n_commits && meta->seqs[low] == seq) ? low : COMMIT_NONE;
+}
+
+// Position of a node's commit in the writer's metadata.
+static uint32_t project_commit_idx(project_t *project, commit_node_t *node) {
+	return node_commit_idx(&project->commits, project->n_total_commit, node);
+}
+
+// Same as grow_table(), for one of several parallel arrays sharing a capacity.
+static void *grow_column(project_t *project, void *column, size_t n_items, size_t capacity, size_t item_size) {
+	return grow_table(project, column, n_items, &capacity, item_size);
+}
+
+// Make room for n_more items in an arena that readers may be looking at.
+// A full arena is copied into a big enough one and the old one is retired.
+static void *grow_arena(project_t *project, void *arena, size_t n_used, size_t n_more, size_t *capacity, size_t item_size) {
+	if (n_used + n_more <= *capacity) {
+		return arena;
+	}
+	
+	size_t new_cap = (*capacity == 0) ? 256 : *capacity * 2;
+	while (new_cap < n_used + n_more) {
+		new_cap *= 2;
+	}
+	void *new_arena = malloc(item_size * new_cap);
+	if (n_used > 0) {
+		memcpy(new_arena, arena, item_size * n_used);
+	}
+	epoch_retire(project, arena);
+	*capacity = new_cap;
+	
+	return new_arena;
+}
+
+// Position of the branch in the branch table.
+static uint32_t branch_index(project_t *project, char *branch_name) {
+	for (uint32_t branch_idx = 0; branch_idx < project->n_total_branch; branch_idx++) {
+		if (project->branch_table[branch_idx].branch_name == branch_name || strcmp(project->branch_table[branch_idx].branch_name, branch_name) == 0) {
+			return branch_idx;
+		}
+	}
+	return 0;
+}
+
+// Bit positions of a path in the per-commit Bloom filter.
+#define PATH_BLOOM_HASHES 3
+static void path_bloom_bits(char *file_name, size_t *bits) {
+	uint64_t hash = path_hash(file_name);
+	uint64_t step = (hash >> 32) | 1;
+	for (int hash_idx = 0; hash_idx < PATH_BLOOM_HASHES; hash_idx++) {
+		bits[hash_idx] = (hash + hash_idx * step) % (PATH_BLOOM_WORDS * 64);
+	}
+}
+
+// Append the staging area being committed to the commit metadata and publish it.
+// The node's actions move into the action arena.
+static void add_commit_meta(project_t *project, commit_node_t *node, uint32_t commit_id, char *message) {
+	commit_meta_t *meta = &project->commits;
+	uint32_t commit_idx = project->n_total_commit;
+	
+	// Readers only look at the published entries, so the new one is written past them first.
+	if (commit_idx == meta->cap) {
+		meta->ids = grow_column(project, meta->ids, commit_idx, meta->cap, sizeof(uint32_t));
+		meta->parents = grow_column(project, meta->parents, commit_idx, meta->cap, sizeof(uint32_t));
+		meta->branches = grow_column(project, meta->branches, commit_idx, meta->cap, sizeof(uint32_t));
+		meta->message_offs = grow_column(project, meta->message_offs, commit_idx, meta->cap, sizeof(uint32_t));
+		meta->action_starts = grow_column(project, meta->action_starts, commit_idx, meta->cap, sizeof(uint32_t));
+		meta->action_counts = grow_column(project, meta->action_counts, commit_idx, meta->cap, sizeof(uint32_t));
+		meta->path_blooms = grow_column(project, meta->path_blooms, commit_idx, meta->cap, sizeof(uint64_t) * PATH_BLOOM_WORDS);
+		meta->seqs = grow_column(project, meta->seqs, commit_idx, meta->cap, sizeof(uint32_t));
+		// The last column updates the shared capacity.
+		meta->nodes = grow_table(project, meta->nodes, commit_idx, &meta->cap, sizeof(commit_node_t *));
+	}
+	// A squash keeps at least one commit, so sequence numbers go on from the last one.
+	uint32_t seq = (commit_idx == 0) ? 0 : meta->seqs[commit_idx - 1] + 1;
+	if (seq / COMMIT_HEX_CHUNK == meta->hex_chunk_base + meta->n_hex_chunks) {
+		size_t chunks_cap = meta->n_hex_chunks;
+		meta->hex_chunks = grow_arena(project, meta->hex_chunks, meta->n_hex_chunks, 1, &chunks_cap, sizeof(char *));
+		meta->hex_chunks[meta->n_hex_chunks++] = (char *)malloc(COMMIT_HEX_CHUNK * COMMIT_ID_LEN);
+	}
+	
+	size_t message_len = strlen(message) + 1;
+	meta->messages = grow_arena(project, meta->messages, meta->messages_len, message_len, &meta->messages_cap, sizeof(char));
+	memcpy(meta->messages + meta->messages_len, message, message_len);
+	meta->message_offs[commit_idx] = meta->messages_len;
+	meta->messages_len += message_len;
+	
+	meta->actions = grow_arena(project, meta->actions, meta->n_actions, node->n_actions, &meta->actions_cap, sizeof(action_info_t));
+	if (node->n_actions > 0) {
+		memcpy(meta->actions + meta->n_actions, node->actions, sizeof(action_info_t) * node->n_actions);
+	}
+	meta->action_starts[commit_idx] = meta->n_actions;
+	meta->action_counts[commit_idx] = node->n_actions;
+	meta->n_actions += node->n_actions;
+	free(node->actions);
+	node->actions = NULL;
+	node->n_actions = 0;
+	
+	// Remember which paths this commit touched in its Bloom filter.
+	uint64_t *bloom = &meta->path_blooms[commit_idx * PATH_BLOOM_WORDS];
+	memset(bloom, 0, sizeof(uint64_t) * PATH_BLOOM_WORDS);
+	for (uint32_t action_idx = 0; action_idx < meta->action_counts[commit_idx]; action_idx++) {
+		size_t bits[PATH_BLOOM_HASHES];
+		path_bloom_bits(meta->actions[meta->action_starts[commit_idx] + action_idx].file_name, bits);
+		for (int hash_idx = 0; hash_idx < PATH_BLOOM_HASHES; hash_idx++) {
+			bloom[bits[hash_idx] / 64] |= 1ULL << (bits[hash_idx] % 64);
+		}
+	}
+	
+	meta->ids[commit_idx] = commit_id;
+	meta->parents[commit_idx] = (node->prev == NULL) ? COMMIT_NONE : node_commit_idx(meta, commit_idx, node->prev);
+	meta->branches[commit_idx] = branch_index(project, node->branch_name);
+	meta->nodes[commit_idx] = node;
+	meta->seqs[commit_idx] = seq;
+	commit_id_to_hex(commit_id, commit_hex(meta, commit_idx));
+	node->commit_seq = seq;
+	project->n_total_commit++;
+	
+	// Keep the id index at most half full. A bigger index is built aside and the old one retired.
+	if (project->n_total_commit * 2 > project->commit_index_cap) {
+		size_t new_cap = (project->commit_index_cap == 0) ? 64 : project->commit_index_cap * 2;
+		atomic_uint *new_index = (atomic_uint *)calloc(new_cap, sizeof(atomic_uint));
+		for (uint32_t index_idx = 0; index_idx < project->n_total_commit; index_idx++) {
+			commit_index_insert(new_index, new_cap, meta->ids, index_idx);
+		}
+		epoch_retire(project, project->commit_index);
+		project->commit_index = new_index;
+		project->commit_index_cap = new_cap;
+	}else {
+		// Readers skip slots that point past their snapshot, so this is safe to do in place.
+		commit_index_insert(project->commit_index, project->commit_index_cap, meta->ids, commit_idx);
+	}
+	
+	publish_snapshot(project);
+}
+
+// Return 0 if the commit certainly did not touch the path, 1 if it may have.
+static int path_bloom_test(uint64_t *bloom, char *file_name) {
+	size_t bits[PATH_BLOOM_HASHES];
+	path_bloom_bits(file_name, bits);
+	for (int hash_idx = 0; hash_idx < PATH_BLOOM_HASHES; hash_idx++) {
+		if ((bloom[bits[hash_idx] / 64] & (1ULL << (bits[hash_idx] % 64))) == 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Find the path log slot of the path, or the empty slot where it belongs.
+static path_log_t *path_log_slot(path_log_t *logs, size_t cap, const char *file_name) {
+	size_t slot_idx = path_hash(file_name) & (cap - 1);
+	while (logs[slot_idx].file_name != NULL && strcmp(logs[slot_idx].file_name, file_name) != 0) {
+		slot_idx = (slot_idx + 1) & (cap - 1);
+	}
+	return &logs[slot_idx];
+}
+
+// Append the commit to the log of the path.
+static void path_log_append(project_t *project, char *file_name, uint32_t commit_idx) {
+	// Keep the table at most half full.
+	if ((project->n_path_logs + 1) * 2 > project->path_logs_cap) {
+		size_t new_cap = (project->path_logs_cap == 0) ? 64 : project->path_logs_cap * 2;
+		path_log_t *new_logs = (path_log_t *)calloc(new_cap, sizeof(path_log_t));
+		for (int log_idx = 0; log_idx < project->path_logs_cap; log_idx++) {
+			if (project->path_logs[log_idx].file_name != NULL) {
+				*path_log_slot(new_logs, new_cap, project->path_logs[log_idx].file_name) = project->path_logs[log_idx];
+			}
+		}
+		free(project->path_logs);
+		project->path_logs = new_logs;
+		project->path_logs_cap = new_cap;
+	}
+	
+	path_log_t *log = path_log_slot(project->path_logs, project->path_logs_cap, file_name);
+	if (log->file_name == NULL) {
+		log->file_name = strdup(file_name);
+		project->n_path_logs++;
+	}
+	// The same path can only appear once in a commit's actions, but guard against repeats.
+	if (log->n_commits > 0 && log->commits[log->n_commits - 1] == commit_idx) {
+		return;
+	}
+	if (log->n_commits == log->commits_cap) {
+		log->commits_cap = (log->commits_cap == 0) ? 4 : log->commits_cap * 2;
+		log->commits = (uint32_t *)realloc(log->commits, sizeof(uint32_t) * log->commits_cap);
+	}
+	log->commits[log->n_commits++] = commit_idx;
+}
+
+// Record the paths changed by a new commit in the path logs.
+static void index_commit_paths(project_t *project, uint32_t commit_idx) {
+	commit_meta_t *meta = &project->commits;
+	for (uint32_t action_idx = 0; action_idx < meta->action_counts[commit_idx]; action_idx++) {
+		path_log_append(project, meta->actions[meta->action_starts[commit_idx] + action_idx].file_name, commit_idx);
+	}
+}
+
+// Make a staging area file from a committed file. The content is shared with the file that holds
+// it, which is committed and stays until it is handed over, see svc_squash_before().
+static void stored_file_share(tracked_file_t *dst, tracked_file_t *src) {
+	dst->file_name = malloc(sizeof(char) * FILE_NAME_LEN);
+	strcpy(dst->file_name, src->file_name);
+	dst->content = NULL;
+	dst->content_len = src->content_len;
+	dst->hash = src->hash;
+	dst->fingerprint = src->fingerprint;
+	dst->content_state = CONTENT_HEAP;
+	dst->spill_offset = -1;
+	dst->lru_prev = NULL;
+	dst->lru_next = NULL;
+	dst->pins = 0;
+	dst->base = content_owner(src);
+}
+
+// Like node_copy(), but the contents are shared with the node instead of read from the working tree.
+static commit_node_t *node_clone(project_t *project, commit_node_t *src_node) {
+	TRACE_SCOPE("node_clone", NULL, src_node->n_tracked_files, TRACE_NONE);
+	commit_node_t *new_node = (commit_node_t *)malloc(sizeof(commit_node_t));
+	new_node->branch_name = src_node->branch_name;
+	new_node->commit_seq = COMMIT_NONE;
+	new_node->tracked_files = (tracked_file_t *)malloc(sizeof(tracked_file_t) * src_node->n_tracked_files);
+	new_node->n_tracked_files = src_node->n_tracked_files;
+	for (int file_idx = 0; file_idx < src_node->n_tracked_files; file_idx++) {
+		stored_file_share(&new_node->tracked_files[file_idx], &src_node->tracked_files[file_idx]);
+	}
+	new_node->n_next_commit = 0;
+	new_node->prev = src_node;
+	new_node->actions = NULL;
+	new_node->n_actions = 0;
+	return new_node;
+}
+
+// Commit the staging area, whose actions are already determined, and start a new staging area.
+// The new staging area is next if it is not NULL, otherwise a copy of the commit.
+static char *commit_staging(project_t *project, char *message, commit_node_t *next, int is_replay) {
+	commit_node_t *node = project->current_node;
+	
+	// Calculate commit_id. A replayed commit has the message and the paths of the commit it was
+	// replayed from, so it takes the next id that no commit has yet.
+	unsigned int commit_id = get_commit_id(project, message);
+	while (is_replay && commit_index_find(project, commit_id) != COMMIT_NONE) {
+		commit_id = commit_id_next(commit_id);
+	}
+	
+	// Update head.
+	project->head = node;
+	
+	// Commit current stage - record id, message and actions in the commit metadata.
+	add_commit_meta(project, node, commit_id, message);
+	
+	// Remember which paths this commit touched.
+	index_commit_paths(project, project->n_total_commit - 1);
+	
+	// The committed contents now count against the memory budget.
+	content_track_node(project, node);
+	
+	// Create next node.
+	node->n_next_commit++;
+	if (node->n_next_commit == 1) {
+		node->next = (commit_node_t **)malloc(sizeof(commit_node_t *) * node->n_next_commit);
+	}else {
+		node->next = (commit_node_t **)realloc(node->next, sizeof(commit_node_t *) * node->n_next_commit);
+	}
+	
+	// Copy node to next node. In memory, the working tree may not have the committed contents.
+	if (next != NULL) {
+		node->next[node->n_next_commit - 1] = next;
+	}else if (project->in_memory) {
+		node->next[node->n_next_commit - 1] = node_clone(project, node);
+	}else {
+		node->next[node->n_next_commit - 1] = node_copy(project, node);
+	}
+
+	// Update current node (which will be used as staging area).
+	project->current_node = node->next[node->n_next_commit - 1];
+	
+	return commit_hex(&project->commits, project_commit_idx(project, node));
+}
+
+// Log a commit that is about to be made from the staging area, whose actions against the head
+// are determined. Only the actions are logged, with the contents of added and modified files:
+// the files of the head are in the journal already.
+static void journal_log_commit(project_t *project, char *message) {
+	journal_t *journal = journal_begin(project);
+	if (journal == NULL) {
+		return;
+	}
+	
+	commit_node_t *node = project->current_node;
+	staging_sync(project);
+	content_pin(project);
+	journal_put_arg(journal, message);
+	journal_put_u32(journal, node->n_actions);
+	for (int action_idx = 0; action_idx < node->n_actions; action_idx++) {
+		action_info_t *action = &node->actions[action_idx];
+		journal_put_arg(journal, action->file_name);
+		journal_put_u32(journal, action->action);
+		if (action->action == ACTION_REMOVE) {
+			continue;
+		}
+		tracked_file_t *file = file_index_find(project->staging_index, project->staging_index_cap, node->tracked_files, action->file_name);
+		journal_put_u32(journal, file->hash);
+		journal_put_u64(journal, file->fingerprint);
+		unsigned char *content = content_get(project, file);
+		journal_put_bytes(journal, (content == NULL) ? (unsigned char *)"" : content, (content == NULL) ? 0 : file->content_len);
+	}
+	content_unpin(project);
+	journal_end(journal, JOURNAL_OP_COMMIT);
+}
+
+// Cursor over the payload of a journal record.
+typedef struct journal_reader{
+	const unsigned char *data;
+	size_t len;
+	size_t pos;
+}journal_reader_t;
+
+static int journal_get(journal_reader_t *reader, void *value, size_t value_len) {
+	if (reader->len - reader->pos < value_len) {
+		return -1;
+	}
+	memcpy(value, reader->data + reader->pos, value_len);
+	reader->pos += value_len;
+	return 0;
+}
+
+// Read a length-prefixed byte string. Return 0, 1 for a NULL argument, or -1 if the record is cut short.
+static int journal_get_bytes(journal_reader_t *reader, const unsigned char **bytes, uint32_t *bytes_len) {
+	if (journal_get(reader, bytes_len, sizeof(*bytes_len)) != 0) {
+		return -1;
+	}
+	if (*bytes_len == JOURNAL_NULL_ARG) {
+		*bytes = NULL;
+		return 1;
+	}
+	if (reader->len - reader->pos < *bytes_len) {
+		return -1;
+	}
+	*bytes = reader->data + reader->pos;
+	reader->pos += *bytes_len;
+	return 0;
+}
+
+// Read a string argument. Return NULL for a NULL argument or a malformed one.
+static char *journal_get_arg(journal_reader_t *reader) {
+	const unsigned char *arg;
+	uint32_t arg_len;
+	if (journal_get_bytes(reader, &arg, &arg_len) != 0 || arg_len == 0 || arg[arg_len - 1] != '\0') {
+		return NULL;
+	}
+	return (char *)arg;
+}
+
+// Redo a logged commit: the staging area gets the files of the head, which the actions were
+// determined against, shared with it and changed by the logged actions. It is committed without
+// looking at the working tree. Return 0, or -1 if the record is malformed.
+static int journal_replay_commit(project_t *project, journal_reader_t *reader) {
+	commit_node_t *node = project->current_node;
+	commit_node_t *prev = project->head;
+	char *message = journal_get_arg(reader);
+	uint32_t n_actions;
+	if (message == NULL || journal_get(reader, &n_actions, sizeof(n_actions)) != 0 || n_actions > reader->len) {
+		return -1;
+	}
+	
+	size_t n_files = (prev == NULL) ? 0 : prev->n_tracked_files;
+	size_t n_prev_files = n_files;
+	tracked_file_t *files = (tracked_file_t *)malloc(sizeof(tracked_file_t) * (n_files + n_actions + 1));
+	for (size_t file_idx = 0; file_idx < n_files; file_idx++) {
+		stored_file_share(&files[file_idx], &prev->tracked_files[file_idx]);
+	}
+	size_t *index = NULL;
+	size_t index_cap = 0;
+	file_index_build(&index, &index_cap, files, n_files);
+	
+	// Removed files keep their place until the end, so the index stays valid.
+	unsigned char *removed = (unsigned char *)calloc(n_files + 1, 1);
+	int result = 0;
+	for (uint32_t action_idx = 0; action_idx < n_actions && result == 0; action_idx++) {
+		char *file_name = journal_get_arg(reader);
+		uint32_t action;
+		if (file_name == NULL || strlen(file_name) >= FILE_NAME_LEN || journal_get(reader, &action, sizeof(action)) != 0) {
+			result = -1;
+			break;
+		}
+		tracked_file_t *file = file_index_find(index, index_cap, files, file_name);
+		if (file != NULL && removed[file - files]) {
+			file = NULL;
+		}
+		if (action == ACTION_REMOVE) {
+			if (file == NULL) {
+				result = -1;
+				break;
+			}
+			removed[file - files] = 1;
+			continue;
+		}
+		if ((action == ACTION_ADD) != (file == NULL) || (action != ACTION_ADD && action != ACTION_MODIFY)) {
+			result = -1;
+			break;
+		}
+		
+		uint32_t hash;
+		uint64_t fingerprint;
+		const unsigned char *content;
+		uint32_t content_len;
+		if (journal_get(reader, &hash, sizeof(hash)) != 0 || journal_get(reader, &fingerprint, sizeof(fingerprint)) != 0 || journal_get_bytes(reader, &content, &content_len) != 0) {
+			result = -1;
+			break;
+		}
+		// Added files are appended, the record names every file once.
+		if (file == NULL) {
+			file = &files[n_files++];
+			file->file_name = malloc(sizeof(char) * FILE_NAME_LEN);
+			strcpy(file->file_name, file_name);
+			file->content_state = CONTENT_HEAP;
+			file->spill_offset = -1;
+			file->lru_prev = NULL;
+			file->lru_next = NULL;
+			file->pins = 0;
+		}
+		file->base = NULL;
+		file->hash = hash;
+		file->fingerprint = fingerprint;
+		file->content = (unsigned char *)malloc(content_len + 1);
+		memcpy(file->content, content, content_len);
+		file->content[content_len] = '\0';
+		file->content_len = content_len;
+	}
+	
+	// Drop the removed files, keeping the order of the others.
+	size_t n_kept = 0;
+	for (size_t file_idx = 0; file_idx < n_files; file_idx++) {
+		if (file_idx < n_prev_files && removed[file_idx]) {
+			cleanup_files(1, &files[file_idx]);
+		}else {
+			files[n_kept++] = files[file_idx];
+		}
+	}
+	free(removed);
+	free(index);
+	if (result != 0) {
+		cleanup_files(n_kept, files);
+		free(files);
+		return -1;
+	}
+	
+	cleanup_files(node->n_tracked_files, node->tracked_files);
+	free(node->tracked_files);
+	node->tracked_files = files;
+	node->n_tracked_files = n_kept;
+	determine_action(project);
+	commit_staging(project, message, NULL, 0);
+	
+	return 0;
+}
+
+// Redo one logged operation. Return 0, or -1 if the record is malformed.
+static int journal_replay_record(project_t *project, journal_op_t op, journal_reader_t *reader) {
+	if (op == JOURNAL_OP_COMMIT) {
+		return journal_replay_commit(project, reader);
+	}
+	
+	char *arg = journal_get_arg(reader);
+	if (arg == NULL) {
+		return -1;
+	}
+	// Operations that failed were not logged, so their result is not checked again.
+	if (op == JOURNAL_OP_ADD) {
+		svc_add(project, arg);
+	}else if (op == JOURNAL_OP_RM) {
+		svc_rm(project, arg);
+	}else if (op == JOURNAL_OP_BRANCH) {
+		svc_branch(project, arg);
+	}else if (op == JOURNAL_OP_CHECKOUT) {
+		svc_checkout(project, arg);
+	}else if (op == JOURNAL_OP_RESET) {
+		svc_reset(project, arg);
+	}else if (op == JOURNAL_OP_CHERRY_PICK) {
+		svc_cherry_pick(project, arg);
+	}else if (op == JOURNAL_OP_REBASE) {
+		svc_rebase(project, arg);
+	}else if (op == JOURNAL_OP_SQUASH) {
+		svc_squash_before(project, arg);
+	}else {
+		return -1;
+	}
+	return 0;
+}
+
+// Log the mutating operations (svc_add, svc_rm, svc_commit, svc_branch, svc_checkout, svc_reset,
+// svc_cherry_pick, svc_rebase, svc_squash_before) to the journal at path. An existing journal is
+// replayed first, so the project has to be fresh. Replay stops at the first torn or damaged
+// record, and the journal is cut there.
+// Records are made durable in batches with one fdatasync() each. A record waits at most
+// window_us microseconds for its batch, use svc_journal_sync() to wait for it. With a window
+// of 0 every operation is synced before it returns.
+// Return the number of replayed records. If path is NULL, window_us is negative, a journal is
+// already open or the project is not fresh, return -1. If the journal can not be opened or is
+// not a journal, return -2.
+int svc_journal_open(void *helper, char *path, long window_us) {
+	TRACE_SCOPE("svc_journal_open", path, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_wait(project);
+	if (path == NULL || window_us < 0 || project->journal != NULL) {
+		return -1;
+	}
+	if (project->n_total_commit > 0 || project->current_node->n_tracked_files > 0 || project->n_total_branch > 1) {
+		return -1;
+	}
+	
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return -2;
+	}
+	struct stat st;
+	unsigned char *data = NULL;
+	size_t data_len = 0;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		data = (unsigned char *)malloc(st.st_size);
+		while (data_len < st.st_size) {
+			ssize_t n_read = pread(fd, data + data_len, st.st_size - data_len, data_len);
+			if (n_read < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n_read <= 0) {
+				break;
+			}
+			data_len += n_read;
+		}
+	}
+	
+	uint32_t file_header[2] = {JOURNAL_MAGIC, JOURNAL_VERSION};
+	if (data_len == 0) {
+		if (ftruncate(fd, 0) != 0 || write_all(fd, (unsigned char *)file_header, sizeof(file_header)) != 0 || fdatasync(fd) != 0) {
+			free(data);
+			close(fd);
+			return -2;
+		}
+	}else if (data_len < sizeof(file_header) || memcmp(data, file_header, sizeof(file_header)) != 0) {
+		free(data);
+		close(fd);
+		return -2;
+	}
+	
+	journal_t *journal = (journal_t *)calloc(1, sizeof(journal_t));
+	journal->fd = fd;
+	journal->window_us = window_us;
+	pthread_mutex_init(&journal->lock, NULL);
+	pthread_cond_init(&journal->wake, NULL);
+	pthread_cond_init(&journal->synced, NULL);
+	project->journal = journal;
+	
+	int n_replayed = 0;
+	size_t pos = sizeof(file_header);
+	journal->paused = 1;
+	project->in_memory = 1;
+	while (data_len >= pos + JOURNAL_HEADER_LEN) {
+		journal_header_t header;
+		memcpy(&header, data + pos, sizeof(header));
+		if (header.len > data_len - pos - JOURNAL_HEADER_LEN) {
+			break;
+		}
+		const unsigned char *payload = data + pos + JOURNAL_HEADER_LEN;
+		if (journal_checksum(payload, header.len, header.op) != header.checksum) {
+			break;
+		}
+		journal_reader_t reader = {payload, header.len, 0};
+		if (journal_replay_record(project, header.op, &reader) != 0) {
+			break;
+		}
+		pos += JOURNAL_HEADER_LEN + header.len;
+		n_replayed++;
+	}
+	journal->paused = 0;
+	project->in_memory = 0;
+	// The hashes of the staging area came from the journal, re-scan the working tree on the next check.
+	project->watch_overflow = 1;
+	free(data);
+	
+	// Drop a torn tail, new records go right after the last good one.
+	if (data_len > 0 && pos < data_len && ftruncate(fd, pos) != 0) {
+		journal_close(project);
+		return -2;
+	}
+	lseek(fd, (data_len == 0) ? sizeof(file_header) : pos, SEEK_SET);
+	
+	if (window_us > 0 && pthread_create(&journal->flusher, NULL, journal_flusher, journal) == 0) {
+		journal->has_flusher = 1;
+	}
+	
+	return n_replayed;
+}
+
+char *svc_commit(void *helper, char *message) {
+	TRACE_SCOPE("svc_commit", message, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_wait(project);
+	commit_node_t *node = project->current_node;
+	commit_node_t *head = project->head;
+	
+	// If message is NULL, return NULL
+	if (message == NULL) {
+		return NULL;
+	}
+			
+	// Return NULL if commit is empty (when SVC is not tracking any files).
+	if (head == NULL) {
+		if(node->n_tracked_files == 0){
+			return NULL;
+		}
+	}
+	
+	// Return NULL if there was no change in tracked files
+	int is_changed = check_change(helper);
+	if (head != NULL) {
+		if (is_changed == 0) {
+			return NULL;
+		}
+	}
+	
+	// Check if file was locally(or manually) deleted.
+	// The journal records the files of the commit, not the svc_rm() calls made here.
+	journal_pause(project);
+	check_local_deletion(helper);
+	journal_resume(project);
+	
+	// Determine if the change is addition, deletion or modification.
+	determine_action(helper);
+	journal_log_commit(project, message);
+	
+	char *commit_id = commit_staging(project, message, NULL, 0);
+	
+	return commit_id;
+}
+
+// Read and hash the files of a queued commit. Files that can not be read are left out, their
+// names stay in job->file_names. Return the files, their number is stored in n_files.
+static tracked_file_t *commit_job_read(project_t *project, commit_job_t *job, size_t *n_files) {
+	TRACE_SCOPE("commit_job_read", job->message, job->n_files, TRACE_NONE);
+	tracked_file_t *files = (tracked_file_t *)malloc(sizeof(tracked_file_t) * (job->n_files + 1));
+	*n_files = 0;
+	size_t dir_len = (job->dir == NULL) ? 0 : strlen(job->dir);
+	char *path = (char *)malloc(dir_len + FILE_NAME_LEN + 2);
+	
+	for (size_t file_idx = 0; file_idx < job->n_files; file_idx++) {
+		char *file_name = job->file_names[file_idx];
+		if (job->dir != NULL && file_name[0] != '/') {
+			memcpy(path, job->dir, dir_len);
+			path[dir_len] = '/';
+			strcpy(path + dir_len + 1, file_name);
+		}else {
+			strcpy(path, file_name);
+		}
+		
+		size_t content_len;
+		unsigned char *content = fs_read_file(&project->fs, path, NULL, &content_len);
+		if (content == NULL) {
+			continue;
+		}
+		tracked_file_t *file = &files[(*n_files)++];
+		file->file_name = file_name;
+		file->content = content;
+		file->content_len = content_len;
+		file->hash = content_hash(file_name, content, content_len, &file->fingerprint);
+		file->content_state = CONTENT_HEAP;
+		file->spill_offset = -1;
+		file->lru_prev = NULL;
+		file->lru_next = NULL;
+		file->pins = 0;
+		file->base = NULL;
+		trace_scope.bytes += content_len;
+		job->file_names[file_idx] = NULL;
+	}
+	free(path);
+	
+	return files;
+}
+
+// Commit the files read for a queued commit, with the commit thread holding the write lock.
+// The node of the staging area becomes the commit, so the branch table and the links of the
+// parent stay as they are, and the files staged since the commit was queued move to a new
+// staging area after it. Return the commit id, or NULL if nothing changed.
+static char *commit_job_publish(project_t *project, commit_job_t *job, tracked_file_t *files, size_t n_files) {
+	TRACE_SCOPE("commit_job_publish", job->message, n_files, TRACE_NONE);
+	commit_node_t *node = project->current_node;
+	commit_node_t *head = project->head;
+	if (head == NULL && job->n_files == 0) {
+		free(files);
+		return NULL;
+	}
+	
+	commit_node_t *next = (commit_node_t *)malloc(sizeof(commit_node_t));
+	next->branch_name = node->branch_name;
+	next->commit_seq = COMMIT_NONE;
+	next->tracked_files = node->tracked_files;
+	next->n_tracked_files = node->n_tracked_files;
+	next->n_next_commit = 0;
+	next->prev = node;
+	next->actions = NULL;
+	next->n_actions = 0;
+	node->tracked_files = files;
+	node->n_tracked_files = n_files;
+	
+	// The files were hashed already, so they are committed like replayed commits.
+	int in_memory = project->in_memory;
+	project->in_memory = 1;
+	if (head != NULL && check_change(project) == 0) {
+		project->in_memory = in_memory;
+		node->tracked_files = next->tracked_files;
+		node->n_tracked_files = next->n_tracked_files;
+		free(next);
+		cleanup_files(n_files, files);
+		free(files);
+		staging_invalidate(project);
+		return NULL;
+	}
+	determine_action(project);
+	journal_log_commit(project, job->message);
+	char *commit_id = commit_staging(project, job->message, next, 0);
+	project->in_memory = in_memory;
+	staging_invalidate(project);
+	
+	// Files that were gone when the commit was read are not staged anymore, like
+	// check_local_deletion() does for svc_commit().
+	journal_pause(project);
+	for (size_t file_idx = 0; file_idx < job->n_files; file_idx++) {
+		if (job->file_names[file_idx] != NULL) {
+			stage_rm(project, job->file_names[file_idx]);
+		}
+	}
+	journal_resume(project);
+	
+	return commit_id;
+}
+
+static void commit_job_free(commit_job_t *job) {
+	for (size_t file_idx = 0; file_idx < job->n_files; file_idx++) {
+		free(job->file_names[file_idx]);
+	}
+	free(job->file_names);
+	free(job->dir);
+	free(job->message);
+}
+
+// Make the queued commits in order and report them to their callbacks. The files are read and
+// hashed without the write lock, only adding the commit holds it.
+static void *commit_queue_worker(void *arg) {
+	project_t *project = (project_t*)arg;
+	commit_queue_t *queue = project->commit_queue;
+	
+	pthread_mutex_lock(&queue->lock);
+	for (;;) {
+		while (queue->next_job == queue->n_jobs && queue->stop == 0) {
+			pthread_cond_wait(&queue->wake, &queue->lock);
+		}
+		if (queue->next_job == queue->n_jobs) {
+			break;
+		}
+		commit_job_t job = queue->jobs[queue->next_job++];
+		queue->running = 1;
+		pthread_mutex_unlock(&queue->lock);
+		
+		size_t n_files;
+		tracked_file_t *files = commit_job_read(project, &job, &n_files);
+		pthread_mutex_lock(&queue->write_lock);
+		char *commit_id = commit_job_publish(project, &job, files, n_files);
+		// Calls the callback makes are not locked again, they run on this thread.
+		if (job.callback != NULL) {
+			job.callback(job.ctx, commit_id);
+		}
+		pthread_mutex_unlock(&queue->write_lock);
+		commit_job_free(&job);
+		
+		pthread_mutex_lock(&queue->lock);
+		queue->running = 0;
+		if (queue->next_job == queue->n_jobs) {
+			queue->next_job = 0;
+			queue->n_jobs = 0;
+			pthread_cond_broadcast(&queue->idle);
+		}
+	}
+	pthread_mutex_unlock(&queue->lock);
+	
+	return NULL;
+}
+
+// Queue a commit of the staging area and return right away. A background thread makes the
+// queued commits in order and calls callback with ctx and the commit id, or NULL if there was
+// nothing to commit. The callback runs on that thread.
+// The names of the staged files are taken now, relative paths are resolved against the current
+// working directory, and the contents are read and hashed by the thread later.
+// Files can be added and removed while commits are queued, they are staged for the commit after
+// them. Calls that look at the commits or the head wait for the queue first, the readers
+// (get_commit, get_prev_commits, print_commit, list_branches) do not.
+// Return 0, or -1 if message is NULL.
+int svc_commit_async(void *helper, char *message, svc_commit_callback_t callback, void *ctx) {
+	TRACE_SCOPE("svc_commit_async", message, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	if (message == NULL) {
+		return -1;
+	}
+	
+	commit_queue_t *queue = project->commit_queue;
+	if (queue == NULL) {
+		queue = (commit_queue_t *)calloc(1, sizeof(commit_queue_t));
+		pthread_mutex_init(&queue->write_lock, NULL);
+		pthread_mutex_init(&queue->lock, NULL);
+		pthread_cond_init(&queue->wake, NULL);
+		pthread_cond_init(&queue->idle, NULL);
+		project->commit_queue = queue;
+		if (pthread_create(&queue->thread, NULL, commit_queue_worker, project) != 0) {
+			// Without a thread, commit synchronously.
+			project->commit_queue = NULL;
+			pthread_mutex_destroy(&queue->write_lock);
+			pthread_mutex_destroy(&queue->lock);
+			pthread_cond_destroy(&queue->wake);
+			pthread_cond_destroy(&queue->idle);
+			free(queue);
+			char *commit_id = svc_commit(project, message);
+			if (callback != NULL) {
+				callback(ctx, commit_id);
+			}
+			return 0;
+		}
+	}
+	
+	commit_job_t job;
+	job.message = malloc(strlen(message) + 1);
+	strcpy(job.message, message);
+	job.callback = callback;
+	job.ctx = ctx;
+	job.dir = ((project->fs.flags & SVC_FS_LOCAL) != 0) ? getcwd(NULL, 0) : NULL;
+	
+	commit_queue_lock(project);
+	commit_node_t *node = project->current_node;
+	job.n_files = node->n_tracked_files;
+	job.file_names = (char **)malloc(sizeof(char *) * (job.n_files + 1));
+	for (size_t file_idx = 0; file_idx < job.n_files; file_idx++) {
+		job.file_names[file_idx] = malloc(sizeof(char) * FILE_NAME_LEN);
+		strcpy(job.file_names[file_idx], node->tracked_files[file_idx].file_name);
+	}
+	commit_queue_unlock(project);
+	
+	pthread_mutex_lock(&queue->lock);
+	if (queue->n_jobs == queue->jobs_cap) {
+		queue->jobs_cap = (queue->jobs_cap == 0) ? 16 : queue->jobs_cap * 2;
+		queue->jobs = (commit_job_t *)realloc(queue->jobs, sizeof(commit_job_t) * queue->jobs_cap);
+	}
+	queue->jobs[queue->n_jobs++] = job;
+	pthread_cond_signal(&queue->wake);
+	pthread_mutex_unlock(&queue->lock);
+	
+	return 0;
+}
+
+void *get_commit(void *helper, char *commit_id) {
+	TRACE_SCOPE("get_commit", commit_id, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	
+	// If commit_id is NULL, this function should return NULL.
+	if (commit_id == NULL) {
+		return NULL;
+	}
+	
+	// Ids that svc_commit() can not have returned match no commit.
+	uint32_t id;
+	if (commit_id_from_hex(commit_id, &id) != 0) {
+		return NULL;
+	}
+	
+	int slot_idx = epoch_enter(project);
+	project_snapshot_t *snapshot = atomic_load(&project->snapshot);
+	commit_node_t *commit = NULL;
+	
+	// If a commit with the given id does exist, return its address.
+	if (snapshot->commit_index_cap > 0) {
+		size_t index_idx = commit_id_slot(id, snapshot->commit_index_cap);
+		unsigned int slot;
+		while ((slot = atomic_load(&snapshot->commit_index[index_idx])) != 0) {
+			// Entries added after this snapshot was published are not visible yet.
+			if (slot <= snapshot->n_total_commit && snapshot->commits.ids[slot - 1] == id) {
+				commit = snapshot->commits.nodes[slot - 1];
+				break;
+			}
+			index_idx = (index_idx + 1) & (snapshot->commit_index_cap - 1);
+		}
+	}
+	epoch_exit(project, slot_idx);
+	
+	// Otherwise, return NULL.
+    return commit;
+}
+
+char **get_prev_commits(void *helper, void *commit, int *n_prev) {
+	TRACE_SCOPE("get_prev_commits", NULL, TRACE_NONE, TRACE_NONE);
+	// If n_prev is NULL, return NULL.
+	if (n_prev == NULL) {
+		return NULL;
+	}
+	
+	// If commit is NULL, or it is the very first commit,
+	// this function should set the contents of n_prev to 0 and return NULL.
+	project_t *project = (project_t*)helper;
+	*n_prev = 0;
+	if (commit == NULL) {
+		return NULL;
+	}
+	
+	int slot_idx = epoch_enter(project);
+	project_snapshot_t *snapshot = atomic_load(&project->snapshot);
+	commit_meta_t *meta = &snapshot->commits;
+	commit_node_t *node = (commit_node_t*)commit;
+	char **prev_commits = NULL;
+	
+	// A staging area's previous commits start at the commit it was copied from.
+	uint32_t first_idx = COMMIT_NONE;
+	if (node->commit_seq != COMMIT_NONE) {
+		uint32_t commit_idx = node_commit_idx(meta, snapshot->n_total_commit, node);
+		first_idx = (commit_idx == COMMIT_NONE) ? COMMIT_NONE : meta->parents[commit_idx];
+	}else if (node->prev != NULL) {
+		first_idx = node_commit_idx(meta, snapshot->n_total_commit, node->prev);
+	}
+	
+	if (snapshot->n_total_commit > 1) {
+		int item_count = 0;
+		for (uint32_t commit_idx = first_idx; commit_idx != COMMIT_NONE; commit_idx = meta->parents[commit_idx]) {
+			item_count++;
+		}
+		if (item_count > 0) {
+			prev_commits = malloc(sizeof(char*) * item_count);
+		}
+		
+		// The ids point into the id arena, they are not copied.
+		*n_prev = 0;
+		for (uint32_t commit_idx = first_idx; commit_idx != COMMIT_NONE; commit_idx = meta->parents[commit_idx]) {
+			prev_commits[(*n_prev)++] = commit_hex(meta, commit_idx);
+		}
+	}
+	epoch_exit(project, slot_idx);
+	
+	return prev_commits;
+}
+
+// Output buffer for the commit formatter. With fd >= 0 it is flushed to the descriptor
+// whenever it fills up, otherwise output past cap is dropped and only counted.
+typedef struct format_buf{
+	char *data;
+	size_t len;
+	size_t cap;
+	int fd;
+	size_t total;
+	int error;
+}format_buf_t;
+
+static void format_flush(format_buf_t *out) {
+	size_t pos = 0;
+	while (out->fd >= 0 && pos < out->len) {
+		ssize_t n_written = write(out->fd, out->data + pos, out->len - pos);
+		if (n_written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			out->error = 1;
+			break;
+		}
+		pos += n_written;
+	}
+	out->len = 0;
+}
+
+static void format_put(format_buf_t *out, const char *str, size_t str_len) {
+	out->total += str_len;
+	if (out->len + str_len > out->cap) {
+		if (out->fd < 0) {
+			size_t n_fit = out->cap - out->len;
+			memcpy(out->data + out->len, str, n_fit);
+			out->len += n_fit;
+			return;
+		}
+		format_flush(out);
+		// Longer than the whole buffer, write it straight through.
+		if (str_len > out->cap) {
+			format_buf_t direct = {(char *)str, str_len, str_len, out->fd, 0, 0};
+			format_flush(&direct);
+			out->error |= direct.error;
+			return;
+		}
+	}
+	memcpy(out->data + out->len, str, str_len);
+	out->len += str_len;
+}
+
+static void format_str(format_buf_t *out, const char *str) {
+	format_put(out, str, strlen(str));
+}
+
+// Same as printf("%*ld", width, value).
+static void format_int(format_buf_t *out, long value, int width) {
+	char digits[24];
+	int n_digits = 0;
+	unsigned long magnitude = (value < 0) ? -(unsigned long)value : (unsigned long)value;
+	
+	do {
+		digits[sizeof(digits) - 1 - n_digits++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude != 0);
+	if (value < 0) {
+		digits[sizeof(digits) - 1 - n_digits++] = '-';
+	}
+	
+	static const char spaces[] = "                    ";
+	if (width > n_digits) {
+		format_put(out, spaces, width - n_digits);
+	}
+	format_put(out, digits + sizeof(digits) - n_digits, n_digits);
+}
+
+// Write the details of a commit in print_commit() format.
+static void format_commit(format_buf_t *out, project_snapshot_t *snapshot, uint32_t commit_idx) {
+	commit_meta_t *meta = &snapshot->commits;
+	commit_node_t *commit = meta->nodes[commit_idx];
+	char commit_id[COMMIT_ID_LEN];
+	commit_id_to_hex(meta->ids[commit_idx], commit_id);
+	format_put(out, commit_id, COMMIT_ID_LEN - 1);
+	format_put(out, " [", 2);
+	format_str(out, snapshot->branch_table[meta->branches[commit_idx]].branch_name);
+	format_put(out, "]: ", 3);
+	format_str(out, meta->messages + meta->message_offs[commit_idx]);
+	format_put(out, "\n", 1);
+	const action_info_t *actions = &meta->actions[meta->action_starts[commit_idx]];
+	for (uint32_t action_idx = 0; action_idx < meta->action_counts[commit_idx]; action_idx++) {
+		const action_info_t *action_inf = &actions[action_idx];
+		if (action_inf->action == ACTION_ADD) {
+			format_put(out, "    + ", 6);
+			format_str(out, action_inf->file_name);
+			format_put(out, "\n", 1);
+		}else if (action_inf->action == ACTION_REMOVE) {
+			format_put(out, "    - ", 6);
+			format_str(out, action_inf->file_name);
+			format_put(out, "\n", 1);
+		}else if (action_inf->action == ACTION_MODIFY){
+			// Hashes are printed as int, like the original "%10d".
+			format_put(out, "    / ", 6);
+			format_str(out, action_inf->file_name);
+			format_put(out, " [", 2);
+			format_int(out, (int)action_inf->old_hash, 10);
+			format_put(out, " -> ", 4);
+			format_int(out, (int)action_inf->hash, 10);
+			format_put(out, "]\n", 2);
+		}
+	}
+	format_put(out, "\n", 1);
+	format_put(out, "    Tracked files (", 19);
+	format_int(out, (long)commit->n_tracked_files, 0);
+	format_put(out, "):\n", 3);
+	for (int file_idx = 0; file_idx < commit->n_tracked_files; file_idx++) {
+		format_put(out, "    [", 5);
+		format_int(out, (int)commit->tracked_files[file_idx].hash, 10);
+		format_put(out, "] ", 2);
+		format_str(out, commit->tracked_files[file_idx].file_name);
+		format_put(out, "\n", 1);
+	}
+}
+
+// Write print_commit()'s output for the commit into the buffer.
+static void format_commit_id(void *helper, char *commit_id, format_buf_t *out) {
+	commit_node_t *commit = get_commit(helper, commit_id);
+	project_t *project = (project_t*)helper;
+	int slot_idx = epoch_enter(project);
+	project_snapshot_t *snapshot = atomic_load(&project->snapshot);
+	uint32_t commit_idx = (commit == NULL) ? COMMIT_NONE : node_commit_idx(&snapshot->commits, snapshot->n_total_commit, commit);
+
+	if (commit_idx == COMMIT_NONE || commit_id == NULL) {
+		format_str(out, "Invalid commit id\n");
+	}else {
+		format_commit(out, snapshot, commit_idx);
+	}
+	epoch_exit(project, slot_idx);
+}
+
+void print_commit(void *helper, char *commit_id) {
+	fprint_commit(helper, commit_id, stdout);
+}
+
+// Same as print_commit(), but the details are written to the given stream.
+void fprint_commit(void *helper, char *commit_id, FILE *stream) {
+	TRACE_SCOPE("fprint_commit", commit_id, TRACE_NONE, TRACE_NONE);
+	// Written through the stream, which may have no file descriptor (open_memstream, fmemopen).
+	char data[8192];
+	format_buf_t out = {data, 0, sizeof(data), -1, 0, 0};
+	format_commit_id(helper, commit_id, &out);
+	if (out.total > sizeof(data)) {
+		out.data = malloc(out.total);
+		out.len = 0;
+		out.cap = out.total;
+		out.total = 0;
+		format_commit_id(helper, commit_id, &out);
+	}
+	fwrite(out.data, 1, out.len, stream);
+	if (out.data != data) {
+		free(out.data);
+	}
+}
+
+// Write print_commit()'s output into buf, like snprintf(): at most buf_len - 1 bytes and a
+// terminating null byte. Return the length of the complete output.
+size_t svc_format_commit(void *helper, char *commit_id, char *buf, size_t buf_len) {
+	TRACE_SCOPE("svc_format_commit", commit_id, TRACE_NONE, TRACE_NONE);
+	format_buf_t out = {buf, 0, (buf_len == 0) ? 0 : buf_len - 1, -1, 0, 0};
+	if (buf == NULL) {
+		out.cap = 0;
+	}
+	format_commit_id(helper, commit_id, &out);
+	if (buf != NULL && buf_len > 0) {
+		buf[out.len] = '\0';
+	}
+	return out.total;
+}
+
+// Write print_commit()'s output to a file descriptor. Return 0, or -1 if the write failed.
+int svc_print_commit_fd(void *helper, char *commit_id, int fd) {
+	TRACE_SCOPE("svc_print_commit_fd", commit_id, TRACE_NONE, TRACE_NONE);
+	char data[8192];
+	format_buf_t out = {data, 0, sizeof(data), fd, 0, 0};
+	format_commit_id(helper, commit_id, &out);
+	format_flush(&out);
+	return (out.error == 0) ? 0 : -1;
+}
+
+// Write the details of every commit, in commit order, to a file descriptor.
+// Each commit is in print_commit() format. Return 0, or -1 if the write failed.
+int svc_export_log(void *helper, int fd) {
+	TRACE_SCOPE("svc_export_log", NULL, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	format_buf_t out = {malloc(1 << 20), 0, 1 << 20, fd, 0, 0};
+	
+	int slot_idx = epoch_enter(project);
+	project_snapshot_t *snapshot = atomic_load(&project->snapshot);
+	for (int commit_idx = 0; commit_idx < snapshot->n_total_commit && out.error == 0; commit_idx++) {
+		format_commit(&out, snapshot, commit_idx);
+	}
+	epoch_exit(project, slot_idx);
+	
+	format_flush(&out);
+	free(out.data);
+	return (out.error == 0) ? 0 : -1;
+}
+
+// Start recording trace events of the API calls and their phases on every thread. A thread
+// keeps its last ring_events events, rings that already exist keep their size.
+// Return 0. If ring_events is 0 or tracing is already on, return -1.
+int svc_trace_start(size_t ring_events) {
+	if (ring_events == 0 || atomic_load(&trace_enabled)) {
+		return -1;
+	}
+	atomic_store(&trace_ring_cap, ring_events);
+	// Events from an earlier trace are not part of this one.
+	for (trace_ring_t *ring = atomic_load(&trace_rings); ring != NULL; ring = ring->next) {
+		ring->tail = atomic_load(&ring->head);
+	}
+	atomic_store(&trace_enabled, 1);
+	return 0;
+}
+
+// JSON string, with the characters JSON does not allow escaped.
+static void trace_format_str(format_buf_t *out, const char *str) {
+	static const char digits[] = "0123456789abcdef";
+	format_put(out, "\"", 1);
+	for (const unsigned char *ptr = (const unsigned char *)str; *ptr != '\0'; ptr++) {
+		if (*ptr == '"' || *ptr == '\\') {
+			char escaped[2] = {'\\', *ptr};
+			format_put(out, escaped, 2);
+		}else if (*ptr < 0x20) {
+			char escaped[6] = {'\\', 'u', '0', '0', digits[*ptr >> 4], digits[*ptr & 0xf]};
+			format_put(out, escaped, 6);
+		}else {
+			format_put(out, (const char *)ptr, 1);
+		}
+	}
+	format_put(out, "\"", 1);
+}
+
+static void trace_format_event(format_buf_t *out, trace_event_t *event, int pid) {
+	format_str(out, "{\"name\":");
+	trace_format_str(out, event->name);
+	format_str(out, (event->phase == 'B') ? ",\"ph\":\"B\",\"ts\":" : ",\"ph\":\"E\",\"ts\":");
+	// Microseconds with three decimals.
+	char decimals[4] = {'.', '0' + event->ts / 100 % 10, '0' + event->ts / 10 % 10, '0' + event->ts % 10};
+	format_int(out, event->ts / 1000, 0);
+	format_put(out, decimals, 4);
+	format_str(out, ",\"pid\":");
+	format_int(out, pid, 0);
+	format_str(out, ",\"tid\":");
+	format_int(out, event->tid, 0);
+	format_str(out, ",\"args\":{");
+	int n_args = 0;
+	if (event->arg[0] != '\0') {
+		format_str(out, "\"arg\":");
+		trace_format_str(out, event->arg);
+		n_args++;
+	}
+	if (event->files != TRACE_NONE) {
+		format_str(out, (n_args++ > 0) ? ",\"files\":" : "\"files\":");
+		format_int(out, event->files, 0);
+	}
+	if (event->bytes != TRACE_NONE) {
+		format_str(out, (n_args++ > 0) ? ",\"bytes\":" : "\"bytes\":");
+		format_int(out, event->bytes, 0);
+	}
+	format_str(out, "}}");
+}
+
+// Stop recording and write the events recorded since svc_trace_start() to fd in the Chrome trace
+// event format, which chrome://tracing and Perfetto load. Events that other threads are writing
+// while tracing stops are left out.
+// Return 0. If tracing is off, return -1. If the write failed, return -2.
+int svc_trace_stop(int fd) {
+	if (atomic_exchange(&trace_enabled, 0) == 0) {
+		return -1;
+	}
+	
+	format_buf_t out = {malloc(1 << 16), 0, 1 << 16, fd, 0, 0};
+	int pid = getpid();
+	int n_events = 0;
+	format_str(&out, "{\"traceEvents\":[\n");
+	for (trace_ring_t *ring = atomic_load(&trace_rings); ring != NULL; ring = ring->next) {
+		unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		unsigned long pos = ring->tail;
+		// Older events were overwritten.
+		if (head - pos > ring->cap) {
+			pos = head - ring->cap;
+		}
+		for (; pos < head; pos++) {
+			trace_event_t *slot = &ring->events[pos % ring->cap];
+			if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1) {
+				continue;
+			}
+			trace_event_t event;
+			event.name = slot->name;
+			event.ts = slot->ts;
+			event.tid = slot->tid;
+			event.phase = slot->phase;
+			event.files = slot->files;
+			event.bytes = slot->bytes;
+			memcpy(event.arg, slot->arg, TRACE_ARG_LEN);
+			// Skip the event if its thread started to overwrite it meanwhile.
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != pos + 1) {
+				continue;
+			}
+			if (n_events++ > 0) {
+				format_str(&out, ",\n");
+			}
+			trace_format_event(&out, &event, pid);
+		}
+		ring->tail = head;
+	}
+	format_str(&out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	format_flush(&out);
+	free(out.data);
+	
+	return (out.error == 0) ? 0 : -2;
+}
+
+// Return the ids of the commits whose actions touched the path, as a dynamically allocated array.
+// If commit is NULL, every commit in the project is searched using the path log, oldest first.
+// Otherwise the commit and its previous commits are searched, newest first, and commits whose
+// Bloom filter rules the path out are skipped without looking at their actions.
+// The number of commits is stored in n_commits. If n_commits is NULL, return NULL.
+// Like svc_commit(), this must be called from the writer's thread.
+char **svc_path_log(void *helper, void *commit, char *path, int *n_commits) {
+	TRACE_SCOPE("svc_path_log", path, TRACE_NONE, TRACE_NONE);
+	commit_queue_wait((project_t*)helper);
+	if (n_commits == NULL) {
+		return NULL;
+	}
+	
+	*n_commits = 0;
+	if (path == NULL) {
+		return NULL;
+	}
+	
+	project_t *project = (project_t*)helper;
+	char **commit_ids = NULL;
+	
+	if (commit == NULL) {
+		if (project->path_logs_cap == 0) {
+			return NULL;
+		}
+		path_log_t *log = path_log_slot(project->path_logs, project->path_logs_cap, path);
+		if (log->file_name == NULL || log->n_commits == 0) {
+			return NULL;
+		}
+		commit_ids = (char **)malloc(sizeof(char *) * log->n_commits);
+		for (int commit_idx = 0; commit_idx < log->n_commits; commit_idx++) {
+			commit_ids[commit_idx] = commit_hex(&project->commits, log->commits[commit_idx]);
+		}
+		*n_commits = log->n_commits;
+		return commit_ids;
+	}
+	
+	commit_meta_t *meta = &project->commits;
+	size_t commit_ids_cap = 0;
+	uint32_t first_idx = project_commit_idx(project, (commit_node_t *)commit);
+	for (uint32_t commit_idx = first_idx; commit_idx != COMMIT_NONE; commit_idx = meta->parents[commit_idx]) {
+		if (path_bloom_test(&meta->path_blooms[commit_idx * PATH_BLOOM_WORDS], path) == 0) {
+			continue;
+		}
+		const action_info_t *actions = &meta->actions[meta->action_starts[commit_idx]];
+		for (uint32_t action_idx = 0; action_idx < meta->action_counts[commit_idx]; action_idx++) {
+			if (strcmp(actions[action_idx].file_name, path) != 0) {
+				continue;
+			}
+			if (*n_commits == commit_ids_cap) {
+				commit_ids_cap = (commit_ids_cap == 0) ? 16 : commit_ids_cap * 2;
+				commit_ids = (char **)realloc(commit_ids, sizeof(char *) * commit_ids_cap);
+			}
+			commit_ids[(*n_commits)++] = commit_hex(meta, commit_idx);
+			break;
+		}
+	}
+	
+	return commit_ids;
+}
+
+// Lines of a file for the diff. Each line keeps its start, length (with the newline) and hash.
+typedef struct diff_lines{
+	const unsigned char **start;
+	size_t *len;
+	uint64_t *hash;
+	size_t n_lines;
+}diff_lines_t;
+
+// One file to diff. Either side may be missing (added or removed file).
+typedef struct diff_job{
+	char *file_name;
+	const unsigned char *a_content;
+	size_t a_len;
+	int a_exists;
+	const unsigned char *b_content;
+	size_t b_len;
+	int b_exists;
+	char *out;
+	size_t out_len;
+	size_t out_cap;
+}diff_job_t;
+
+typedef struct diff_pool{
+	diff_job_t *jobs;
+	size_t n_jobs;
+	atomic_size_t next_job;
+}diff_pool_t;
+
+#define DIFF_CONTEXT 3
+
+static void diff_append(diff_job_t *job, const void *data, size_t data_len) {
+	if (job->out_len + data_len > job->out_cap) {
+		job->out_cap = (job->out_cap == 0) ? 4096 : job->out_cap;
+		while (job->out_len + data_len > job->out_cap) {
+			job->out_cap *= 2;
+		}
+		job->out = (char *)realloc(job->out, job->out_cap);
+	}
+	memcpy(job->out + job->out_len, data, data_len);
+	job->out_len += data_len;
+}
+
+static void diff_append_str(diff_job_t *job, const char *str) {
+	diff_append(job, str, strlen(str));
+}
+
+// Hash a line eight bytes at a time.
+static uint64_t line_hash(const unsigned char *line, size_t line_len) {
+	uint64_t hash = 0x9e3779b97f4a7c15ULL ^ line_len;
+	size_t pos = 0;
+	for (; pos + 8 <= line_len; pos += 8) {
+		uint64_t word;
+		memcpy(&word, line + pos, 8);
+		hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 32;
+	}
+	uint64_t tail = 0;
+	memcpy(&tail, line + pos, line_len - pos);
+	hash = (hash ^ tail) * 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 29;
+	return hash;
+}
+
+// Split the content into lines. memchr() finds the newlines many bytes at a time.
+static void diff_split_lines(const unsigned char *content, size_t content_len, diff_lines_t *lines) {
+	size_t n_lines = 0;
+	for (const unsigned char *ptr = content; ptr < content + content_len; n_lines++) {
+		const unsigned char *newline = memchr(ptr, '\n', content + content_len - ptr);
+		ptr = (newline == NULL) ? content + content_len : newline + 1;
+	}
+	
+	lines->n_lines = n_lines;
+	lines->start = (const unsigned char **)malloc(sizeof(unsigned char *) * (n_lines + 1));
+	lines->len = (size_t *)malloc(sizeof(size_t) * (n_lines + 1));
+	lines->hash = (uint64_t *)malloc(sizeof(uint64_t) * (n_lines + 1));
+	
+	const unsigned char *ptr = content;
+	for (size_t line_idx = 0; line_idx < n_lines; line_idx++) {
+		const unsigned char *newline = memchr(ptr, '\n', content + content_len - ptr);
+		const unsigned char *end = (newline == NULL) ? content + content_len : newline + 1;
+		lines->start[line_idx] = ptr;
+		lines->len[line_idx] = end - ptr;
+		lines->hash[line_idx] = line_hash(ptr, end - ptr);
+		ptr = end;
+	}
+}
+
+static void diff_free_lines(diff_lines_t *lines) {
+	free(lines->start);
+	free(lines->len);
+	free(lines->hash);
+}
+
+static int diff_line_equal(diff_lines_t *a, size_t a_idx, diff_lines_t *b, size_t b_idx) {
+	return a->hash[a_idx] == b->hash[b_idx] && a->len[a_idx] == b->len[b_idx] &&
+		   memcmp(a->start[a_idx], b->start[b_idx], a->len[a_idx]) == 0;
+}
+
+// State of one Myers diff: the two files and which of their lines are not common.
+typedef struct diff_ctx{
+	diff_lines_t *a;
+	diff_lines_t *b;
+	char *a_changed;
+	char *b_changed;
+	long *v_forward;
+	long *v_backward;
+}diff_ctx_t;
+
+// Find the middle snake of a[a_lo, a_hi) and b[b_lo, b_hi) (Myers, linear space).
+// The split point lies on a shortest edit script.
+static void diff_middle_snake(diff_ctx_t *ctx, long a_lo, long a_hi, long b_lo, long b_hi, long *a_split, long *b_split) {
+	long n = a_hi - a_lo;
+	long m = b_hi - b_lo;
+	long delta = n - m;
+	int is_odd = delta & 1;
+	long max_d = (n + m + 1) / 2;
+	// Diagonals run from -max_d - 1 to max_d + 1.
+	long *vf = ctx->v_forward + max_d + 1;
+	long *vb = ctx->v_backward + max_d + 1;
+	vf[1] = 0;
+	vb[1] = 0;
+	
+	for (long d = 0; d <= max_d; d++) {
+		for (long k = -d; k <= d; k += 2) {
+			long x = (k == -d || (k != d && vf[k - 1] < vf[k + 1])) ? vf[k + 1] : vf[k - 1] + 1;
+			long y = x - k;
+			while (x < n && y < m && diff_line_equal(ctx->a, a_lo + x, ctx->b, b_lo + y)) {
+				x++;
+				y++;
+			}
+			vf[k] = x;
+			if (is_odd && delta - k >= -(d - 1) && delta - k <= d - 1 && vf[k] + vb[delta - k] >= n) {
+				*a_split = a_lo + x;
+				*b_split = b_lo + y;
+				return;
+			}
+		}
+		for (long k = -d; k <= d; k += 2) {
+			long x = (k == -d || (k != d && vb[k - 1] < vb[k + 1])) ? vb[k + 1] : vb[k - 1] + 1;
+			long y = x - k;
+			while (x < n && y < m && diff_line_equal(ctx->a, a_hi - 1 - x, ctx->b, b_hi - 1 - y)) {
+				x++;
+				y++;
+			}
+			vb[k] = x;
+			if (!is_odd && delta - k >= -d && delta - k <= d && vb[k] + vf[delta - k] >= n) {
+				*a_split = a_hi - x;
+				*b_split = b_hi - y;
+				return;
+			}
+		}
+	}
+	
+	*a_split = a_lo;
+	*b_split = b_lo;
+}
+
+// Mark the lines of a[a_lo, a_hi) and b[b_lo, b_hi) that are not part of the longest common subsequence.
+static void diff_compare(diff_ctx_t *ctx, long a_lo, long a_hi, long b_lo, long b_hi) {
+	// Common prefix and suffix need no search.
+	while (a_lo < a_hi && b_lo < b_hi && diff_line_equal(ctx->a, a_lo, ctx->b, b_lo)) {
+		a_lo++;
+		b_lo++;
+	}
+	while (a_lo < a_hi && b_lo < b_hi && diff_line_equal(ctx->a, a_hi - 1, ctx->b, b_hi - 1)) {
+		a_hi--;
+		b_hi--;
+	}
+	
+	if (a_lo == a_hi || b_lo == b_hi) {
+		memset(ctx->a_changed + a_lo, 1, a_hi - a_lo);
+		memset(ctx->b_changed + b_lo, 1, b_hi - b_lo);
+		return;
+	}
+	
+	long a_split;
+	long b_split;
+	diff_middle_snake(ctx, a_lo, a_hi, b_lo, b_hi, &a_split, &b_split);
+	
+	// A split that does not shrink the problem can not happen after trimming, but never loop on it.
+	if ((a_split == a_lo && b_split == b_lo) || (a_split == a_hi && b_split == b_hi)) {
+		memset(ctx->a_changed + a_lo, 1, a_hi - a_lo);
+		memset(ctx->b_changed + b_lo, 1, b_hi - b_lo);
+		return;
+	}
+	
+	diff_compare(ctx, a_lo, a_split, b_lo, b_split);
+	diff_compare(ctx, a_split, a_hi, b_split, b_hi);
+}
+
+// Append "-start,len" (or "+start,len") of a unified diff hunk header.
+static void diff_append_range(diff_job_t *job, char sign, size_t start, size_t len) {
+	char range[64];
+	if (len == 1) {
+		snprintf(range, sizeof(range), "%c%zu", sign, start + 1);
+	}else {
+		// An empty range names the line before it.
+		snprintf(range, sizeof(range), "%c%zu,%zu", sign, (len == 0) ? start : start + 1, len);
+	}
+	diff_append_str(job, range);
+}
+
+static void diff_append_line(diff_job_t *job, char sign, diff_lines_t *lines, size_t line_idx) {
+	diff_append(job, &sign, 1);
+	diff_append(job, lines->start[line_idx], lines->len[line_idx]);
+	if (lines->len[line_idx] == 0 || lines->start[line_idx][lines->len[line_idx] - 1] != '\n') {
+		diff_append_str(job, "\n\\ No newline at end of file\n");
+	}
+}
+
+// Produce the unified diff of one file into job->out.
+static void diff_file(diff_job_t *job) {
+	// Content with a null byte is not text.
+	if ((job->a_exists && memchr(job->a_content, '\0', job->a_len) != NULL) ||
+	   (job->b_exists && memchr(job->b_content, '\0', job->b_len) != NULL)
+	){
+		diff_append_str(job, "Binary files ");
+		diff_append_str(job, job->a_exists ? "a/" : "/dev/null");
+		diff_append_str(job, job->a_exists ? job->file_name : "");
+		diff_append_str(job, " and ");
+		diff_append_str(job, job->b_exists ? "b/" : "/dev/null");
+		diff_append_str(job, job->b_exists ? job->file_name : "");
+		diff_append_str(job, " differ\n");
+		return;
+	}
+	
+	diff_lines_t a;
+	diff_lines_t b;
+	diff_split_lines(job->a_content, job->a_exists ? job->a_len : 0, &a);
+	diff_split_lines(job->b_content, job->b_exists ? job->b_len : 0, &b);
+	
+	diff_ctx_t ctx;
+	ctx.a = &a;
+	ctx.b = &b;
+	ctx.a_changed = (char *)calloc(a.n_lines + 1, 1);
+	ctx.b_changed = (char *)calloc(b.n_lines + 1, 1);
+	size_t v_len = (a.n_lines + b.n_lines + 1) / 2 * 2 + 4;
+	ctx.v_forward = (long *)malloc(sizeof(long) * v_len);
+	ctx.v_backward = (long *)malloc(sizeof(long) * v_len);
+	diff_compare(&ctx, 0, a.n_lines, 0, b.n_lines);
+	
+	diff_append_str(job, job->a_exists ? "--- a/" : "--- /dev/null");
+	diff_append_str(job, job->a_exists ? job->file_name : "");
+	diff_append_str(job, job->b_exists ? "\n+++ b/" : "\n+++ /dev/null");
+	diff_append_str(job, job->b_exists ? job->file_name : "");
+	diff_append_str(job, "\n");
+	
+	size_t a_idx = 0;
+	size_t b_idx = 0;
+	while (a_idx < a.n_lines || b_idx < b.n_lines) {
+		// Skip to the next change.
+		if ((a_idx >= a.n_lines || ctx.a_changed[a_idx] == 0) && (b_idx >= b.n_lines || ctx.b_changed[b_idx] == 0)) {
+			a_idx++;
+			b_idx++;
+			continue;
+		}
+		
+		// Extend the hunk over every change that is at most 2 * DIFF_CONTEXT common lines away.
+		size_t context = (a_idx < DIFF_CONTEXT) ? a_idx : DIFF_CONTEXT;
+		size_t a_start = a_idx - context;
+		size_t b_start = b_idx - context;
+		size_t a_end = a_idx;
+		size_t b_end = b_idx;
+		for (;;) {
+			while (a_end < a.n_lines && ctx.a_changed[a_end]) {
+				a_end++;
+			}
+			while (b_end < b.n_lines && ctx.b_changed[b_end]) {
+				b_end++;
+			}
+			size_t n_common = 0;
+			while (a_end + n_common < a.n_lines && b_end + n_common < b.n_lines &&
+				   ctx.a_changed[a_end + n_common] == 0 && ctx.b_changed[b_end + n_common] == 0 && n_common <= 2 * DIFF_CONTEXT) {
+				n_common++;
+			}
+			int is_more = (a_end + n_common < a.n_lines && ctx.a_changed[a_end + n_common]) ||
+						  (b_end + n_common < b.n_lines && ctx.b_changed[b_end + n_common]);
+			if (n_common <= 2 * DIFF_CONTEXT && is_more) {
+				a_end += n_common;
+				b_end += n_common;
+				continue;
+			}
+			context = (n_common < DIFF_CONTEXT) ? n_common : DIFF_CONTEXT;
+			a_end += context;
+			b_end += context;
+			break;
+		}
+		
+		diff_append_str(job, "@@ ");
+		diff_append_range(job, '-', a_start, a_end - a_start);
+		diff_append_str(job, " ");
+		diff_append_range(job, '+', b_start, b_end - b_start);
+		diff_append_str(job, " @@\n");
+		
+		a_idx = a_start;
+		b_idx = b_start;
+		while (a_idx < a_end || b_idx < b_end) {
+			if (a_idx < a_end && ctx.a_changed[a_idx]) {
+				diff_append_line(job, '-', &a, a_idx++);
+			}else if (b_idx < b_end && ctx.b_changed[b_idx]) {
+				diff_append_line(job, '+', &b, b_idx++);
+			}else {
+				diff_append_line(job, ' ', &a, a_idx++);
+				b_idx++;
+			}
+		}
+	}
+	
+	free(ctx.a_changed);
+	free(ctx.b_changed);
+	free(ctx.v_forward);
+	free(ctx.v_backward);
+	diff_free_lines(&a);
+	diff_free_lines(&b);
+}
+
+static void *diff_worker(void *arg) {
+	diff_pool_t *pool = (diff_pool_t *)arg;
+	for (;;) {
+		size_t job_idx = atomic_fetch_add(&pool->next_job, 1);
+		if (job_idx >= pool->n_jobs) {
+			return NULL;
+		}
+		diff_file(&pool->jobs[job_idx]);
+	}
+}
+
+// Comparator function for qsort in order to sort tracked files by name.
+static int compare_tracked_file(const void *pa, const void *pb) {
+	const tracked_file_t *p1 = *(const tracked_file_t **)pa;
+	const tracked_file_t *p2 = *(const tracked_file_t **)pb;
+	return strcmp(p1->file_name, p2->file_name);
+}
+
+// Tracked files of a node, sorted by name.
+static tracked_file_t **sorted_tracked_files(commit_node_t *node) {
+	tracked_file_t **files = (tracked_file_t **)malloc(sizeof(tracked_file_t *) * (node->n_tracked_files + 1));
+	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+		files[file_idx] = &node->tracked_files[file_idx];
+	}
+	qsort(files, node->n_tracked_files, sizeof(tracked_file_t *), compare_tracked_file);
+	return files;
+}
+
+// Write the unified diff between two commits to a file descriptor.
+// If to_id is NULL, the commit is compared with the tracked files in the working tree.
+// Files whose fingerprints match are skipped without looking at their content, and the changed
+// files are diffed in parallel.
+// If from_id is NULL or no such commit exists, return -1. If to_id does not exist, return -2.
+// If writing fails, return -3. Otherwise return 0.
+int svc_diff(void *helper, char *from_id, char *to_id, int fd) {
+	TRACE_SCOPE("svc_diff", from_id, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_wait(project);
+	
+	commit_node_t *from = get_commit(helper, from_id);
+	if (from == NULL) {
+		return -1;
+	}
+	commit_node_t *to = project->current_node;
+	if (to_id != NULL) {
+		to = get_commit(helper, to_id);
+		if (to == NULL) {
+			return -2;
+		}
+	}
+	
+	tracked_file_t **a_files = sorted_tracked_files(from);
+	tracked_file_t **b_files = sorted_tracked_files(to);
+	// Spilled contents are mapped in below, keep them all mapped until the diffs are done.
+	content_pin(project);
+	diff_job_t *jobs = (diff_job_t *)calloc(from->n_tracked_files + to->n_tracked_files + 1, sizeof(diff_job_t));
+	// Working tree contents read for the diff, freed at the end.
+	unsigned char **disk_contents = (unsigned char **)calloc(to->n_tracked_files + 1, sizeof(unsigned char *));
+	size_t n_jobs = 0;
+	size_t a_idx = 0;
+	size_t b_idx = 0;
+	
+	// Merge the two sorted file lists.
+	while (a_idx < from->n_tracked_files || b_idx < to->n_tracked_files) {
+		int order = 0;
+		if (a_idx == from->n_tracked_files) {
+			order = 1;
+		}else if (b_idx == to->n_tracked_files) {
+			order = -1;
+		}else {
+			order = strcmp(a_files[a_idx]->file_name, b_files[b_idx]->file_name);
+		}
+		
+		diff_job_t *job = &jobs[n_jobs];
+		int is_changed = 1;
+		if (order <= 0) {
+			job->file_name = a_files[a_idx]->file_name;
+			job->a_len = a_files[a_idx]->content_len;
+			job->a_exists = 1;
+		}
+		if (order >= 0) {
+			job->file_name = b_files[b_idx]->file_name;
+			job->b_len = b_files[b_idx]->content_len;
+			job->b_exists = 1;
+			uint64_t b_fingerprint = b_files[b_idx]->fingerprint;
+			
+			if (to_id == NULL) {
+				int hash = hash_file_ex(helper, job->file_name, &b_fingerprint);
+				// Deleted from the working tree.
+				if (hash < 0) {
+					job->b_exists = 0;
+					job->b_len = 0;
+				}
+			}
+			// Same fingerprint on both sides means no change, the contents are not compared.
+			if (order == 0 && job->b_exists == 1 && b_fingerprint == a_files[a_idx]->fingerprint) {
+				is_changed = 0;
+			}
+			if (is_changed == 1 && to_id == NULL && job->b_exists == 1) {
+				disk_contents[b_idx] = file_content_copy(project, job->file_name, &job->b_len);
+				job->b_content = disk_contents[b_idx];
+			}else if (is_changed == 1 && job->b_exists == 1) {
+				job->b_content = content_get(project, b_files[b_idx]);
+			}
+		}
+		
+		if (is_changed == 1 && (job->a_exists || job->b_exists)) {
+			// Only the contents of changed files are touched.
+			if (job->a_exists == 1) {
+				job->a_content = content_get(project, a_files[a_idx]);
+			}
+			n_jobs++;
+		}else {
+			memset(job, 0, sizeof(diff_job_t));
+		}
+		
+		if (order <= 0) {
+			a_idx++;
+		}
+		if (order >= 0) {
+			b_idx++;
+		}
+	}
+	
+	// Diff the changed files on as many threads as there are cores.
+	diff_pool_t pool;
+	pool.jobs = jobs;
+	pool.n_jobs = n_jobs;
+	atomic_init(&pool.next_job, 0);
+	long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_threads > (long)n_jobs) {
+		n_threads = n_jobs;
+	}
+	if (n_threads > 64) {
+		n_threads = 64;
+	}
+	pthread_t threads[64];
+	int n_started = 0;
+	for (int thread_idx = 1; thread_idx < n_threads; thread_idx++) {
+		if (pthread_create(&threads[n_started], NULL, diff_worker, &pool) == 0) {
+			n_started++;
+		}
+	}
+	diff_worker(&pool);
+	for (int thread_idx = 0; thread_idx < n_started; thread_idx++) {
+		pthread_join(threads[thread_idx], NULL);
+	}
+	
+	// Write the diffs in file name order.
+	int result = 0;
+	for (size_t job_idx = 0; job_idx < n_jobs; job_idx++) {
+		format_buf_t out = {jobs[job_idx].out, jobs[job_idx].out_len, jobs[job_idx].out_len, fd, 0, 0};
+		if (result == 0) {
+			format_flush(&out);
+			if (out.error != 0) {
+				result = -3;
+			}
+		}
+		free(jobs[job_idx].out);
+	}
+	
+	for (size_t file_idx = 0; file_idx < to->n_tracked_files; file_idx++) {
+		free(disk_contents[file_idx]);
+	}
+	free(disk_contents);
+	free(jobs);
+	free(a_files);
+	free(b_files);
+	content_unpin(project);
+	
+	return result;
+}
+
+// Tar archives are written in blocks of this size.
+#define TAR_BLOCK 512
+// Files whose headers and contents are gathered into one writev() batch.
+#define ARCHIVE_BATCH_FILES 256
+// Room for the headers of one file: a pax header, its records and the ustar header.
+#define ARCHIVE_HEADER_MAX (3 * TAR_BLOCK)
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Write all the buffers, continuing after short writes. Return 0, or -1 if writing failed.
+static int write_all_iov(int fd, struct iovec *iov, int n_iov) {
+	while (n_iov > 0) {
+		ssize_t n_written = writev(fd, iov, (n_iov > IOV_MAX) ? IOV_MAX : n_iov);
+		if (n_written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		while (n_iov > 0 && (size_t)n_written >= iov->iov_len) {
+			n_written -= iov->iov_len;
+			iov++;
+			n_iov--;
+		}
+		if (n_iov > 0) {
+			iov->iov_base = (char *)iov->iov_base + n_written;
+			iov->iov_len -= n_written;
+		}
+	}
+	return 0;
+}
+
+// Write a value as a null terminated octal number filling the field.
+static void tar_octal(unsigned char *field, size_t field_len, uint64_t value) {
+	field[field_len - 1] = '\0';
+	for (size_t digit_idx = field_len - 1; digit_idx > 0; digit_idx--) {
+		field[digit_idx - 1] = '0' + (value & 7);
+		value >>= 3;
+	}
+}
+
+// Fill a ustar header block. Members are regular files owned by root with mode 0644 and
+// mtime 0, so the same commit always gives the same archive.
+static void tar_header(unsigned char *block, const char *name, size_t name_len, const char *prefix, size_t prefix_len, uint64_t size, char type) {
+	memset(block, 0, TAR_BLOCK);
+	memcpy(block, name, name_len);
+	tar_octal(block + 100, 8, 0644);
+	tar_octal(block + 108, 8, 0);
+	tar_octal(block + 116, 8, 0);
+	// Sizes that do not fit the field are given by a pax record instead.
+	tar_octal(block + 124, 12, (size < (1ULL << 33)) ? size : 0);
+	tar_octal(block + 136, 12, 0);
+	block[156] = type;
+	memcpy(block + 257, "ustar", 6);
+	memcpy(block + 263, "00", 2);
+	memcpy(block + 345, prefix, prefix_len);
+	
+	// The checksum is computed with its own field filled with spaces.
+	memset(block + 148, ' ', 8);
+	unsigned int checksum = 0;
+	for (int byte_idx = 0; byte_idx < TAR_BLOCK; byte_idx++) {
+		checksum += block[byte_idx];
+	}
+	tar_octal(block + 148, 7, checksum);
+}
+
+// Append a pax record "<length> <key>=<value>\n". The length counts its own digits.
+static void pax_record(format_buf_t *out, const char *key, const char *value, size_t value_len) {
+	size_t body_len = 1 + strlen(key) + 1 + value_len + 1;
+	size_t record_len = body_len + 1;
+	for (size_t limit = 10; record_len >= limit; limit *= 10) {
+		record_len++;
+	}
+	format_int(out, (long)record_len, 0);
+	format_put(out, " ", 1);
+	format_str(out, key);
+	format_put(out, "=", 1);
+	format_put(out, value, value_len);
+	format_put(out, "\n", 1);
+}
+
+// Write the headers of a file into buf. Return their length.
+// Paths that do not fit ustar's name and prefix fields, and sizes of 8 GiB and more, get a pax header.
+static size_t archive_file_header(unsigned char *buf, const char *file_name, uint64_t size) {
+	size_t name_len = strlen(file_name);
+	const char *name = file_name;
+	const char *prefix = "";
+	size_t prefix_len = 0;
+	int needs_pax = (size >= (1ULL << 33));
+	
+	if (name_len > 100) {
+		// Split at a slash so the directory part goes into the prefix field.
+		const char *slash = NULL;
+		for (const char *ptr = file_name; *ptr != '\0'; ptr++) {
+			if (*ptr == '/' && ptr - file_name <= 155 && name_len - (ptr - file_name) - 1 <= 100 && ptr[1] != '\0') {
+				slash = ptr;
+				break;
+			}
+		}
+		if (slash != NULL) {
+			prefix = file_name;
+			prefix_len = slash - file_name;
+			name = slash + 1;
+			name_len = name_len - prefix_len - 1;
+		}else {
+			needs_pax = 1;
+			name_len = 100;
+		}
+	}
+	
+	size_t header_len = 0;
+	if (needs_pax) {
+		format_buf_t records = {(char *)buf + TAR_BLOCK, 0, TAR_BLOCK, -1, 0, 0};
+		if (name != file_name || name_len < strlen(file_name)) {
+			pax_record(&records, "path", file_name, strlen(file_name));
+		}
+		if (size >= (1ULL << 33)) {
+			char digits[24];
+			format_buf_t size_out = {digits, 0, sizeof(digits), -1, 0, 0};
+			format_int(&size_out, (long)size, 0);
+			pax_record(&records, "size", digits, size_out.len);
+		}
+		size_t records_len = records.len;
+		tar_header(buf, "././@PaxHeader", 14, "", 0, records_len, 'x');
+		memset(buf + TAR_BLOCK + records_len, 0, TAR_BLOCK - records_len);
+		header_len = 2 * TAR_BLOCK;
+	}
+	tar_header(buf + header_len, name, name_len, prefix, prefix_len, size, '0');
+	
+	return header_len + TAR_BLOCK;
+}
+
+// Copy spilled content from the spill file straight to the descriptor.
+// Return 0, -1 if writing failed, or 1 if sendfile() can not write to fd and nothing was sent.
+static int archive_sendfile(project_t *project, tracked_file_t *file, int fd) {
+	off_t offset = file->spill_offset;
+	size_t remaining = file->content_len;
+	while (remaining > 0) {
+		ssize_t n_sent = sendfile(fd, project->spill_fd, &offset, remaining);
+		if (n_sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((errno == EINVAL || errno == ENOSYS) && remaining == file->content_len) {
+				return 1;
+			}
+			return -1;
+		}
+		if (n_sent == 0) {
+			return -1;
+		}
+		remaining -= n_sent;
+	}
+	return 0;
+}
+
+// Write a tar archive of the tracked files of a commit to a file descriptor, in file name order.
+// Headers of a batch of files are built in one buffer and written together with the contents
+// by writev(), without copying the contents. Contents spilled to disk are sent from the spill
+// file with sendfile().
+// If commit_id is NULL or no such commit exists, return -1. If writing fails, return -2.
+// Otherwise return 0. Like svc_commit(), this must be called from the writer's thread.
+int svc_archive(void *helper, char *commit_id, int fd) {
+	TRACE_SCOPE("svc_archive", commit_id, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_wait(project);
+	
+	commit_node_t *commit = get_commit(helper, commit_id);
+	if (commit == NULL) {
+		return -1;
+	}
+	
+	static const unsigned char zero_block[2 * TAR_BLOCK];
+	tracked_file_t **files = sorted_tracked_files(commit);
+	unsigned char *headers = (unsigned char *)malloc(ARCHIVE_BATCH_FILES * ARCHIVE_HEADER_MAX);
+	struct iovec *iov = (struct iovec *)malloc(sizeof(struct iovec) * (3 * ARCHIVE_BATCH_FILES + 1));
+	int n_iov = 0;
+	int n_batch = 0;
+	int result = 0;
+	// Contents in the batch must stay where they are until it is written.
+	content_pin(project);
+	
+	for (size_t file_idx = 0; file_idx < commit->n_tracked_files && result == 0; file_idx++) {
+		tracked_file_t *file = content_owner(files[file_idx]);
+		unsigned char *header = headers + n_batch * ARCHIVE_HEADER_MAX;
+		iov[n_iov].iov_base = header;
+		iov[n_iov].iov_len = archive_file_header(header, file->file_name, file->content_len);
+		n_iov++;
+		n_batch++;
+		
+		if (file->content_state == CONTENT_SPILLED && file->content_len > 0) {
+			// The headers so far have to go out before the content is sent.
+			result = write_all_iov(fd, iov, n_iov);
+			n_iov = 0;
+			n_batch = 0;
+			if (result == 0) {
+				result = archive_sendfile(project, file, fd);
+			}
+			if (result == 1) {
+				result = 0;
+				if (content_get(project, file) == NULL) {
+					result = -1;
+					break;
+				}
+			}
+		}
+		if (file->content_state != CONTENT_SPILLED && file->content_len > 0) {
+			iov[n_iov].iov_base = file->content;
+			iov[n_iov].iov_len = file->content_len;
+			n_iov++;
+		}
+		
+		size_t padding = (TAR_BLOCK - file->content_len % TAR_BLOCK) % TAR_BLOCK;
+		if (padding > 0) {
+			iov[n_iov].iov_base = (void *)zero_block;
+			iov[n_iov].iov_len = padding;
+			n_iov++;
+		}
+		
+		if (n_batch == ARCHIVE_BATCH_FILES && result == 0) {
+			result = write_all_iov(fd, iov, n_iov);
+			n_iov = 0;
+			n_batch = 0;
+		}
+	}
+	
+	// The archive ends with two zero blocks.
+	if (result == 0) {
+		iov[n_iov].iov_base = (void *)zero_block;
+		iov[n_iov].iov_len = sizeof(zero_block);
+		n_iov++;
+		result = write_all_iov(fd, iov, n_iov);
+	}
+	
+	content_unpin(project);
+	free(iov);
+	free(headers);
+	free(files);
+	
+	return (result == 0) ? 0 : -2;
+}
+
+// Files of one commit that one fsck worker verifies at a time.
+#define FSCK_JOB_FILES 64
+
+typedef struct fsck_job{
+	uint32_t commit_idx;
+	int first_file;
+	int n_files;
+}fsck_job_t;
+
+// A problem found by a worker, before it is reported.
+typedef struct fsck_found{
+	svc_fsck_kind_t kind;
+	uint32_t commit_idx;
+	char *name;
+}fsck_found_t;
+
+typedef struct fsck_list{
+	fsck_found_t *found;
+	size_t n_found;
+	size_t found_cap;
+}fsck_list_t;
+
+typedef struct fsck_pool{
+	project_t *project;
+	int checks;
+	fsck_job_t *jobs;
+	size_t n_jobs;
+	atomic_size_t next_job;
+	pthread_mutex_t lock;
+	fsck_list_t list;
+}fsck_pool_t;
+
+static void fsck_report(fsck_list_t *list, svc_fsck_kind_t kind, uint32_t commit_idx, char *name) {
+	if (list->n_found == list->found_cap) {
+		list->found_cap = (list->found_cap == 0) ? 16 : list->found_cap * 2;
+		list->found = (fsck_found_t *)realloc(list->found, sizeof(fsck_found_t) * list->found_cap);
+	}
+	list->found[list->n_found].kind = kind;
+	list->found[list->n_found].commit_idx = commit_idx;
+	list->found[list->n_found].name = name;
+	list->n_found++;
+}
+
+// Each committed action must agree with the files of its commit.
+static void fsck_actions(project_t *project, uint32_t commit_idx, fsck_list_t *list) {
+	commit_meta_t *meta = &project->commits;
+	commit_node_t *node = meta->nodes[commit_idx];
+	action_info_t *actions = &meta->actions[meta->action_starts[commit_idx]];
+	tracked_file_t **files = sorted_tracked_files(node);
+	
+	for (uint32_t action_idx = 0; action_idx < meta->action_counts[commit_idx]; action_idx++) {
+		action_info_t *action = &actions[action_idx];
+		tracked_file_t key;
+		tracked_file_t *key_ptr = &key;
+		key.file_name = action->file_name;
+		tracked_file_t **found = (tracked_file_t **)bsearch(&key_ptr, files, node->n_tracked_files, sizeof(tracked_file_t *), compare_tracked_file);
+		if (action->action == ACTION_REMOVE) {
+			if (found != NULL) {
+				fsck_report(list, FSCK_BAD_ACTION, commit_idx, action->file_name);
+			}
+		}else if (found == NULL || (*found)->hash != action->hash) {
+			fsck_report(list, FSCK_BAD_ACTION, commit_idx, action->file_name);
+		}
+	}
+	free(files);
+}
+
+// The stored id must be the one get_commit_id() computes from the message and the actions, or
+// for a replayed commit one that commit_id_next() reaches from there in at most as many steps as
+// commits were made before it. The commits it stepped over may be squashed away since.
+static void fsck_id(project_t *project, uint32_t commit_idx, fsck_list_t *list) {
+	commit_meta_t *meta = &project->commits;
+	uint32_t hex_id;
+	uint32_t stored_id = meta->ids[commit_idx];
+	unsigned int commit_id = commit_id_of(meta->messages + meta->message_offs[commit_idx], &meta->actions[meta->action_starts[commit_idx]], meta->action_counts[commit_idx]);
+	uint64_t n_steps;
+	if (stored_id == commit_id) {
+		n_steps = 0;
+	}else if (stored_id == 0 || stored_id > COMMIT_ID_MAX) {
+		n_steps = UINT64_MAX;
+	}else if (commit_id == 0) {
+		n_steps = stored_id;
+	}else {
+		n_steps = ((uint64_t)stored_id + COMMIT_ID_MAX - commit_id) % COMMIT_ID_MAX;
+	}
+	if (n_steps > meta->seqs[commit_idx] || commit_id_from_hex(commit_hex(meta, commit_idx), &hex_id) != 0 || hex_id != stored_id) {
+		fsck_report(list, FSCK_BAD_ID, commit_idx, NULL);
+	}
+}
+
+// Recompute the hash and fingerprint of stored contents. Spilled contents are read with pread(),
+// the workers must not map them in through content_get(). A shared content is verified with the
+// file that holds it, the files sharing it only have to agree with that file.
+static void fsck_contents(project_t *project, fsck_job_t *job, unsigned char **buf, size_t *buf_cap, fsck_list_t *list) {
+	commit_node_t *node = project->commits.nodes[job->commit_idx];
+	for (int file_idx = job->first_file; file_idx < job->first_file + job->n_files; file_idx++) {
+		tracked_file_t *file = &node->tracked_files[file_idx];
+		if (file->base != NULL) {
+			tracked_file_t *base = file->base;
+			if (base->fingerprint != file->fingerprint || base->hash != file->hash || base->content_len != file->content_len || strcmp(base->file_name, file->file_name) != 0) {
+				fsck_report(list, FSCK_BAD_CONTENT, job->commit_idx, file->file_name);
+			}
+			continue;
+		}
+		const unsigned char *content = file->content;
+		if (file->content_state == CONTENT_SPILLED) {
+			if (*buf_cap < file->content_len + 1) {
+				*buf_cap = file->content_len + 1;
+				*buf = (unsigned char *)realloc(*buf, *buf_cap);
+			}
+			size_t pos = 0;
+			while (pos < file->content_len) {
+				ssize_t n_read = pread(project->spill_fd, *buf + pos, file->content_len - pos, file->spill_offset + pos);
+				if (n_read < 0 && errno == EINTR) {
+					continue;
+				}
+				if (n_read <= 0) {
+					break;
+				}
+				pos += n_read;
+			}
+			if (pos < file->content_len) {
+				fsck_report(list, FSCK_BAD_CONTENT, job->commit_idx, file->file_name);
+				continue;
+			}
+			content = *buf;
+		}else if (content == NULL) {
+			// The file could not be read when it was committed.
+			continue;
+		}
+		
+		unsigned int hash = 0;
+		for (const char *ptr = file->file_name; *ptr != '\0'; ptr++) {
+			hash += *ptr;
+			hash = (hash % 1000);
+		}
+		uint64_t fingerprint = fingerprint_content(content, file->content_len, &hash);
+		if (fingerprint != file->fingerprint || hash != file->hash) {
+			fsck_report(list, FSCK_BAD_CONTENT, job->commit_idx, file->file_name);
+		}
+	}
+}
+
+static void *fsck_worker(void *arg) {
+	fsck_pool_t *pool = (fsck_pool_t *)arg;
+	fsck_list_t list = {NULL, 0, 0};
+	unsigned char *buf = NULL;
+	size_t buf_cap = 0;
+	
+	for (;;) {
+		size_t job_idx = atomic_fetch_add(&pool->next_job, 1);
+		if (job_idx >= pool->n_jobs) {
+			break;
+		}
+		fsck_job_t *job = &pool->jobs[job_idx];
+		// The first job of a commit checks the commit itself.
+		if (job->first_file == 0 && (pool->checks & FSCK_GRAPH)) {
+			fsck_actions(pool->project, job->commit_idx, &list);
+		}
+		if (job->first_file == 0 && (pool->checks & FSCK_IDS)) {
+			fsck_id(pool->project, job->commit_idx, &list);
+		}
+		if (pool->checks & FSCK_CONTENT) {
+			fsck_contents(pool->project, job, &buf, &buf_cap, &list);
+		}
+	}
+	free(buf);
+	
+	pthread_mutex_lock(&pool->lock);
+	for (size_t found_idx = 0; found_idx < list.n_found; found_idx++) {
+		fsck_report(&pool->list, list.found[found_idx].kind, list.found[found_idx].commit_idx, list.found[found_idx].name);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	free(list.found);
+	
+	return NULL;
+}
+
+// The commit metadata, the commit id index and the links of a commit must agree.
+// Return 0 if the commit's node can be looked at.
+static int fsck_commit_links(project_t *project, uint32_t commit_idx, fsck_list_t *list) {
+	commit_meta_t *meta = &project->commits;
+	commit_node_t *node = meta->nodes[commit_idx];
+	if (node == NULL || project_commit_idx(project, node) != commit_idx) {
+		fsck_report(list, FSCK_BAD_LINK, commit_idx, NULL);
+		return -1;
+	}
+	
+	int is_bad = 0;
+	uint32_t parent = meta->parents[commit_idx];
+	uint32_t prev = (node->prev == NULL) ? COMMIT_NONE : project_commit_idx(project, node->prev);
+	// Parents are always committed first, so the history has no cycles.
+	if (parent != prev || (parent != COMMIT_NONE && parent >= commit_idx)) {
+		is_bad = 1;
+	}
+	if (meta->branches[commit_idx] >= project->n_total_branch || strcmp(project->branch_table[meta->branches[commit_idx]].branch_name, node->branch_name) != 0) {
+		is_bad = 1;
+	}
+	if (meta->message_offs[commit_idx] >= meta->messages_len || (size_t)meta->action_starts[commit_idx] + meta->action_counts[commit_idx] > meta->n_actions) {
+		is_bad = 1;
+	}
+	for (int next_idx = 0; next_idx < node->n_next_commit; next_idx++) {
+		commit_node_t *next = node->next[next_idx];
+		if (next == NULL || (next->commit_seq != COMMIT_NONE && project_commit_idx(project, next) == COMMIT_NONE)) {
+			is_bad = 1;
+		}
+	}
+	
+	// The index must lead to this commit, or to an earlier one with the same id.
+	uint32_t found = commit_index_find(project, meta->ids[commit_idx]);
+	if (found == COMMIT_NONE || found > commit_idx) {
+		is_bad = 1;
+	}
+	
+	if (is_bad) {
+		fsck_report(list, FSCK_BAD_LINK, commit_idx, NULL);
+		// The actions can not be trusted to be in the arena.
+		return -1;
+	}
+	return 0;
+}
+
+// Every branch must lead to one staging area with the branch's name.
+static void fsck_branches(project_t *project, fsck_list_t *list) {
+	for (size_t branch_idx = 0; branch_idx < project->n_total_branch; branch_idx++) {
+		char *branch_name = project->branch_table[branch_idx].branch_name;
+		commit_node_t *node = project->branch_table[branch_idx].branch_address;
+		for (size_t other_idx = 0; other_idx < branch_idx; other_idx++) {
+			if (strcmp(project->branch_table[other_idx].branch_name, branch_name) == 0) {
+				node = NULL;
+			}
+		}
+		
+		// A branch can not be longer than the history.
+		size_t n_steps = 0;
+		while (node != NULL && node->commit_seq != COMMIT_NONE && n_steps <= project->n_total_commit) {
+			node = (node->n_next_commit == 0) ? NULL : node->next[0];
+			n_steps++;
+		}
+		if (node == NULL || node->commit_seq != COMMIT_NONE || strcmp(node->branch_name, branch_name) != 0) {
+			fsck_report(list, FSCK_BAD_BRANCH, COMMIT_NONE, branch_name);
+		}
+	}
+	if (project->current_node->commit_seq != COMMIT_NONE) {
+		fsck_report(list, FSCK_BAD_BRANCH, COMMIT_NONE, project->current_node->branch_name);
+	}
+}
+
+static int compare_fsck_found(const void *pa, const void *pb) {
+	const fsck_found_t *p1 = (const fsck_found_t *)pa;
+	const fsck_found_t *p2 = (const fsck_found_t *)pb;
+	// Branch problems first, then by commit.
+	uint32_t idx1 = p1->commit_idx + 1;
+	uint32_t idx2 = p2->commit_idx + 1;
+	if (idx1 != idx2) {
+		return (idx1 < idx2) ? -1 : 1;
+	}
+	if (p1->kind != p2->kind) {
+		return (p1->kind < p2->kind) ? -1 : 1;
+	}
+	if (p1->name == NULL || p2->name == NULL) {
+		return (p1->name == NULL) - (p2->name == NULL);
+	}
+	return strcmp(p1->name, p2->name);
+}
+
+// Verify the stored history. checks selects what is verified:
+// FSCK_GRAPH: the commit metadata, the commit id index, the branch table and the node links
+// agree, and the actions of every commit agree with its files.
+// FSCK_IDS: every commit id is the one computed from the commit's message and actions.
+// FSCK_CONTENT: the hash and fingerprint of every stored file match its content.
+// The commits and files are verified on as many threads as there are cores.
+// On return, out holds the problems sorted by commit, branch problems first. The file and
+// branch names are copied with the problems, so a single free() releases them.
+// Return the number of problems. If out or n_out is NULL or checks has unknown bits, return -1.
+int svc_fsck(void *helper, int checks, svc_fsck_problem_t **out, int *n_out) {
+	TRACE_SCOPE("svc_fsck", NULL, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_wait(project);
+	if (out == NULL || n_out == NULL || (checks & ~FSCK_ALL) != 0) {
+		return -1;
+	}
+	
+	fsck_pool_t pool;
+	pool.project = project;
+	pool.checks = checks;
+	pool.list.found = NULL;
+	pool.list.n_found = 0;
+	pool.list.found_cap = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+	
+	// Commits whose links are broken are not looked at any further.
+	unsigned char *is_usable = (unsigned char *)malloc(project->n_total_commit + 1);
+	fsck_list_t links = {NULL, 0, 0};
+	for (uint32_t commit_idx = 0; commit_idx < project->n_total_commit; commit_idx++) {
+		is_usable[commit_idx] = (fsck_commit_links(project, commit_idx, &links) == 0);
+	}
+	if (checks & FSCK_GRAPH) {
+		pool.list = links;
+		fsck_branches(project, &pool.list);
+	}else {
+		free(links.found);
+	}
+	
+	// Big commits are split, so a few of them do not keep one thread busy.
+	size_t jobs_cap = project->n_total_commit + 1;
+	pool.jobs = (fsck_job_t *)malloc(sizeof(fsck_job_t) * jobs_cap);
+	pool.n_jobs = 0;
+	for (uint32_t commit_idx = 0; commit_idx < project->n_total_commit; commit_idx++) {
+		if (is_usable[commit_idx] == 0) {
+			continue;
+		}
+		int n_files = project->commits.nodes[commit_idx]->n_tracked_files;
+		int first_file = 0;
+		do {
+			if (pool.n_jobs == jobs_cap) {
+				jobs_cap *= 2;
+				pool.jobs = (fsck_job_t *)realloc(pool.jobs, sizeof(fsck_job_t) * jobs_cap);
+			}
+			pool.jobs[pool.n_jobs].commit_idx = commit_idx;
+			pool.jobs[pool.n_jobs].first_file = first_file;
+			pool.jobs[pool.n_jobs].n_files = (n_files - first_file < FSCK_JOB_FILES) ? n_files - first_file : FSCK_JOB_FILES;
+			pool.n_jobs++;
+			first_file += FSCK_JOB_FILES;
+		} while (first_file < n_files);
+	}
+	free(is_usable);
+	atomic_init(&pool.next_job, 0);
+	
+	long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_threads > (long)pool.n_jobs) {
+		n_threads = pool.n_jobs;
+	}
+	if (n_threads > 64) {
+		n_threads = 64;
+	}
+	pthread_t threads[64];
+	int n_started = 0;
+	for (int thread_idx = 1; thread_idx < n_threads; thread_idx++) {
+		if (pthread_create(&threads[n_started], NULL, fsck_worker, &pool) == 0) {
+			n_started++;
+		}
+	}
+	fsck_worker(&pool);
+	for (int thread_idx = 0; thread_idx < n_started; thread_idx++) {
+		pthread_join(threads[thread_idx], NULL);
+	}
+	pthread_mutex_destroy(&pool.lock);
+	free(pool.jobs);
+	
+	fsck_list_t *list = &pool.list;
+	qsort(list->found, list->n_found, sizeof(fsck_found_t), compare_fsck_found);
+	size_t names_len = 0;
+	for (size_t found_idx = 0; found_idx < list->n_found; found_idx++) {
+		if (list->found[found_idx].name != NULL) {
+			names_len += strlen(list->found[found_idx].name) + 1;
+		}
+	}
+	*out = (svc_fsck_problem_t *)malloc(sizeof(svc_fsck_problem_t) * list->n_found + names_len + 1);
+	char *names = (char *)(*out + list->n_found);
+	for (size_t found_idx = 0; found_idx < list->n_found; found_idx++) {
+		fsck_found_t *found = &list->found[found_idx];
+		svc_fsck_problem_t *problem = &(*out)[found_idx];
+		problem->kind = found->kind;
+		problem->commit_id[0] = '\0';
+		if (found->commit_idx != COMMIT_NONE) {
+			commit_id_to_hex(project->commits.ids[found->commit_idx], problem->commit_id);
+		}
+		problem->name = NULL;
+		if (found->name != NULL) {
+			problem->name = names;
+			strcpy(names, found->name);
+			names += strlen(found->name) + 1;
+		}
+	}
+	free(list->found);
+	*n_out = list->n_found;
+	
+	return *n_out;
+}
+
+// Check if the given branch name is valid.
+static int check_valid_barnch_name(char *branch_name) {
+	if (branch_name == NULL) {
+		return 0;
+	}
+	
+	int branch_name_len = strlen(branch_name);
+	int is_valid = 0;
+	
+	for (int idx = 0; idx < branch_name_len; idx++) {
+		if ((branch_name[idx] >= 'a' && branch_name[idx] <= 'z') || 
+		   (branch_name[idx] >= 'A' && branch_name[idx] <= 'Z') || 
+		   (branch_name[idx] >= '0' && branch_name[idx] <= '9') ||
+		   (branch_name[idx] == '_') ||
+		   (branch_name[idx] == '/') ||
+		   (branch_name[idx] == '-') 
+	  	){
+			is_valid = 1;
+		}else {
+			is_valid = 0;
+			break;
+		}
+	}
+	
+	return is_valid;
+}
+
+// Fill up the branch table that keeps track of the address of the root node for each branches.
+static void add_branch_table(void *helper) {
+	project_t *project = (project_t*)helper;
+	commit_node_t *node = project->current_node->prev;
+
+	project->branch_table = grow_table(project, project->branch_table, project->n_total_branch, &project->branch_table_cap, sizeof(branch_table_t));
+	project->branch_table[project->n_total_branch].branch_name = node->next[node->n_next_commit - 1]->branch_name;
+	project->branch_table[project->n_total_branch].branch_address = node->next[node->n_next_commit - 1];
+	project->n_total_branch++;
+	
+	publish_snapshot(project);
+}
+
+// Check if the given branch name is already existing.
+static int check_exist_branch(void *helper, char *branch_name) {
+	project_t *project = (project_t*)helper;
+	int is_exist = 1;
+	
+	for (int branch_idx = 0; branch_idx < project->n_total_branch; branch_idx++) {
+		is_exist = strcmp(project->branch_table[branch_idx].branch_name, branch_name);
+		if (is_exist == 0) {
+			break;
+		}
+	}
+	
+	return is_exist;
+}
+
+int svc_branch(void *helper, char *branch_name) {
+	TRACE_SCOPE("svc_branch", branch_name, TRACE_NONE, TRACE_NONE);
+	commit_queue_wait((project_t*)helper);
+	// If the given branch name is NULL, return -1.
+	if (branch_name == NULL) {
+		return -1;
+	}
+	
+	// If the given branch name is invalid, return -1.
+	int is_valid_branch_name = check_valid_barnch_name(branch_name);
+	if (is_valid_branch_name == 0) {
+		return -1;
+	}
+	
+	// If the branch name already exists, return -2.
+	int is_exist = check_exist_branch(helper, branch_name);
+	if (is_exist == 0) {
+		return -2;
+	}
+	
+	// If there are uncommitted changes, return -3.
+	int is_changed = check_change(helper);
+	if (is_changed == 1) {
+		return -3;
+	}
+	
+	project_t *project = (project_t*)helper;
+	commit_node_t *node = project->current_node->prev;
+	
+	node->n_next_commit++;
+	if (node->n_next_commit == 1) {
+		node->next = (commit_node_t **)malloc(sizeof(commit_node_t *) * node->n_next_commit);
+	}else {
+		node->next = (commit_node_t **)realloc(node->next, sizeof(commit_node_t *) * node->n_next_commit);
+	}
+	
+	node->next[node->n_next_commit - 1] = branch_node_copy(project, node, branch_name); // get_node_copy returns copy with 'malloc' performed
+	add_branch_table(helper);
+	journal_log_args(project, JOURNAL_OP_BRANCH, 1, &branch_name);
+	
+    return 0;
+}
+
+int svc_checkout(void *helper, char *branch_name) {
+	TRACE_SCOPE("svc_checkout", branch_name, TRACE_NONE, TRACE_NONE);
+	commit_queue_wait((project_t*)helper);
+	// If branch_name is NULL, return -1.
+	if (branch_name == NULL) {
+		return -1;
+	}
+	
+	// If no such branch exists, return -1.
+	int check_exist = check_exist_branch(helper, branch_name);
+	if (check_exist != 0) {
+		return -1;
+	}
+	
+	// If there are uncommitted changes, return -2.
+	int is_changed = check_change(helper);
+	if (is_changed == 1) {
+		return -2;
+	}
+	
+	project_t *project = (project_t*)helper;
+	commit_node_t *current_node = project->current_node;
+	int is_exist = 0;
+	
+	// Find the branch's root node from the branch table.
+	for (int branch_idx = 0; branch_idx < project->n_total_branch; branch_idx++) {
+		is_exist = strcmp(project->branch_table[branch_idx].branch_name, branch_name);
+		if (is_exist == 0) {
+			current_node = project->branch_table[branch_idx].branch_address;
+		}
+	}
+	
+	// Set current node to the staging area of the branch.
+	while (current_node->commit_seq != COMMIT_NONE) {
+		if (current_node->next[0] != NULL) {
+			current_node = current_node->next[0];
+		}
+	}
+	
+	// Make it the active branch.
+	project->current_node = current_node;
+	// The hashes of the other branch's staging area may be stale, re-scan on the next check.
+	project->watch_overflow = 1;
+	journal_log_args(project, JOURNAL_OP_CHECKOUT, 1, &branch_name);
+	
+    return 0;
+}
+
+// Names of the branches in the published snapshot, printed one per line if print is 1.
+static char **snapshot_branch_names(project_t *project, int *n_branches, int print) {
+	int slot_idx = epoch_enter(project);
+	project_snapshot_t *snapshot = atomic_load(&project->snapshot);
+	size_t total_branch = snapshot->n_total_branch;
+	
+	int malloc_size = (sizeof(char*) * total_branch);
+	char **branch_names = malloc(malloc_size);
+	
+	for (int branch_idx = 0; branch_idx < total_branch; branch_idx++) {
+		char * branch_name = snapshot->branch_table[branch_idx].branch_name;
+		if (print == 1) {
+			printf("%s\n", branch_name);
+		}
+		branch_names[branch_idx] = branch_name;
+	}
+	epoch_exit(project, slot_idx);
+	*n_branches = total_branch;
+	
+	return branch_names;
+}
+
+char **list_branches(void *helper, int *n_branches) {
+	TRACE_SCOPE("list_branches", NULL, TRACE_NONE, TRACE_NONE);
+	// If n_branches is NULL, return NULL
+	if (n_branches ==NULL) {
+		return NULL;
+	}
+	
+	return snapshot_branch_names((project_t*)helper, n_branches, 1);
+}
+
+// Same as list_branches(), but nothing is printed.
+char **svc_list_branches(void *helper, int *n_branches) {
+	TRACE_SCOPE("svc_list_branches", NULL, TRACE_NONE, TRACE_NONE);
+	if (n_branches == NULL) {
+		return NULL;
+	}
+	
+	return snapshot_branch_names((project_t*)helper, n_branches, 0);
+}
+
+int svc_add(void *helper, char *file_name) {
+	TRACE_SCOPE("svc_add", file_name, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_lock(project);
+	int hash = stage_add(project, file_name);
+	commit_queue_unlock(project);
+	return hash;
+}
+
+// svc_add() without the write lock.
+static int stage_add(void *helper, char *file_name) {
+	// If file_name is NULL, return -1 and do not add it to version control.
+	if (file_name == NULL) {
+		return -1;
+	}
+	
+	project_t *project = (project_t*)helper;
+	commit_node_t *node = project->current_node;
+
+	// If a file with this name is already being tracked in the current branch, return -2.
+	staging_sync(project);
+	if (file_index_find(project->staging_index, project->staging_index_cap, node->tracked_files, file_name) != NULL) {
+		return -2;
+	}
+	
+	// If this file does not exist, return -3. The hash is computed from the bytes read here.
+	struct stat st;
+	size_t content_len;
+	unsigned char *content = fs_read_file(&project->fs, file_name, &st, &content_len);
+	if (content == NULL) {
+		return -3;
+	}
+	
+	node->n_tracked_files++;
+	if (node->n_tracked_files == 1) {
+		node->tracked_files = (tracked_file_t*)malloc(sizeof(tracked_file_t) * node->n_tracked_files);
+	}else {
+		node->tracked_files = (tracked_file_t*)realloc(node->tracked_files, sizeof(tracked_file_t) * node->n_tracked_files);
+	}
+	tracked_file_t *tracked_files = &node->tracked_files[node->n_tracked_files - 1];
+	tracked_files->file_name = malloc(sizeof(char) * FILE_NAME_LEN);
+	strcpy(tracked_files->file_name, file_name);
+	tracked_files->content = content;
+	tracked_files->content_len = content_len;
+	tracked_files->content_state = CONTENT_HEAP;
+	tracked_files->spill_offset = -1;
+	tracked_files->lru_prev = NULL;
+	tracked_files->lru_next = NULL;
+	tracked_files->pins = 0;
+	tracked_files->base = NULL;
+	unsigned int hash = content_hash(file_name, content, content_len, &tracked_files->fingerprint);
+	tracked_files->hash = hash;
+	hash_cache_store(project, file_name, &st, hash, tracked_files->fingerprint);
+	staging_sync_appended(project);
+	watch_add_dir(project, file_name);
+	journal_log_args(project, JOURNAL_OP_ADD, 1, &file_name);
+	
+	return hash;
+}
+
+// A regular file found by the tree walker, with its content and hash.
+typedef struct walk_file{
+	char *file_name;
+	unsigned char *content;
+	size_t content_len;
+	struct stat st;
+	unsigned int hash;
+	uint64_t fingerprint;
+	// The hash, or the svc_add_tree() error code.
+	int status;
+}walk_file_t;
+
+// Shared state of the tree walker threads. Directories to read are kept on a stack.
+typedef struct walk_pool{
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	char **dirs;
+	size_t n_dirs;
+	size_t dirs_cap;
+	// Threads that are reading a directory and may still push more.
+	int n_busy;
+	walk_file_t *files;
+	size_t n_files;
+	size_t files_cap;
+	char **filter;
+	const svc_fs_t *fs;
+}walk_pool_t;
+
+// What one walker thread found in the directory it reads.
+typedef struct walk_listing{
+	walk_pool_t *pool;
+	const char *prefix;
+	size_t prefix_len;
+	walk_file_t *files;
+	size_t n_files;
+	size_t files_cap;
+	char **dirs;
+	size_t n_dirs;
+}walk_listing_t;
+
+// Check if the path matches one of the filter patterns. Patterns with a slash are matched
+// against the whole path, the others against the last component.
+static int walk_filtered(char **filter, const char *path, const char *name) {
+	for (int filter_idx = 0; filter != NULL && filter[filter_idx] != NULL; filter_idx++) {
+		if (strchr(filter[filter_idx], '/') != NULL) {
+			if (fnmatch(filter[filter_idx], path, FNM_PATHNAME) == 0) {
+				return 1;
+			}
+		}else if (fnmatch(filter[filter_idx], name, 0) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Read and hash a file the way hash_file() does. The content is kept for staging.
+static void walk_read_file(const svc_fs_t *fs, walk_file_t *file) {
+	file->status = -3;
+	if (strlen(file->file_name) >= FILE_NAME_LEN) {
+		file->status = -4;
+		return;
+	}
+	
+	file->content = fs_read_file(fs, file->file_name, &file->st, &file->content_len);
+	if (file->content == NULL) {
+		return;
+	}
+	
+	// Calculate hash value of the file_path, then of the content.
+	unsigned int hash = 0;
+	for (const char *ptr = file->file_name; *ptr != '\0'; ptr++) {
+		hash += *ptr;
+		hash = (hash % 1000);
+	}
+	file->fingerprint = fingerprint_content(file->content, file->content_len, &hash);
+	file->hash = hash;
+	file->status = hash;
+}
+
+// Take one directory entry: keep a subdirectory for the walker and read a file.
+static void walk_entry(void *arg, const char *name, svc_fs_type_t type) {
+	walk_listing_t *listing = (walk_listing_t *)arg;
+	// Symbolic links and special files are not followed.
+	if (type != SVC_FS_DIR && type != SVC_FS_FILE) {
+		return;
+	}
+	
+	size_t name_len = strlen(name);
+	char *path = (char *)malloc(listing->prefix_len + 1 + name_len + 1);
+	if (listing->prefix_len > 0) {
+		memcpy(path, listing->prefix, listing->prefix_len);
+		path[listing->prefix_len] = '/';
+		memcpy(path + listing->prefix_len + 1, name, name_len + 1);
+	}else {
+		memcpy(path, name, name_len + 1);
+	}
+	if (walk_filtered(listing->pool->filter, path, name)) {
+		free(path);
+		return;
+	}
+	
+	if (type == SVC_FS_DIR) {
+		listing->dirs = (char **)realloc(listing->dirs, sizeof(char *) * (listing->n_dirs + 1));
+		listing->dirs[listing->n_dirs++] = path;
+		return;
+	}
+	if (listing->n_files == listing->files_cap) {
+		listing->files_cap = (listing->files_cap == 0) ? 64 : listing->files_cap * 2;
+		listing->files = (walk_file_t *)realloc(listing->files, sizeof(walk_file_t) * listing->files_cap);
+	}
+	walk_file_t *file = &listing->files[listing->n_files++];
+	memset(file, 0, sizeof(walk_file_t));
+	file->file_name = path;
+	walk_read_file(listing->pool->fs, file);
+}
+
+// Read one directory: push its subdirectories for the walker and read its files.
+static void walk_dir(walk_pool_t *pool, char *dir_name) {
+	walk_listing_t listing;
+	memset(&listing, 0, sizeof(listing));
+	listing.pool = pool;
+	// Paths in the working directory are used without a "./" prefix, like svc_add() gets them.
+	listing.prefix = (strcmp(dir_name, ".") == 0) ? "" : dir_name;
+	listing.prefix_len = strlen(listing.prefix);
+	// A directory that can not be read adds nothing.
+	pool->fs->list(pool->fs->ctx, dir_name, walk_entry, &listing);
+	walk_file_t *files = listing.files;
+	size_t n_files = listing.n_files;
+	char **dirs = listing.dirs;
+	size_t n_dirs = listing.n_dirs;
+	
+	pthread_mutex_lock(&pool->lock);
+	if (pool->n_dirs + n_dirs > pool->dirs_cap) {
+		while (pool->n_dirs + n_dirs > pool->dirs_cap) {
+			pool->dirs_cap = (pool->dirs_cap == 0) ? 64 : pool->dirs_cap * 2;
+		}
+		pool->dirs = (char **)realloc(pool->dirs, sizeof(char *) * pool->dirs_cap);
+	}
+	if (n_dirs > 0) {
+		memcpy(pool->dirs + pool->n_dirs, dirs, sizeof(char *) * n_dirs);
+		pool->n_dirs += n_dirs;
+	}
+	if (pool->n_files + n_files > pool->files_cap) {
+		while (pool->n_files + n_files > pool->files_cap) {
+			pool->files_cap = (pool->files_cap == 0) ? 256 : pool->files_cap * 2;
+		}
+		pool->files = (walk_file_t *)realloc(pool->files, sizeof(walk_file_t) * pool->files_cap);
+	}
+	if (n_files > 0) {
+		memcpy(pool->files + pool->n_files, files, sizeof(walk_file_t) * n_files);
+		pool->n_files += n_files;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	free(dirs);
+	free(files);
+}
+
+static void *walk_worker(void *arg) {
+	walk_pool_t *pool = (walk_pool_t *)arg;
+	
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		// The walk is over when no directory is left and nobody can push another one.
+		while (pool->n_dirs == 0 && pool->n_busy > 0) {
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+		if (pool->n_dirs == 0) {
+			pthread_cond_broadcast(&pool->wake);
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		
+		char *dir_name = pool->dirs[--pool->n_dirs];
+		pool->n_busy++;
+		pthread_mutex_unlock(&pool->lock);
+		
+		walk_dir(pool, dir_name);
+		free(dir_name);
+		
+		pthread_mutex_lock(&pool->lock);
+		pool->n_busy--;
+		pthread_cond_broadcast(&pool->wake);
+	}
+}
+
+static int compare_walk_file(const void *pa, const void *pb) {
+	return strcmp(((const walk_file_t *)pa)->file_name, ((const walk_file_t *)pb)->file_name);
+}
+
+// Add every regular file under the directory to the staging area, like svc_add() per file.
+// Directories are read in parallel. Files and directories matching a pattern of filter
+// (NULL terminated, fnmatch() patterns, may be NULL) are skipped, symbolic links are not followed.
+// Return the result of each file found, in file name order: its hash, -2 if it was already
+// tracked, -3 if it could not be read, or -4 if its path is too long. The results and their
+// file names are one allocation, free() it once. The number of results is stored in n_results.
+// If dir or n_results is NULL, or dir is not a directory, return NULL.
+svc_add_result_t *svc_add_tree(void *helper, char *dir, char **filter, int *n_results) {
+	TRACE_SCOPE("svc_add_tree", dir, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_lock(project);
+	svc_add_result_t *results = stage_add_tree(project, dir, filter, n_results);
+	commit_queue_unlock(project);
+	return results;
+}
+
+// svc_add_tree() without the write lock.
+static svc_add_result_t *stage_add_tree(void *helper, char *dir, char **filter, int *n_results) {
+	if (n_results == NULL) {
+		return NULL;
+	}
+	*n_results = 0;
+	project_t *project = (project_t*)helper;
+	struct stat dir_st;
+	if (dir == NULL || project->fs.stat(project->fs.ctx, dir, &dir_st) != 0 || !S_ISDIR(dir_st.st_mode)) {
+		return NULL;
+	}
+	
+	commit_node_t *node = project->current_node;
+	walk_pool_t pool;
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.wake, NULL);
+	pool.filter = filter;
+	pool.fs = &project->fs;
+	pool.dirs_cap = 64;
+	pool.dirs = (char **)malloc(sizeof(char *) * pool.dirs_cap);
+	// Trailing slashes would end up doubled in the paths.
+	pool.dirs[0] = strdup(dir);
+	for (size_t dir_len = strlen(pool.dirs[0]); dir_len > 1 && pool.dirs[0][dir_len - 1] == '/'; dir_len--) {
+		pool.dirs[0][dir_len - 1] = '\0';
+	}
+	pool.n_dirs = 1;
+	
+	// Reading files mostly waits for the disk, so use twice as many threads as there are cores.
+	long n_threads = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+	if (n_threads > 64) {
+		n_threads = 64;
+	}
+	pthread_t threads[64];
+	int n_started = 0;
+	for (int thread_idx = 1; thread_idx < n_threads; thread_idx++) {
+		if (pthread_create(&threads[n_started], NULL, walk_worker, &pool) == 0) {
+			n_started++;
+		}
+	}
+	walk_worker(&pool);
+	for (int thread_idx = 0; thread_idx < n_started; thread_idx++) {
+		pthread_join(threads[thread_idx], NULL);
+	}
+	pthread_mutex_destroy(&pool.lock);
+	pthread_cond_destroy(&pool.wake);
+	free(pool.dirs);
+	qsort(pool.files, pool.n_files, sizeof(walk_file_t), compare_walk_file);
+	
+	// Names already tracked, in an open addressing set at most half full.
+	size_t set_cap = 64;
+	while (set_cap < (node->n_tracked_files + pool.n_files) * 2) {
+		set_cap *= 2;
+	}
+	char **tracked_set = (char **)calloc(set_cap, sizeof(char *));
+	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+		size_t slot_idx = path_hash(node->tracked_files[file_idx].file_name) & (set_cap - 1);
+		while (tracked_set[slot_idx] != NULL) {
+			slot_idx = (slot_idx + 1) & (set_cap - 1);
+		}
+		tracked_set[slot_idx] = node->tracked_files[file_idx].file_name;
+	}
+	
+	// Stage the new files with a single reallocation.
+	size_t names_len = 0;
+	for (size_t file_idx = 0; file_idx < pool.n_files; file_idx++) {
+		names_len += strlen(pool.files[file_idx].file_name) + 1;
+	}
+	if (pool.n_files > 0) {
+		node->tracked_files = (tracked_file_t *)realloc(node->tracked_files, sizeof(tracked_file_t) * (node->n_tracked_files + pool.n_files));
+	}
+	svc_add_result_t *results = (svc_add_result_t *)malloc(sizeof(svc_add_result_t) * pool.n_files + names_len + 1);
+	char *names = (char *)(results + pool.n_files);
+	
+	for (size_t file_idx = 0; file_idx < pool.n_files; file_idx++) {
+		walk_file_t *file = &pool.files[file_idx];
+		if (file->status >= 0) {
+			size_t slot_idx = path_hash(file->file_name) & (set_cap - 1);
+			while (tracked_set[slot_idx] != NULL && strcmp(tracked_set[slot_idx], file->file_name) != 0) {
+				slot_idx = (slot_idx + 1) & (set_cap - 1);
+			}
+			if (tracked_set[slot_idx] != NULL) {
+				file->status = -2;
+			}else {
+				tracked_file_t *tracked_file = &node->tracked_files[node->n_tracked_files++];
+				tracked_file->file_name = malloc(sizeof(char) * FILE_NAME_LEN);
+				strcpy(tracked_file->file_name, file->file_name);
+				tracked_file->content = file->content;
+				tracked_file->content_len = file->content_len;
+				tracked_file->hash = file->hash;
+				tracked_file->fingerprint = file->fingerprint;
+				tracked_file->content_state = CONTENT_HEAP;
+				tracked_file->spill_offset = -1;
+				tracked_file->lru_prev = NULL;
+				tracked_file->lru_next = NULL;
+				tracked_file->pins = 0;
+				tracked_file->base = NULL;
+				file->content = NULL;
+				tracked_set[slot_idx] = tracked_file->file_name;
+				hash_cache_store(project, tracked_file->file_name, &file->st, file->hash, file->fingerprint);
+				watch_add_dir(project, tracked_file->file_name);
+				journal_log_args(project, JOURNAL_OP_ADD, 1, &tracked_file->file_name);
+			}
+		}
+		
+		results[file_idx].file_name = names;
+		results[file_idx].status = file->status;
+		strcpy(names, file->file_name);
+		names += strlen(file->file_name) + 1;
+		free(file->content);
+		free(file->file_name);
+	}
+	// tracked_set only pointed at names owned by the staging area.
+	free(tracked_set);
+	staging_invalidate(project);
+	free(pool.files);
+	*n_results = pool.n_files;
+	
+	return results;
+}
+
+int svc_rm(void *helper, char *file_name) {
+	TRACE_SCOPE("svc_rm", file_name, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_lock(project);
+	int hash = stage_rm(project, file_name);
+	commit_queue_unlock(project);
+	return hash;
+}
+
+// svc_rm() without the write lock.
+static int stage_rm(void *helper, char *file_name) {
+	// If file_name is NULL, return -1.
+	if (file_name == NULL) {
+		return -1;
+	}
+	
+	project_t *project = (project_t*)helper;
+	commit_node_t *node = project->current_node;
+		
+	// If the file with the given name is not being tracked in the current branch and SVC is not tracking any files, return -2.
+	if (node->n_tracked_files == 0 && node->tracked_files == NULL) {
+		return -2;
+	}
+
+	// If the file with the given name is not being tracked in the current branch, return -2. 
+	if (node->tracked_files != NULL) {
+		int is_exist = -1;
+		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+			is_exist = strcmp(node->tracked_files[file_idx].file_name, file_name);
+			if (is_exist == 0) {
+				break;
+			}
+		}
+		if (is_exist != 0) {
+			return -2;
+		}
+	}
+	
+	// Allocate memroy for temp array that holds copy of tracked files.
+	tracked_file_t *temp = (tracked_file_t*)malloc(sizeof(tracked_file_t) * node->n_tracked_files);
+	// Index of the file that will be removed.
+	int matched_file_index = -1;
+	// Keep the number of tracked files before removing the file.
+	int original_len = node->n_tracked_files;
+	unsigned int last_knwon_hash = 0;
+	
+	// Find index of the file that will be removed and keep its hash value.
+	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+		matched_file_index = strcmp(node->tracked_files[file_idx].file_name, file_name);
+		if (matched_file_index == 0) {
+			matched_file_index = file_idx;
+			last_knwon_hash = node->tracked_files[file_idx].hash;
+			// Free file name.
+			free(node->tracked_files[file_idx].file_name);
+			// Free file content.
+			free(node->tracked_files[file_idx].content);
+			break;
+		}
+	}
+	
+	// Copy tracked files into the temp array.
+	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+		memcpy(&temp[file_idx], &project->current_node->tracked_files[file_idx], sizeof(tracked_file_t));
+	}
+
+	// Reallocate a new tracked files array.
+	node->n_tracked_files--;
+	node->tracked_files = (tracked_file_t*)realloc(node->tracked_files, sizeof(tracked_file_t) * node->n_tracked_files);	
+	int file_idx = 0;
+	
+	// Copy temp array into the new tracked files array except the index of the file that will be removed.
+	if (node->n_tracked_files > 0) {
+		for (int temp_idx = 0; temp_idx < original_len; temp_idx++) {
+			if (temp_idx == matched_file_index) {
+				continue;
+			}
+			memcpy(&project->current_node->tracked_files[file_idx], &temp[temp_idx], sizeof(tracked_file_t));
+			file_idx++;
 		}
-		n_prev_node = 0;
 	}
+	free(temp);
+	staging_invalidate(project);
+	journal_log_args(project, JOURNAL_OP_RM, 1, &file_name);
+	
+    return last_knwon_hash;
 }
 
-void cleanup(void *helper) {
-	project_t *project = (project_t*)helper;
-	cleanup_branch(helper);
-	free(project->commit_table);
-	free(project->branch_table);
-	free(project);
-}
-
-int hash_file(void *helper, char *file_path) {
-	// If file_path is NULL, return -1.
-	if (file_path == NULL) {
+int svc_reset(void *helper, char *commit_id) {
+	TRACE_SCOPE("svc_reset", commit_id, TRACE_NONE, TRACE_NONE);
+	commit_queue_wait((project_t*)helper);
+	// If commit_id is NULL, return -1.
+	if (commit_id == NULL) {
 		return -1;
 	}
 	
-	FILE * fptr;
-    // Make sure that characters in the file always treated as unsigned value. (e.g. special characters)
-	unsigned char * file_content;
-	unsigned int file_path_len = strlen(file_path);
-	unsigned int file_content_len = 0;
-	unsigned int hash = 0;
-	
-	fptr = fopen(file_path, "r");
+	commit_node_t *commit = get_commit(helper, commit_id);
 	
-	// If no file exists at the given path, return -2
-	if (fptr == NULL) {
-    	return -2;
+	// If no commit with the given id exists, return -2. 
+	if (commit == NULL) {
+		return -2;
 	}
- 
-	// Find number of characters in the file.
-	fseek(fptr, 0, SEEK_END);
-	file_content_len = ftell(fptr);
-	fseek(fptr, 0, SEEK_SET);	
+
+	project_t *project = (project_t*)helper;
+	commit_node_t *staging = project->current_node;
 	
-	file_content = (unsigned char*)malloc(sizeof(unsigned char) * file_content_len + 1);	
-    
-	if (file_content == NULL) {
-    	return 1;
-	}
- 
-	fread(file_content, sizeof(unsigned char), file_content_len, fptr);
-	fclose(fptr);
+	// The staging area continues from the commit with the commit's files. The commit itself is
+	// not reused as staging area, it keeps its id and metadata.
+	cleanup_files(staging->n_tracked_files, staging->tracked_files);
+	free(staging->tracked_files);
+	staging->tracked_files = tracked_files_copy(project, commit->n_tracked_files, commit->tracked_files);
+	staging->n_tracked_files = commit->n_tracked_files;
+	staging->prev = commit;
+	project->watch_overflow = 1;
+	journal_log_args(project, JOURNAL_OP_RESET, 1, &commit_id);
 	
-	// Calculate hash value of the file_path.
-	for (int i = 0; i < file_path_len; i++) {
-        hash += file_path[i];
-        hash = (hash % 1000);
+    return 0;
+}
+
+// Names and fingerprints of a tree of files, without contents. Replayed commits are checked
+// against it before anything is changed. Removed files stay in the tree, marked, so the path
+// index stays valid.
+typedef struct replay_file{
+	char *file_name;
+	uint64_t fingerprint;
+	int is_removed;
+}replay_file_t;
+
+typedef struct replay_tree{
+	replay_file_t *files;
+	size_t n_files;
+	size_t cap;
+	// Open addressing over the files by path, at most half full. Slots hold the file index plus one.
+	size_t *index;
+	size_t index_cap;
+}replay_tree_t;
 
+static void replay_tree_index(replay_tree_t *tree, size_t file_idx) {
+	size_t slot_idx = path_hash(tree->files[file_idx].file_name) & (tree->index_cap - 1);
+	while (tree->index[slot_idx] != 0) {
+		slot_idx = (slot_idx + 1) & (tree->index_cap - 1);
 	}
-	
-	// Calculate hash value of the file content.
-	for (int i = 0; i < file_content_len; i++) {
-		hash += file_content[i];
-        hash = (hash % 2000000000);
+	tree->index[slot_idx] = file_idx + 1;
+}
+
+// Put the last file of the tree into the index, rebuilding it if it would be more than half full.
+static void replay_tree_index_last(replay_tree_t *tree) {
+	if (tree->n_files * 2 <= tree->index_cap) {
+		replay_tree_index(tree, tree->n_files - 1);
+		return;
+	}
+	free(tree->index);
+	tree->index_cap = 64;
+	while (tree->index_cap < tree->n_files * 2) {
+		tree->index_cap *= 2;
+	}
+	tree->index = (size_t *)calloc(tree->index_cap, sizeof(size_t));
+	for (size_t file_idx = 0; file_idx < tree->n_files; file_idx++) {
+		replay_tree_index(tree, file_idx);
 	}
-	
-	free(file_content);
-	
-	return hash;
 }
 
-// Check if there is a change in tracked files.
-// Return 1 if there is a change (addition, deletion, modification).
-// Return 0 if there is no change .
-static int check_change(void *helper) {
-	project_t *project = (project_t*)helper;
-	commit_node_t *node = project->current_node;
-	commit_node_t *head = project->head;
-	
-	if (head != NULL) {
-		unsigned int total_hash_node = 0;
-		unsigned int total_hash_head = 0;
-		
-		// Find total hash value for the current node (stage area).
-		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
-			// Update hash value if there was a modification of the file.
-			node->tracked_files[file_idx].hash = hash_file(helper, node->tracked_files[file_idx].file_name);
-			total_hash_node += node->tracked_files[file_idx].hash;
-		}
-		// Find total hash value for the head.
-		for (int head_file_idx = 0; head_file_idx < head->n_tracked_files; head_file_idx++) {
-			total_hash_head += head->tracked_files[head_file_idx].hash;
-		}
-		// If two total hash values are equal, there was no change and return 0.
-		if (total_hash_node == total_hash_head) {
-			return 0;
+static void replay_tree_init(replay_tree_t *tree, commit_node_t *node) {
+	tree->n_files = 0;
+	tree->cap = node->n_tracked_files + 16;
+	tree->files = (replay_file_t *)malloc(sizeof(replay_file_t) * tree->cap);
+	tree->index = NULL;
+	tree->index_cap = 0;
+	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+		replay_file_t *file = &tree->files[tree->n_files++];
+		file->file_name = malloc(strlen(node->tracked_files[file_idx].file_name) + 1);
+		strcpy(file->file_name, node->tracked_files[file_idx].file_name);
+		file->fingerprint = node->tracked_files[file_idx].fingerprint;
+		file->is_removed = 0;
+		replay_tree_index_last(tree);
+	}
+}
+
+static void replay_tree_free(replay_tree_t *tree) {
+	for (size_t file_idx = 0; file_idx < tree->n_files; file_idx++) {
+		free(tree->files[file_idx].file_name);
+	}
+	free(tree->files);
+	free(tree->index);
+}
+
+// Find a file of the tree, also a removed one, or return NULL.
+static replay_file_t *replay_tree_find(replay_tree_t *tree, const char *file_name) {
+	if (tree->index_cap == 0) {
+		return NULL;
+	}
+	size_t slot_idx = path_hash(file_name) & (tree->index_cap - 1);
+	while (tree->index[slot_idx] != 0) {
+		replay_file_t *file = &tree->files[tree->index[slot_idx] - 1];
+		if (strcmp(file->file_name, file_name) == 0) {
+			return file;
 		}
+		slot_idx = (slot_idx + 1) & (tree->index_cap - 1);
 	}
-	// Otherwise, return 1
-	return 1;
+	return NULL;
 }
 
-// Check if the file is locally (or manually) removed from SVC. 
-static void check_local_deletion(void *helper) {
-	project_t *project = (project_t*)helper;
-	commit_node_t *node = project->current_node;
-	FILE * fptr;
-	
+// Index of a tracked file of a node, or -1.
+static int node_file_idx(commit_node_t *node, char *file_name) {
+	if (node == NULL) {
+		return -1;
+	}
 	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
-		fptr = fopen(node->tracked_files[file_idx].file_name, "r");	
-		// If the file does not exist at the given path, remove it from the SVC.
-		if (fptr == NULL) {
-			svc_rm(helper, node->tracked_files[file_idx].file_name);
+		if (strcmp(node->tracked_files[file_idx].file_name, file_name) == 0) {
+			return file_idx;
 		}
 	}
-	
-	if (fptr != NULL) {
-		fclose(fptr);
-	}
+	return -1;
 }
 
-// Determine if the change is addition, deletion or modification.
-static void determine_action(void *helper) {
-	project_t *project = (project_t*)helper;
-	commit_node_t *node = project->current_node;
-	commit_node_t *head = project->head;
+static tracked_file_t *node_find_file(commit_node_t *node, char *file_name) {
+	int file_idx = node_file_idx(node, file_name);
+	return (file_idx < 0) ? NULL : &node->tracked_files[file_idx];
+}
+
+// Apply the actions of a commit to the tree, like a three-way merge against the commit's parent:
+// every file the commit changed must still be as in the parent, or already as in the commit.
+// Return 0, or -1 if the tree changed a file the commit changes too.
+static int replay_check(project_t *project, replay_tree_t *tree, uint32_t commit_idx) {
+	commit_meta_t *meta = &project->commits;
+	commit_node_t *commit = meta->nodes[commit_idx];
+	commit_node_t *parent = (meta->parents[commit_idx] == COMMIT_NONE) ? NULL : meta->nodes[meta->parents[commit_idx]];
+	action_info_t *actions = &meta->actions[meta->action_starts[commit_idx]];
+	size_t *commit_index = NULL;
+	size_t commit_index_cap = 0;
+	size_t *parent_index = NULL;
+	size_t parent_index_cap = 0;
+	file_index_build(&commit_index, &commit_index_cap, commit->tracked_files, commit->n_tracked_files);
+	if (parent != NULL) {
+		file_index_build(&parent_index, &parent_index_cap, parent->tracked_files, parent->n_tracked_files);
+	}
 	
-	// If head is NULL, it means initial commit.
-	// Every tracked files will be determined as addition.
-	if (head == NULL) {
-		node->n_actions = node->n_tracked_files;
-		node->actions = (action_info_t*)malloc(sizeof(action_info_t) * node->n_actions);
-		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
-			node->actions[file_idx].file_name = node->tracked_files[file_idx].file_name;
-			node->actions[file_idx].action = ACTION_ADD;
-			node->actions[file_idx].hash = node->tracked_files[file_idx].hash;
-			node->actions[file_idx].old_hash = 0;
+	int result_code = 0;
+	for (uint32_t action_idx = 0; action_idx < meta->action_counts[commit_idx]; action_idx++) {
+		char *file_name = actions[action_idx].file_name;
+		tracked_file_t *base = (parent == NULL) ? NULL : file_index_find(parent_index, parent_index_cap, parent->tracked_files, file_name);
+		tracked_file_t *result = (actions[action_idx].action == ACTION_REMOVE) ? NULL : file_index_find(commit_index, commit_index_cap, commit->tracked_files, file_name);
+		replay_file_t *file = replay_tree_find(tree, file_name);
+		replay_file_t *removed = NULL;
+		if (file != NULL && file->is_removed) {
+			removed = file;
+			file = NULL;
 		}
-	}else {
-		int is_matched = -1;
-		// Check and determine if the file is added or modified in SVC.
-		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
-			for (int head_file_idx = 0; head_file_idx < head->n_tracked_files; head_file_idx++) {
-				is_matched = strcmp(node->tracked_files[file_idx].file_name, head->tracked_files[head_file_idx].file_name);
-				if (is_matched == 0) {
-					// Update hash value if there was a modification of the file
-					unsigned int new_hash = hash_file(project, node->tracked_files[file_idx].file_name);
-					// If equal, there was no modification.
-					if (new_hash == head->tracked_files[head_file_idx].hash) {
-						break;
-					}else {
-						node->n_actions++;
-				
-						if (node->n_actions == 1) {
-							node->actions = (action_info_t*)malloc(sizeof(action_info_t) * node->n_actions);
-						}else {
-							node->actions = (action_info_t*)realloc(node->actions, sizeof(action_info_t) * node->n_actions);
-						}
-						// Free the previous file content.
-						free(node->tracked_files[file_idx].content);
-						// Copy the new file content.
-						node->tracked_files[file_idx].content = file_content_copy(node->tracked_files[file_idx].file_name);
-						node->tracked_files[file_idx].hash = new_hash;
-						node->actions[node->n_actions - 1].file_name = node->tracked_files[file_idx].file_name;
-						node->actions[node->n_actions - 1].action = ACTION_MODIFY;
-						node->actions[node->n_actions - 1].hash = node->tracked_files[file_idx].hash;
-						node->actions[node->n_actions - 1].old_hash = head->tracked_files[file_idx].hash;
-						break;
-					}
-				}
-			}
-			if (is_matched != 0) {
-				node->n_actions++;
-				
-				if (node->n_actions == 1) {
-					node->actions = (action_info_t*)malloc(sizeof(action_info_t) * node->n_actions);
-				}else {
-					node->actions = (action_info_t*)realloc(node->actions, sizeof(action_info_t) * node->n_actions);
-				}
-				node->actions[node->n_actions - 1].file_name = node->tracked_files[file_idx].file_name;
-				node->actions[node->n_actions - 1].action = ACTION_ADD;
-				node->actions[node->n_actions - 1].hash = node->tracked_files[file_idx].hash;
-				node->actions[node->n_actions - 1].old_hash = 0;
-			}
+		
+		if (file == NULL && result == NULL) {
+			continue;
 		}
-		// Check and determine if the file is removed from SVC.
-		for (int head_file_idx = 0; head_file_idx < head->n_tracked_files; head_file_idx++) {
-			for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
-				is_matched = strcmp(node->tracked_files[file_idx].file_name, head->tracked_files[head_file_idx].file_name);
-				if (is_matched == 0) {
-					break;
-				}
-			}
-			if (is_matched != 0) {
-				node->n_actions++;
-				
-				if (node->n_actions == 1) {
-					node->actions = (action_info_t*)malloc(sizeof(action_info_t) * node->n_actions);
-				}else {
-					node->actions = (action_info_t*)realloc(node->actions, sizeof(action_info_t) * node->n_actions);
-				}
-				node->actions[node->n_actions - 1].file_name = head->tracked_files[head_file_idx].file_name;
-				node->actions[node->n_actions - 1].action = ACTION_REMOVE;
-				node->actions[node->n_actions - 1].hash = head->tracked_files[head_file_idx].hash;
-				node->actions[node->n_actions - 1].old_hash = 0;
+		if (file != NULL && result != NULL && file->fingerprint == result->fingerprint) {
+			continue;
+		}
+		if ((file == NULL) != (base == NULL) || (file != NULL && file->fingerprint != base->fingerprint)) {
+			result_code = -1;
+			break;
+		}
+		
+		if (result == NULL) {
+			file->is_removed = 1;
+		}else if (file != NULL) {
+			file->fingerprint = result->fingerprint;
+		}else if (removed != NULL) {
+			removed->is_removed = 0;
+			removed->fingerprint = result->fingerprint;
+		}else {
+			if (tree->n_files == tree->cap) {
+				tree->cap *= 2;
+				tree->files = (replay_file_t *)realloc(tree->files, sizeof(replay_file_t) * tree->cap);
 			}
-		}		
+			file = &tree->files[tree->n_files++];
+			file->file_name = malloc(strlen(file_name) + 1);
+			strcpy(file->file_name, file_name);
+			file->fingerprint = result->fingerprint;
+			file->is_removed = 0;
+			replay_tree_index_last(tree);
+		}
 	}
+	free(commit_index);
+	free(parent_index);
+	return result_code;
 }
 
-// Comparator function for qsort in order to sort file names by increasing alphabetical order.
-static int compare_str(const void *pa, const void * pb) {
-	const action_info_t *p1 = (action_info_t *) pa;
-	const action_info_t *p2 = (action_info_t *) pb;
-	unsigned int p1_ascii = tolower(p1->file_name[0]);
-	unsigned int p2_ascii = tolower(p2->file_name[0]);
+// Apply the actions of a commit, already checked with replay_check(), to the staging area.
+// Changed files share their contents with the commit.
+static void replay_apply(project_t *project, commit_node_t *node, uint32_t commit_idx) {
+	commit_meta_t *meta = &project->commits;
+	commit_node_t *commit = meta->nodes[commit_idx];
+	action_info_t *actions = &meta->actions[meta->action_starts[commit_idx]];
+	uint32_t n_actions = meta->action_counts[commit_idx];
+	size_t *commit_index = NULL;
+	size_t commit_index_cap = 0;
+	size_t *node_index = NULL;
+	size_t node_index_cap = 0;
+	file_index_build(&commit_index, &commit_index_cap, commit->tracked_files, commit->n_tracked_files);
+	file_index_build(&node_index, &node_index_cap, node->tracked_files, node->n_tracked_files);
 	
- 	if (p1_ascii < p2_ascii){
-		return -1;	
-	} 
-  	if (p1_ascii == p2_ascii){
-		return 0;
-	} 
-  	if (p1_ascii > p2_ascii){
-		return 1;
-	} 
+	// Added files go after the others. Removed ones are only marked here, so the index stays valid.
+	size_t n_files = node->n_tracked_files;
+	node->tracked_files = (tracked_file_t *)realloc(node->tracked_files, sizeof(tracked_file_t) * (n_files + n_actions + 1));
+	unsigned char *removed = (unsigned char *)calloc(n_files + 1, 1);
+	for (uint32_t action_idx = 0; action_idx < n_actions; action_idx++) {
+		char *file_name = actions[action_idx].file_name;
+		tracked_file_t *result = (actions[action_idx].action == ACTION_REMOVE) ? NULL : file_index_find(commit_index, commit_index_cap, commit->tracked_files, file_name);
+		tracked_file_t *file = file_index_find(node_index, node_index_cap, node->tracked_files, file_name);
+		
+		if (file != NULL) {
+			if (result != NULL && file->fingerprint == result->fingerprint) {
+				continue;
+			}
+			if (result == NULL) {
+				removed[file - node->tracked_files] = 1;
+				continue;
+			}
+			free(file->file_name);
+			content_release(file);
+			stored_file_share(file, result);
+		}else if (result != NULL) {
+			stored_file_share(&node->tracked_files[node->n_tracked_files], result);
+			node->n_tracked_files++;
+		}
+	}
 	
-	return 0;
+	// Keep the order, so the files stay at the same index as in the previous commit.
+	size_t n_kept = 0;
+	for (size_t file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+		if (file_idx < n_files && removed[file_idx]) {
+			cleanup_files(1, &node->tracked_files[file_idx]);
+		}else {
+			node->tracked_files[n_kept++] = node->tracked_files[file_idx];
+		}
+	}
+	node->n_tracked_files = n_kept;
+	free(removed);
+	free(commit_index);
+	free(node_index);
 }
 
-// Calculate commit id.
-static unsigned int get_commit_id(void *helper, char *message) {
-	project_t *project = (project_t*)helper;
-	commit_node_t *node = project->current_node;
+// Replay commits, oldest first, on top of the staging area without reading the working tree.
+// Each one is committed with its own message and an id of its own. A commit whose changes
+// are already there is dropped. Return the number of new commits.
+static int replay_commits(project_t *project, uint32_t *commits, size_t n_commits) {
+	int in_memory = project->in_memory;
+	int n_replayed = 0;
+	project->in_memory = 1;
 	
-	unsigned int commit_id = 0;
-	unsigned int message_len = strlen(message);
+	for (size_t commit_pos = 0; commit_pos < n_commits; commit_pos++) {
+		commit_node_t *node = project->current_node;
+		replay_apply(project, node, commits[commit_pos]);
 		
-	// Calculate commit_id from message.
-	for (int i = 0; i < message_len; i++) {
-        commit_id += message[i];
-        commit_id = (commit_id % 1000);
+		// The actions are relative to the commit the staging area continues from.
+		project->head = node->prev;
+		determine_action(project);
+		if (node->n_actions == 0) {
+			free(node->actions);
+			node->actions = NULL;
+			continue;
+		}
+		
+		// The message arena may move while the commit is added.
+		commit_meta_t *meta = &project->commits;
+		char *message = malloc(strlen(meta->messages + meta->message_offs[commits[commit_pos]]) + 1);
+		strcpy(message, meta->messages + meta->message_offs[commits[commit_pos]]);
+		commit_staging(project, message, NULL, 1);
+		free(message);
+		n_replayed++;
 	}
 	
-	// Sort file names by increasing alphabetical order.
-	qsort(node->actions, node->n_actions, sizeof(action_info_t), compare_str);
-	
-	// Calculate commit_id from action array.
-	for (int action_idx = 0; action_idx < node->n_actions; action_idx++) {
-		if(node->actions[action_idx].action == ACTION_ADD){
-			commit_id += 376591;
-		}
-		if (node->actions[action_idx].action == ACTION_REMOVE) {
-			commit_id += 85973;
-		}
-		if (node->actions[action_idx].action == ACTION_MODIFY) {
-			commit_id += 9573681;
-		}
-		unsigned int file_path_len = strlen(node->actions[action_idx].file_name);
-		for (int file_idx = 0; file_idx < file_path_len; file_idx++) {
-			commit_id *= (node->actions[action_idx].file_name[file_idx] % 37);
-			commit_id = (commit_id % 15485863) + 1;
+	project->in_memory = in_memory;
+	return n_replayed;
+}
+
+// Write a file's stored content to the working tree, creating its directories if needed.
+static void write_work_file(project_t *project, tracked_file_t *file) {
+	unsigned char *content = content_get(project, file);
+	fs_write_file(&project->fs, file->file_name, content, (content == NULL) ? 0 : file->content_len);
+}
+
+// Bring the working tree from the files in before to the files of the staging area.
+// Only files that differ are written or removed.
+static void replay_write_tree(project_t *project, replay_tree_t *before, commit_node_t *node) {
+	content_pin(project);
+	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+		tracked_file_t *file = &node->tracked_files[file_idx];
+		replay_file_t *old = replay_tree_find(before, file->file_name);
+		if (old == NULL || old->fingerprint != file->fingerprint) {
+			write_work_file(project, file);
 		}
 	}
+	content_unpin(project);
 	
-	return commit_id;
+	size_t *index = NULL;
+	size_t index_cap = 0;
+	file_index_build(&index, &index_cap, node->tracked_files, node->n_tracked_files);
+	for (size_t file_idx = 0; file_idx < before->n_files; file_idx++) {
+		char *file_name = before->files[file_idx].file_name;
+		if (file_index_find(index, index_cap, node->tracked_files, file_name) == NULL) {
+			project->fs.unlink(project->fs.ctx, file_name);
+		}
+	}
+	free(index);
 }
 
-// Fill up the commit table that keeps track of commit addresses.
-static void add_commit_table(void *helper) {
-	project_t *project = (project_t*)helper;
-	commit_node_t *node = project->current_node;
+// Apply the changes of a commit to the current branch as a new commit with the same message.
+// The files are taken from the stored commit, and only the result is written to the working tree.
+// Return the id of the new commit. Return NULL if commit_id is NULL or no such commit exists,
+// if there are uncommitted changes, if the branch changed the same files differently or if
+// the changes are already on the branch.
+char *svc_cherry_pick(void *helper, char *commit_id) {
+	TRACE_SCOPE("svc_cherry_pick", commit_id, TRACE_NONE, TRACE_NONE);
+	commit_queue_wait((project_t*)helper);
+	if (commit_id == NULL) {
+		return NULL;
+	}
 	
-	project->n_total_commit++;
-	if (project->n_total_commit == 1) {
-		project->commit_table = (commit_table_t *)malloc(sizeof(commit_table_t) * project->n_total_commit);
-	}else {
-		project->commit_table = (commit_table_t *)realloc(project->commit_table, sizeof(commit_table_t) * project->n_total_commit);
+	commit_node_t *commit = get_commit(helper, commit_id);
+	if (commit == NULL) {
+		return NULL;
 	}
 	
-	project->commit_table[project->n_total_commit - 1].commit_id = node->commit_id;
-	project->commit_table[project->n_total_commit - 1].commit_address = node;
-}
-
-char *svc_commit(void *helper, char *message) {
+	// Changes are relative to the commit the staging area continues from, which is not the last
+	// commit after a checkout or reset. The head is put back if nothing is committed.
 	project_t *project = (project_t*)helper;
-	commit_node_t *node = project->current_node;
-	commit_node_t *head = project->head;
+	commit_node_t *staging = project->current_node;
+	commit_node_t *old_head = project->head;
+	project->head = staging->prev;
+	int is_changed = check_change(helper);
+	if (is_changed == 1) {
+		project->head = old_head;
+		return NULL;
+	}
 	
-	// If message is NULL, return NULL
-	if (message == NULL) {
+	uint32_t commit_idx = project_commit_idx(project, commit);
+	replay_tree_t tree;
+	replay_tree_init(&tree, staging);
+	int is_conflict = replay_check(project, &tree, commit_idx);
+	replay_tree_free(&tree);
+	if (is_conflict != 0) {
+		project->head = old_head;
 		return NULL;
 	}
-			
-	// Return NULL if commit is empty (when SVC is not tracking any files).
-	if (head == NULL) {
-		if(node->n_tracked_files == 0){
-			return NULL;
+	
+	replay_tree_t before;
+	replay_tree_init(&before, staging);
+	int write_tree = (project->in_memory == 0);
+	if (replay_commits(project, &commit_idx, 1) == 0) {
+		replay_tree_free(&before);
+		project->head = old_head;
+		return NULL;
+	}
+	if (write_tree) {
+		replay_write_tree(project, &before, project->current_node);
+	}
+	replay_tree_free(&before);
+	journal_log_args(project, JOURNAL_OP_CHERRY_PICK, 1, &commit_id);
+	
+	return commit_hex(&project->commits, project_commit_idx(project, project->head));
+}
+
+// Detach a staging area from the node whose next commits hold it.
+static void unlink_staging(project_t *project, commit_node_t *staging) {
+	for (size_t commit_idx = 0; commit_idx < project->n_total_commit; commit_idx++) {
+		commit_node_t *node = project->commits.nodes[commit_idx];
+		for (int next_idx = 0; next_idx < node->n_next_commit; next_idx++) {
+			if (node->next[next_idx] != staging) {
+				continue;
+			}
+			memmove(&node->next[next_idx], &node->next[next_idx + 1], sizeof(commit_node_t *) * (node->n_next_commit - next_idx - 1));
+			node->n_next_commit--;
+			if (node->n_next_commit == 0) {
+				free(node->next);
+				node->next = NULL;
+			}
+			return;
 		}
 	}
+}
+
+// Move the commits of the current branch that onto_branch does not have on top of the last
+// commit of onto_branch. They are replayed in memory from their stored files, each one gets a
+// new id, and the working tree is written once with the result. Commits whose
+// changes onto_branch already has are dropped. The old commits keep their ids.
+// Return the number of replayed commits. If onto_branch is NULL, does not exist or is the
+// current branch, return -1. If there are uncommitted changes, return -2. If a commit changes
+// a file that onto_branch changed differently, return -3 and leave the branch as it was.
+int svc_rebase(void *helper, char *onto_branch) {
+	TRACE_SCOPE("svc_rebase", onto_branch, TRACE_NONE, TRACE_NONE);
+	commit_queue_wait((project_t*)helper);
+	if (onto_branch == NULL) {
+		return -1;
+	}
+	
+	int check_exist = check_exist_branch(helper, onto_branch);
+	if (check_exist != 0) {
+		return -1;
+	}
+	
+	project_t *project = (project_t*)helper;
+	commit_node_t *staging = project->current_node;
+	if (strcmp(staging->branch_name, onto_branch) == 0) {
+		return -1;
+	}
+	
+	// See svc_cherry_pick().
+	commit_node_t *old_head = project->head;
+	project->head = staging->prev;
+	int is_changed = check_change(helper);
+	if (is_changed == 1) {
+		project->head = old_head;
+		return -2;
+	}
 	
-	// Return NULL if there was no change in tracked files
-	int is_changed = check_change(helper);
-	if (head != NULL) {
-		if (is_changed == 0) {
-			return NULL;
-		}
+	// Last commit of onto_branch.
+	commit_node_t *onto = project->branch_table[branch_index(project, onto_branch)].branch_address;
+	while (onto->commit_seq != COMMIT_NONE) {
+		onto = onto->next[0];
+	}
+	onto = onto->prev;
+	if (onto == NULL) {
+		project->head = old_head;
+		return -1;
 	}
 	
-	// Check if file was locally(or manually) deleted.
-	check_local_deletion(helper);
+	// Commits of the current branch back to the first one onto_branch has, newest first.
+	commit_meta_t *meta = &project->commits;
+	unsigned char *on_onto = (unsigned char *)calloc(project->n_total_commit, sizeof(unsigned char));
+	uint32_t onto_idx = project_commit_idx(project, onto);
+	for (uint32_t commit_idx = onto_idx; commit_idx != COMMIT_NONE; commit_idx = meta->parents[commit_idx]) {
+		on_onto[commit_idx] = 1;
+	}
+	uint32_t *commits = NULL;
+	size_t n_commits = 0;
+	size_t commits_cap = 0;
+	uint32_t commit_idx = (staging->prev == NULL) ? COMMIT_NONE : project_commit_idx(project, staging->prev);
+	while (commit_idx != COMMIT_NONE && on_onto[commit_idx] == 0) {
+		if (n_commits == commits_cap) {
+			commits_cap = (commits_cap == 0) ? 64 : commits_cap * 2;
+			commits = (uint32_t *)realloc(commits, sizeof(uint32_t) * commits_cap);
+		}
+		commits[n_commits++] = commit_idx;
+		commit_idx = meta->parents[commit_idx];
+	}
+	free(on_onto);
 	
-	// Determine if the change is addition, deletion or modification.
-	determine_action(helper);
-		
-	// Calculate commit_id.
-	unsigned int commit_id = get_commit_id(helper, message);
-	unsigned int message_len = strlen(message) + 1;
-			
-	// Convert commit_id to hexadecimal.
-	char commit_id_hex[COMMIT_ID_LEN];
-	sprintf(commit_id_hex, "%06x", commit_id);	
+	// Already on top of onto_branch.
+	if (commit_idx == onto_idx) {
+		free(commits);
+		project->head = old_head;
+		return 0;
+	}
 	
-	// Commit current stage - set message and commit id to the node.
-	node->message = (char *)malloc(sizeof(char) * message_len);
-	strcpy(node->message, message);
-	node->commit_id = (char *)malloc(sizeof(char) * COMMIT_ID_LEN);
-	strcpy(node->commit_id, commit_id_hex);
+	for (size_t commit_pos = 0; commit_pos < n_commits / 2; commit_pos++) {
+		uint32_t oldest = commits[n_commits - 1 - commit_pos];
+		commits[n_commits - 1 - commit_pos] = commits[commit_pos];
+		commits[commit_pos] = oldest;
+	}
 	
-	// Update head.
-	project->head = node;
+	// Check every commit before anything changes.
+	replay_tree_t tree;
+	replay_tree_init(&tree, onto);
+	int is_conflict = 0;
+	for (size_t commit_pos = 0; commit_pos < n_commits && is_conflict == 0; commit_pos++) {
+		is_conflict = replay_check(project, &tree, commits[commit_pos]);
+	}
+	replay_tree_free(&tree);
+	if (is_conflict != 0) {
+		free(commits);
+		project->head = old_head;
+		return -3;
+	}
 	
-	// Fill up the commit_table.
-	add_commit_table(helper);
+	replay_tree_t before;
+	replay_tree_init(&before, staging);
+	int write_tree = (project->in_memory == 0);
 	
-	// Create next node.
-	node->n_next_commit++;
-	if (node->n_next_commit == 1) {
-		node->next = (commit_node_t **)malloc(sizeof(commit_node_t *) * node->n_next_commit);
+	// The branch continues from onto_branch with a new staging area, the old one is dropped.
+	commit_node_t *node = node_clone(project, onto);
+	node->branch_name = staging->branch_name;
+	onto->n_next_commit++;
+	if (onto->n_next_commit == 1) {
+		onto->next = (commit_node_t **)malloc(sizeof(commit_node_t *) * onto->n_next_commit);
 	}else {
-		node->next = (commit_node_t **)realloc(node->next, sizeof(commit_node_t *) * node->n_next_commit);
+		onto->next = (commit_node_t **)realloc(onto->next, sizeof(commit_node_t *) * onto->n_next_commit);
 	}
+	onto->next[onto->n_next_commit - 1] = node;
+	project->branch_table[branch_index(project, staging->branch_name)].branch_address = node;
+	unlink_staging(project, staging);
+	cleanup_files(staging->n_tracked_files, staging->tracked_files);
+	free(staging->tracked_files);
+	free(staging->actions);
+	free(staging);
+	project->current_node = node;
+	project->head = onto;
 	
-	// Copy node to next node.
-	node->next[node->n_next_commit - 1] = node_copy(node);
-
-	// Update current node (which will be used as staging area).
-	project->current_node = node->next[node->n_next_commit - 1];
+	int n_replayed = replay_commits(project, commits, n_commits);
+	free(commits);
+	if (write_tree) {
+		replay_write_tree(project, &before, project->current_node);
+	}
+	replay_tree_free(&before);
+	journal_log_args(project, JOURNAL_OP_REBASE, 1, &onto_branch);
 	
-	return node->commit_id;
+	return n_replayed;
 }
 
-void *get_commit(void *helper, char *commit_id) {
+// Find a file of a commit for svc_read_file() and svc_read_file_chunks(), as the file that holds
+// its content. Return 0, -1 if an argument is NULL, -2 if no such commit exists or -3 if the commit
+// has no such file.
+static int read_file_lookup(void *helper, char *commit_id, char *path, tracked_file_t **file) {
+	if (commit_id == NULL || path == NULL) {
+		return -1;
+	}
+	commit_node_t *commit = get_commit(helper, commit_id);
+	if (commit == NULL) {
+		return -2;
+	}
+	*file = node_find_file(commit, path);
+	if (*file == NULL) {
+		return -3;
+	}
+	*file = content_owner(*file);
+	return 0;
+}
+
+// Give a view of the stored content of a file of a commit, without copying it. view->data
+// points into the stored content or into its mapping from the spill file, and holds view->len
+// bytes followed by a null byte. The content is pinned in memory until svc_release_file(), the
+// memory budget is still enforced on every other content.
+// Return 0, -1 if an argument is NULL, -2 if no such commit exists, -3 if the commit has no
+// such file, or -4 if the spilled content could not be mapped.
+int svc_read_file(void *helper, char *commit_id, char *path, svc_blob_view_t *view) {
+	TRACE_SCOPE("svc_read_file", path, TRACE_NONE, TRACE_NONE);
 	project_t *project = (project_t*)helper;
-	int is_matched = 1;
+	commit_queue_wait(project);
+	if (view == NULL) {
+		return -1;
+	}
+	view->data = NULL;
+	view->len = 0;
+	view->file = NULL;
 	
-	// If commit_id is NULL, this function should return NULL.
-	if (commit_id == NULL) {
-		return NULL;
+	tracked_file_t *file;
+	int result = read_file_lookup(helper, commit_id, path, &file);
+	if (result != 0) {
+		return result;
 	}
 	
-	// If a commit with the given id does exist in the commit table, return its address.
-	for (int commit_idx = 0; commit_idx < project->n_total_commit; commit_idx++) {
-		is_matched = strcmp(project->commit_table[commit_idx].commit_id, commit_id);
-		if (is_matched == 0) {
-			return project->commit_table[commit_idx].commit_address;
-		}
+	// content_get() does not spill the content it returns, and the pin keeps it from then on.
+	unsigned char *content = content_get(project, file);
+	// The file could not be read when it was committed, it is stored as empty.
+	if (content == NULL && file->content_state != CONTENT_SPILLED) {
+		content = (unsigned char *)"";
 	}
+	if (content == NULL) {
+		return -4;
+	}
+	content_pin_file(project, file);
+	view->data = content;
+	view->len = (content == file->content) ? file->content_len : 0;
+	view->file = file;
+	trace_scope.bytes = view->len;
 	
-	// Otherwise, return NULL.
-    return NULL;
+	return 0;
 }
 
-char **get_prev_commits(void *helper, void *commit, int *n_prev) {
-	// If n_prev is NULL, return NULL.
-	if (n_prev == NULL) {
-		return NULL;
+// Unpin the content behind a view from svc_read_file(). The view must not be used afterwards.
+void svc_release_file(void *helper, svc_blob_view_t *view) {
+	project_t *project = (project_t*)helper;
+	if (view == NULL || view->data == NULL) {
+		return;
 	}
-	
-	// If commit is NULL, or it is the very first commit,
-	// this function should set the contents of n_prev to 0 and return NULL.
+	view->data = NULL;
+	view->len = 0;
+	commit_queue_lock(project);
+	content_unpin_file(project, (tracked_file_t *)view->file);
+	commit_queue_unlock(project);
+	view->file = NULL;
+}
+
+// Stream the stored content of a file of a commit to callback in chunks of at most chunk_len
+// bytes. Content in memory is passed without copying. Spilled content is read from the spill
+// file chunk by chunk, it is not mapped back in and does not displace other contents.
+// A nonzero return from the callback stops the stream.
+// Return 0, 1 if the callback stopped it, -1 if an argument is NULL or chunk_len is 0, -2 if no
+// such commit exists, -3 if the commit has no such file, or -4 if the spill file could not be read.
+int svc_read_file_chunks(void *helper, char *commit_id, char *path, size_t chunk_len, svc_chunk_callback_t callback, void *ctx) {
+	TRACE_SCOPE("svc_read_file_chunks", path, TRACE_NONE, TRACE_NONE);
 	project_t *project = (project_t*)helper;
-	if (commit == NULL || project->n_total_commit == 1){
-		*n_prev = 0;
-		return NULL;
+	commit_queue_wait(project);
+	if (callback == NULL || chunk_len == 0) {
+		return -1;
 	}
 	
-    commit_node_t *node = (commit_node_t*)commit;
-	char **prev_commits = NULL;
-	int item_count = 0;
+	tracked_file_t *file;
+	int result = read_file_lookup(helper, commit_id, path, &file);
+	if (result != 0) {
+		return result;
+	}
+	trace_scope.bytes = file->content_len;
 	
-	while (node != NULL && node->prev != NULL) {
-		node = node->prev;
-		item_count++;
-		int malloc_size = sizeof(char*) * item_count;
-		
-		if (item_count == 1) {
-			prev_commits = malloc(malloc_size);
-		}else {
-			prev_commits = realloc(prev_commits, malloc_size);
+	if (file->content_state != CONTENT_SPILLED) {
+		content_pin(project);
+		unsigned char *content = content_get(project, file);
+		for (size_t pos = 0; content != NULL && pos < file->content_len && result == 0; pos += chunk_len) {
+			size_t len = (file->content_len - pos < chunk_len) ? file->content_len - pos : chunk_len;
+			result = (callback(ctx, content + pos, len) != 0);
 		}
-		
-		// Allocate memory for commit_id string.
-		prev_commits[item_count - 1] = node->commit_id;
+		content_unpin(project);
+		return result;
 	}
-	*n_prev = item_count;
 	
-	return prev_commits;
+	size_t buf_len = (file->content_len < chunk_len) ? file->content_len : chunk_len;
+	unsigned char *buf = (unsigned char *)malloc(buf_len + 1);
+	size_t pos = 0;
+	while (pos < file->content_len && result == 0) {
+		size_t len = (file->content_len - pos < chunk_len) ? file->content_len - pos : chunk_len;
+		ssize_t n_read = pread(project->spill_fd, buf, len, file->spill_offset + pos);
+		if (n_read < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n_read <= 0) {
+			result = -4;
+			break;
+		}
+		result = (callback(ctx, buf, n_read) != 0);
+		pos += n_read;
+	}
+	free(buf);
+
+	return result;
 }
 
-void print_commit(void *helper, char *commit_id) {
-	commit_node_t *commit = get_commit(helper, commit_id);
+// The staging area at the end of a branch.
+static commit_node_t *branch_staging(project_t *project, size_t branch_idx) {
+	commit_node_t *node = project->branch_table[branch_idx].branch_address;
+	while (node->commit_seq != COMMIT_NONE) {
+		node = node->next[0];
+	}
+	return node;
+}
+
+static int compare_name_ptr(const void *pa, const void *pb) {
+	uintptr_t p1 = (uintptr_t)*(char * const *)pa;
+	uintptr_t p2 = (uintptr_t)*(char * const *)pb;
+	return (p1 > p2) - (p1 < p2);
+}
 
-	if (commit == NULL || commit_id == NULL) {
-		printf("Invalid commit id\n");
-	}else {		
-		printf("%s [%s]: %s\n", commit->commit_id, commit->branch_name, commit->message);
-		for (int action_idx = 0; action_idx < commit->n_actions; action_idx++) {
-			const action_info_t *action_inf = &commit->actions[action_idx];
-			if (action_inf->action == ACTION_ADD) {
-				printf("    + %s\n", action_inf->file_name);
-			}else if (action_inf->action == ACTION_REMOVE) {
-				printf("    - %s\n", action_inf->file_name);
-			}else if (action_inf->action == ACTION_MODIFY){
-				printf("    / %s [%10d -> %10d]\n", action_inf->file_name, action_inf->old_hash, action_inf->hash);
+// Keep the names that actions of retained commits point to as squashed names, and retire the rest.
+// The action of a removal points to the file of the commit it was removed from, which may be squashed.
+static void squash_keep_names(project_t *project, char **names, size_t n_names, unsigned char *removed) {
+	qsort(names, n_names, sizeof(char *), compare_name_ptr);
+	unsigned char *is_used = (unsigned char *)calloc(n_names + 1, sizeof(unsigned char));
+	commit_meta_t *meta = &project->commits;
+	for (uint32_t commit_idx = 0; commit_idx < project->n_total_commit; commit_idx++) {
+		if (removed[commit_idx]) {
+			continue;
+		}
+		for (uint32_t action_idx = 0; action_idx < meta->action_counts[commit_idx]; action_idx++) {
+			char *file_name = meta->actions[meta->action_starts[commit_idx] + action_idx].file_name;
+			char **found = (char **)bsearch(&file_name, names, n_names, sizeof(char *), compare_name_ptr);
+			if (found != NULL) {
+				is_used[found - names] = 1;
 			}
 		}
-		printf("\n");
-		printf("    Tracked files (%ld):\n", commit->n_tracked_files);
-		for (int file_idx = 0; file_idx < commit->n_tracked_files; file_idx++) {
-			printf("    [%10d] %s\n", commit->tracked_files[file_idx].hash, commit->tracked_files[file_idx].file_name);
+	}
+
+	free(project->squash_names);
+	project->squash_names = NULL;
+	project->n_squash_names = 0;
+	for (size_t name_idx = 0; name_idx < n_names; name_idx++) {
+		if (is_used[name_idx] == 0) {
+			epoch_retire(project, names[name_idx]);
+			continue;
 		}
+		project->n_squash_names++;
+		if (project->n_squash_names == 1) {
+			project->squash_names = (char **)malloc(sizeof(char *) * project->n_squash_names);
+		}else {
+			project->squash_names = (char **)realloc(project->squash_names, sizeof(char *) * project->n_squash_names);
+		}
+		project->squash_names[project->n_squash_names - 1] = names[name_idx];
 	}
+	free(is_used);
 }
 
-// Check if the given branch name is valid.
-static int check_valid_barnch_name(char *branch_name) {
-	if (branch_name == NULL) {
-		return 0;
+// Let a retained file that shares the content of a dropped file take the content over, or share
+// it with the file that took it over. The squash marks a dropped file that holds a content by
+// pointing it to itself, and then to the file that took it over. Only committed files take
+// contents over, because the file array of a staging area moves. A staged file gets a copy.
+static void squash_take_content(project_t *project, tracked_file_t *file, int is_staged) {
+	tracked_file_t *base = file->base;
+	if (base == NULL || base->base == NULL) {
+		return;
+	}
+	if (base->base != base) {
+		file->base = base->base;
+		return;
 	}
 	
-	int branch_name_len = strlen(branch_name);
-	int is_valid = 0;
+	file->base = NULL;
+	if (is_staged) {
+		unsigned char *content = content_get(project, base);
+		file->content_len = (content == NULL) ? 0 : base->content_len;
+		file->content = (unsigned char *)malloc(file->content_len + 1);
+		if (content != NULL) {
+			memcpy(file->content, content, file->content_len);
+		}
+		file->content[file->content_len] = '\0';
+		return;
+	}
+	int is_listed = (base->lru_prev != NULL || base->lru_next != NULL || project->lru_head == base);
+	if (is_listed) {
+		lru_unlink(project, base);
+	}
+	file->content = base->content;
+	file->content_state = base->content_state;
+	file->spill_offset = base->spill_offset;
+	if (is_listed) {
+		lru_push_front(project, file);
+	}
+	base->content = NULL;
+	base->content_state = CONTENT_HEAP;
+	base->base = file;
+}
+
+// Rebuild the commit metadata with only the commits that are not removed, in the same order.
+// new_idx receives the new position of every commit, COMMIT_NONE for a removed one. The nodes
+// keep their sequence numbers, so readers of the old snapshot still find them at the old positions.
+static void squash_compact_meta(project_t *project, unsigned char *removed, uint32_t *new_idx) {
+	commit_meta_t *old_meta = &project->commits;
+	commit_meta_t meta;
+	memset(&meta, 0, sizeof(meta));
+
+	size_t n_kept = 0;
+	for (uint32_t commit_idx = 0; commit_idx < project->n_total_commit; commit_idx++) {
+		if (removed[commit_idx] == 0) {
+			n_kept++;
+			meta.messages_cap += strlen(old_meta->messages + old_meta->message_offs[commit_idx]) + 1;
+			meta.actions_cap += old_meta->action_counts[commit_idx];
+		}
+	}
+	meta.cap = 16;
+	while (meta.cap < n_kept) {
+		meta.cap *= 2;
+	}
+	meta.ids = (uint32_t *)malloc(sizeof(uint32_t) * meta.cap);
+	meta.parents = (uint32_t *)malloc(sizeof(uint32_t) * meta.cap);
+	meta.branches = (uint32_t *)malloc(sizeof(uint32_t) * meta.cap);
+	meta.message_offs = (uint32_t *)malloc(sizeof(uint32_t) * meta.cap);
+	meta.action_starts = (uint32_t *)malloc(sizeof(uint32_t) * meta.cap);
+	meta.action_counts = (uint32_t *)malloc(sizeof(uint32_t) * meta.cap);
+	meta.path_blooms = (uint64_t *)malloc(sizeof(uint64_t) * PATH_BLOOM_WORDS * meta.cap);
+	meta.nodes = (commit_node_t **)malloc(sizeof(commit_node_t *) * meta.cap);
+	meta.seqs = (uint32_t *)malloc(sizeof(uint32_t) * meta.cap);
+	meta.messages = (meta.messages_cap == 0) ? NULL : (char *)malloc(meta.messages_cap);
+	meta.actions = (meta.actions_cap == 0) ? NULL : (action_info_t *)malloc(sizeof(action_info_t) * meta.actions_cap);
+
+	uint32_t kept_idx = 0;
+	for (uint32_t commit_idx = 0; commit_idx < project->n_total_commit; commit_idx++) {
+		if (removed[commit_idx]) {
+			new_idx[commit_idx] = COMMIT_NONE;
+			continue;
+		}
+		commit_node_t *node = old_meta->nodes[commit_idx];
+		new_idx[commit_idx] = kept_idx;
+		// Parents come first, so theirs is already known.
+		meta.parents[kept_idx] = (node->prev == NULL) ? COMMIT_NONE : new_idx[old_meta->parents[commit_idx]];
+		meta.ids[kept_idx] = old_meta->ids[commit_idx];
+		meta.branches[kept_idx] = old_meta->branches[commit_idx];
 	
-	for (int idx = 0; idx < branch_name_len; idx++) {
-		if ((branch_name[idx] >= 'a' && branch_name[idx] <= 'z') || 
-		   (branch_name[idx] >= 'A' && branch_name[idx] <= 'Z') || 
-		   (branch_name[idx] >= '0' && branch_name[idx] <= '9') ||
-		   (branch_name[idx] == '_') ||
-		   (branch_name[idx] == '/') ||
-		   (branch_name[idx] == '-') 
-	  	){
-			is_valid = 1;
-		}else {
-			is_valid = 0;
-			break;
+		char *message = old_meta->messages + old_meta->message_offs[commit_idx];
+		size_t message_len = strlen(message) + 1;
+		memcpy(meta.messages + meta.messages_len, message, message_len);
+		meta.message_offs[kept_idx] = meta.messages_len;
+		meta.messages_len += message_len;
+	
+		uint32_t n_actions = old_meta->action_counts[commit_idx];
+		if (n_actions > 0) {
+			memcpy(meta.actions + meta.n_actions, old_meta->actions + old_meta->action_starts[commit_idx], sizeof(action_info_t) * n_actions);
 		}
+		meta.action_starts[kept_idx] = meta.n_actions;
+		meta.action_counts[kept_idx] = n_actions;
+		meta.n_actions += n_actions;
+	
+		memcpy(&meta.path_blooms[kept_idx * PATH_BLOOM_WORDS], &old_meta->path_blooms[commit_idx * PATH_BLOOM_WORDS], sizeof(uint64_t) * PATH_BLOOM_WORDS);
+		meta.nodes[kept_idx] = node;
+		meta.seqs[kept_idx] = old_meta->seqs[commit_idx];
+		kept_idx++;
 	}
 	
-	return is_valid;
+	// Hex ids are kept by sequence number, so the strings of retained commits do not move. Blocks
+	// without a retained commit go, except the last one, which new commits still fill. Readers of
+	// the old snapshot may still format a dropped commit, so the blocks are retired.
+	size_t chunk_base = old_meta->hex_chunk_base;
+	size_t chunk_end = chunk_base + old_meta->n_hex_chunks;
+	meta.hex_chunk_base = meta.seqs[0] / COMMIT_HEX_CHUNK;
+	meta.n_hex_chunks = chunk_end - meta.hex_chunk_base;
+	meta.hex_chunks = (char **)calloc(meta.n_hex_chunks, sizeof(char *));
+	meta.hex_chunks[meta.n_hex_chunks - 1] = old_meta->hex_chunks[old_meta->n_hex_chunks - 1];
+	for (size_t seq_idx = 0; seq_idx < n_kept; seq_idx++) {
+		size_t chunk = meta.seqs[seq_idx] / COMMIT_HEX_CHUNK;
+		meta.hex_chunks[chunk - meta.hex_chunk_base] = old_meta->hex_chunks[chunk - chunk_base];
+	}
+	for (size_t chunk = chunk_base; chunk < chunk_end; chunk++) {
+		char *block = old_meta->hex_chunks[chunk - chunk_base];
+		if (chunk < meta.hex_chunk_base || meta.hex_chunks[chunk - meta.hex_chunk_base] != block) {
+			epoch_retire(project, block);
+		}
+	}
+
+	epoch_retire(project, old_meta->ids);
+	epoch_retire(project, old_meta->parents);
+	epoch_retire(project, old_meta->branches);
+	epoch_retire(project, old_meta->message_offs);
+	epoch_retire(project, old_meta->action_starts);
+	epoch_retire(project, old_meta->action_counts);
+	epoch_retire(project, old_meta->path_blooms);
+	epoch_retire(project, old_meta->nodes);
+	epoch_retire(project, old_meta->seqs);
+	epoch_retire(project, old_meta->messages);
+	epoch_retire(project, old_meta->actions);
+	epoch_retire(project, old_meta->hex_chunks);
+	*old_meta = meta;
+	project->n_total_commit = n_kept;
+
+	// A new id index, sized like add_commit_meta() sizes it.
+	size_t index_cap = 64;
+	while (project->n_total_commit * 2 > index_cap) {
+		index_cap *= 2;
+	}
+	atomic_uint *index = (atomic_uint *)calloc(index_cap, sizeof(atomic_uint));
+	for (uint32_t commit_idx = 0; commit_idx < project->n_total_commit; commit_idx++) {
+		commit_index_insert(index, index_cap, meta.ids, commit_idx);
+	}
+	epoch_retire(project, project->commit_index);
+	project->commit_index = index;
+	project->commit_index_cap = index_cap;
 }
 
-// Fill up the branch table that keeps track of the address of the root node for each branches.
-static void add_branch_table(void *helper) {
+// Renumber the path logs and drop the removed commits from them. Only the writer uses them.
+static void squash_path_logs(project_t *project, uint32_t *new_idx) {
+	size_t logs_cap = project->path_logs_cap;
+	path_log_t *logs = (logs_cap == 0) ? NULL : (path_log_t *)calloc(logs_cap, sizeof(path_log_t));
+	project->n_path_logs = 0;
+	for (size_t log_idx = 0; log_idx < logs_cap; log_idx++) {
+		path_log_t *log = &project->path_logs[log_idx];
+		if (log->file_name == NULL) {
+			continue;
+		}
+		size_t n_commits = 0;
+		for (size_t pos = 0; pos < log->n_commits; pos++) {
+			if (new_idx[log->commits[pos]] != COMMIT_NONE) {
+				log->commits[n_commits++] = new_idx[log->commits[pos]];
+			}
+		}
+		log->n_commits = n_commits;
+		if (n_commits == 0) {
+			free(log->file_name);
+			free(log->commits);
+			continue;
+		}
+		*path_log_slot(logs, logs_cap, log->file_name) = *log;
+		project->n_path_logs++;
+	}
+	free(project->path_logs);
+	project->path_logs = logs;
+}
+
+// Make commit_id the first commit of its history. Its ancestors that no branch still reaches
+// without passing through it are dropped with their files, and the rest no longer count as its
+// previous commits. Retained commits keep their ids, nodes and actions, so get_commit(),
+// get_prev_commits() and print_commit() work for them as before, also with id strings handed
+// out earlier. Id strings of dropped commits are freed with them, and their spilled contents give
+// their space in the spill file back, so a history that is squashed now and then keeps a bounded
+// footprint.
+// A reader racing the squash may see a retained commit with the history of either side.
+// Return the number of dropped commits. If commit_id is NULL or no such commit exists,
+// return -1. If views from svc_read_file() are still held, return -2.
+int svc_squash_before(void *helper, char *commit_id) {
+	TRACE_SCOPE("svc_squash_before", commit_id, TRACE_NONE, TRACE_NONE);
 	project_t *project = (project_t*)helper;
-	commit_node_t *node = project->current_node->prev;
+	commit_queue_wait(project);
+	commit_node_t *first = (commit_node_t *)get_commit(helper, commit_id);
+	if (first == NULL) {
+		return -1;
+	}
+	if (project->n_file_pins > 0) {
+		return -2;
+	}
+	// The caller's string may be one of the ids that are about to go.
+	char id[COMMIT_ID_LEN];
+	strcpy(id, commit_id);
 
-	project->n_total_branch++;
-	if (project->n_total_branch == 1) {
-		project->branch_table = (branch_table_t *)malloc(sizeof(branch_table_t) * project->n_total_branch);
-	}else {
-		project->branch_table = (branch_table_t *)realloc(project->branch_table, sizeof(branch_table_t) * project->n_total_branch);
+	commit_meta_t *meta = &project->commits;
+	size_t n_commits = project->n_total_commit;
+	uint32_t first_idx = project_commit_idx(project, first);
+	unsigned char *removed = (unsigned char *)calloc(n_commits, sizeof(unsigned char));
+	unsigned char *is_reached = (unsigned char *)calloc(n_commits, sizeof(unsigned char));
+	for (uint32_t commit_idx = meta->parents[first_idx]; commit_idx != COMMIT_NONE; commit_idx = meta->parents[commit_idx]) {
+		removed[commit_idx] = 1;
+	}
+
+	// Ancestors that a branch reaches around the first commit stay.
+	commit_node_t **stagings = (commit_node_t **)malloc(sizeof(commit_node_t *) * project->n_total_branch);
+	for (size_t branch_idx = 0; branch_idx < project->n_total_branch; branch_idx++) {
+		stagings[branch_idx] = branch_staging(project, branch_idx);
+		commit_node_t *tip = stagings[branch_idx]->prev;
+		uint32_t commit_idx = (tip == NULL) ? COMMIT_NONE : project_commit_idx(project, tip);
+		while (commit_idx != COMMIT_NONE && commit_idx != first_idx && is_reached[commit_idx] == 0) {
+			is_reached[commit_idx] = 1;
+			removed[commit_idx] = 0;
+			commit_idx = meta->parents[commit_idx];
+		}
+	}
+	free(is_reached);
+
+	// Detach the first commit and the retained nodes from the removed ones.
+	commit_node_t *parent = first->prev;
+	if (parent != NULL) {
+		for (int next_idx = 0; next_idx < parent->n_next_commit; next_idx++) {
+			if (parent->next[next_idx] == first) {
+				memmove(&parent->next[next_idx], &parent->next[next_idx + 1], sizeof(commit_node_t *) * (parent->n_next_commit - next_idx - 1));
+				parent->n_next_commit--;
+				break;
+			}
+		}
+		first->prev = NULL;
+	}
+	int n_removed = 0;
+	for (uint32_t commit_idx = 0; commit_idx < n_commits; commit_idx++) {
+		commit_node_t *node = meta->nodes[commit_idx];
+		if (removed[commit_idx]) {
+			n_removed++;
+			continue;
+		}
+		size_t n_next = 0;
+		for (int next_idx = 0; next_idx < node->n_next_commit; next_idx++) {
+			commit_node_t *next = node->next[next_idx];
+			if (next->commit_seq == COMMIT_NONE || removed[project_commit_idx(project, next)] == 0) {
+				node->next[n_next++] = next;
+			}
+		}
+		node->n_next_commit = n_next;
+		if (n_next == 0) {
+			epoch_retire(project, node->next);
+			node->next = NULL;
+		}
+	}
+
+	// A branch must still lead to its staging area through first next nodes. If it does not, it
+	// starts again where its staging area stops being the first next node.
+	for (size_t branch_idx = 0; branch_idx < project->n_total_branch; branch_idx++) {
+		commit_node_t *node = project->branch_table[branch_idx].branch_address;
+		while (node != NULL && node->commit_seq != COMMIT_NONE && removed[project_commit_idx(project, node)] == 0) {
+			node = (node->n_next_commit == 0) ? NULL : node->next[0];
+		}
+		if (node == stagings[branch_idx]) {
+			continue;
+		}
+		node = stagings[branch_idx];
+		while (node->prev != NULL && node->prev->n_next_commit > 0 && node->prev->next[0] == node) {
+			node = node->prev;
+		}
+		project->branch_table[branch_idx].branch_address = node;
+	}
+	free(stagings);
+	if (project->root_node->commit_seq != COMMIT_NONE && removed[project_commit_idx(project, project->root_node)]) {
+		project->root_node = first;
+	}
+	if (project->head != NULL && project->head->commit_seq != COMMIT_NONE && removed[project_commit_idx(project, project->head)]) {
+		project->head = project->current_node->prev;
+	}
+
+	// File names of the removed nodes, and of earlier squashes, that actions may still name.
+	size_t n_names = project->n_squash_names;
+	for (uint32_t commit_idx = 0; commit_idx < n_commits; commit_idx++) {
+		if (removed[commit_idx]) {
+			n_names += meta->nodes[commit_idx]->n_tracked_files;
+		}
+	}
+	char **names = (char **)malloc(sizeof(char *) * (n_names + 1));
+	n_names = 0;
+	for (size_t name_idx = 0; name_idx < project->n_squash_names; name_idx++) {
+		names[n_names++] = project->squash_names[name_idx];
+	}
+	for (uint32_t commit_idx = 0; commit_idx < n_commits; commit_idx++) {
+		commit_node_t *node = meta->nodes[commit_idx];
+		if (removed[commit_idx] == 0) {
+			continue;
+		}
+		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+			names[n_names++] = node->tracked_files[file_idx].file_name;
+		}
+	}
+	squash_keep_names(project, names, n_names, removed);
+	free(names);
+
+	// Contents the retained files share with removed ones are handed over, commits first.
+	for (uint32_t commit_idx = 0; commit_idx < n_commits; commit_idx++) {
+		commit_node_t *node = meta->nodes[commit_idx];
+		for (int file_idx = 0; removed[commit_idx] && file_idx < node->n_tracked_files; file_idx++) {
+			tracked_file_t *file = &node->tracked_files[file_idx];
+			if (file->base == NULL) {
+				file->base = file;
+			}
+		}
+	}
+	content_pin(project);
+	for (uint32_t commit_idx = 0; commit_idx < n_commits; commit_idx++) {
+		commit_node_t *node = meta->nodes[commit_idx];
+		for (int file_idx = 0; removed[commit_idx] == 0 && file_idx < node->n_tracked_files; file_idx++) {
+			squash_take_content(project, &node->tracked_files[file_idx], 0);
+		}
 	}
+	for (size_t branch_idx = 0; branch_idx < project->n_total_branch; branch_idx++) {
+		commit_node_t *node = branch_staging(project, branch_idx);
+		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+			squash_take_content(project, &node->tracked_files[file_idx], 1);
+		}
+	}
+	content_unpin(project);
 	
-	project->branch_table[project->n_total_branch - 1].branch_name = node->next[node->n_next_commit - 1]->branch_name;
-	project->branch_table[project->n_total_branch - 1].branch_address = node->next[node->n_next_commit - 1];
+	// Readers of an older snapshot may still look at the removed nodes and their file names,
+	// but not at their contents.
+	spill_range_t *ranges = NULL;
+	size_t n_ranges = 0;
+	size_t ranges_cap = 0;
+	for (uint32_t commit_idx = 0; commit_idx < n_commits; commit_idx++) {
+		commit_node_t *node = meta->nodes[commit_idx];
+		if (removed[commit_idx] == 0) {
+			continue;
+		}
+		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+			tracked_file_t *file = &node->tracked_files[file_idx];
+			if (file->content_state != CONTENT_HEAP) {
+				if (n_ranges == ranges_cap) {
+					ranges_cap = (ranges_cap == 0) ? 64 : ranges_cap * 2;
+					ranges = (spill_range_t *)realloc(ranges, sizeof(spill_range_t) * ranges_cap);
+				}
+				ranges[n_ranges].offset = file->spill_offset;
+				ranges[n_ranges].len = file->content_len + 1;
+				n_ranges++;
+			}
+			content_forget(project, file);
+		}
+		epoch_retire(project, node->tracked_files);
+		epoch_retire(project, node->next);
+		epoch_retire(project, node);
+	}
+	spill_release(project, ranges, n_ranges);
+	free(ranges);
+
+	uint32_t *new_idx = (uint32_t *)malloc(sizeof(uint32_t) * (n_commits + 1));
+	squash_compact_meta(project, removed, new_idx);
+	squash_path_logs(project, new_idx);
+	free(new_idx);
+	free(removed);
+	publish_snapshot(project);
+
+	char *args[1] = {id};
+	journal_log_args(project, JOURNAL_OP_SQUASH, 1, args);
+
+	return n_removed;
 }
 
-// Check if the given branch name is already existing.
-static int check_exist_branch(void *helper, char *branch_name) {
-	project_t *project = (project_t*)helper;
-	int is_exist = 1;
-	
-	for (int branch_idx = 0; branch_idx < project->n_total_branch; branch_idx++) {
-		is_exist = strcmp(project->branch_table[branch_idx].branch_name, branch_name);
-		if (is_exist == 0) {
-			break;
+// Histories are imported from and exported to a stream of commands, each on a line of its own:
+//   commit <branch>     Start a commit on the branch, which is created if it does not exist.
+//   from <ref>          Optional. The parent of the commit, by default the last commit of the branch.
+//   message <len>       Followed by len bytes of message and a newline.
+//   M <len> <path>      Followed by len bytes of content and a newline. Adds or replaces a file.
+//   D <path>            Removes a file.
+//   end                 Makes the commit. A commit that changes nothing is not made.
+//   branch <branch>     Followed by from <ref>. The branch continues from ref, created if missing.
+// A ref is :<n> for the n-th commit of the stream counting from 1, :0 for no commit, or a commit id.
+// A commit starts with the files of its parent, and its actions are computed against them.
+#define IMPORT_BUF_LEN (1 << 16)
+
+typedef struct import_reader{
+	int fd;
+	unsigned char *buf;
+	size_t len;
+	size_t pos;
+	int error;
+}import_reader_t;
+
+// Read more of the stream behind what is not consumed yet. Return 0 at the end of the stream,
+// if reading failed or if the buffer is full.
+static size_t import_fill(import_reader_t *reader) {
+	if (reader->pos > 0) {
+		memmove(reader->buf, reader->buf + reader->pos, reader->len - reader->pos);
+		reader->len -= reader->pos;
+		reader->pos = 0;
+	}
+	while (reader->len < IMPORT_BUF_LEN) {
+		ssize_t n_read = read(reader->fd, reader->buf + reader->len, IMPORT_BUF_LEN - reader->len);
+		if (n_read < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n_read < 0) {
+			reader->error = 1;
+			return 0;
+		}
+		reader->len += n_read;
+		return n_read;
+	}
+	return 0;
+}
+
+// The next line, null terminated in place of its newline. NULL at the end of the stream.
+// A line cut short or longer than the buffer sets the error.
+static char *import_line(import_reader_t *reader) {
+	size_t n_scanned = 0;
+	for (;;) {
+		unsigned char *start = reader->buf + reader->pos;
+		unsigned char *newline = (unsigned char *)memchr(start + n_scanned, '\n', reader->len - reader->pos - n_scanned);
+		if (newline != NULL) {
+			*newline = '\0';
+			reader->pos = newline - reader->buf + 1;
+			return (char *)start;
+		}
+		n_scanned = reader->len - reader->pos;
+		if (import_fill(reader) == 0) {
+			if (reader->len > reader->pos) {
+				reader->error = 1;
+			}
+			return NULL;
+		}
+	}
+}
+
+// Read len bytes and the newline after them. Whatever is not buffered is read straight into dst.
+// Return 0, or -1 if the stream ends first.
+static int import_bytes(import_reader_t *reader, unsigned char *dst, size_t len) {
+	size_t n_copied = reader->len - reader->pos;
+	if (n_copied > len) {
+		n_copied = len;
+	}
+	memcpy(dst, reader->buf + reader->pos, n_copied);
+	reader->pos += n_copied;
+	while (n_copied < len) {
+		ssize_t n_read = read(reader->fd, dst + n_copied, len - n_copied);
+		if (n_read < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n_read <= 0) {
+			return -1;
 		}
+		n_copied += n_read;
 	}
 	
-	return is_exist;
+	if (reader->pos == reader->len && import_fill(reader) == 0) {
+		return -1;
+	}
+	if (reader->buf[reader->pos] != '\n') {
+		return -1;
+	}
+	reader->pos++;
+	return 0;
 }
 
-int svc_branch(void *helper, char *branch_name) {
-	// If the given branch name is NULL, return -1.
-	if (branch_name == NULL) {
+// Parse the decimal length at the start of a command argument. rest gets what follows the
+// length and one space. Return 0, or -1 if there is no length.
+static int import_len(char *arg, size_t *len, char **rest) {
+	if (*arg < '0' || *arg > '9') {
+		return -1;
+	}
+	char *end;
+	errno = 0;
+	unsigned long long value = strtoull(arg, &end, 10);
+	if (errno != 0 || (*end != '\0' && *end != ' ')) {
 		return -1;
 	}
-	
-	// If the given branch name is invalid, return -1.
-	int is_valid_branch_name = check_valid_barnch_name(branch_name);
-	if (is_valid_branch_name == 0) {
-		return -1;
+	*len = value;
+	*rest = (*end == ' ') ? end + 1 : end;
+	return 0;
+}
+
+// Resolve a ref of the stream. node is NULL for :0 or a commit that was not made because it changed
+// nothing and had no parent. Return 0, or -1 if the ref names no commit.
+static int import_ref(project_t *project, char *ref, commit_node_t **marks, size_t n_marks, commit_node_t **node) {
+	if (ref[0] == ':') {
+		size_t mark;
+		char *rest;
+		if (import_len(ref + 1, &mark, &rest) != 0 || *rest != '\0' || mark > n_marks) {
+			return -1;
+		}
+		*node = (mark == 0) ? NULL : marks[mark - 1];
+		return 0;
+	}
+	*node = (commit_node_t *)get_commit(project, ref);
+	return (*node == NULL) ? -1 : 0;
+}
+
+// Whether a staging area has exactly the files of the commit, in the same order.
+static int import_same_files(commit_node_t *staging, commit_node_t *commit) {
+	size_t n_files = (commit == NULL) ? 0 : commit->n_tracked_files;
+	if (staging->n_tracked_files != n_files) {
+		return 0;
+	}
+	for (size_t file_idx = 0; file_idx < n_files; file_idx++) {
+		tracked_file_t *file = &staging->tracked_files[file_idx];
+		tracked_file_t *commit_file = &commit->tracked_files[file_idx];
+		if (file->fingerprint != commit_file->fingerprint || file->hash != commit_file->hash || strcmp(file->file_name, commit_file->file_name) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Staging area of a branch. Walking a branch is linear, so stagings caches them for the import.
+static commit_node_t *import_staging(project_t *project, commit_node_t ***stagings, size_t *n_stagings, uint32_t branch_idx) {
+	if (*n_stagings < project->n_total_branch) {
+		*stagings = (commit_node_t **)realloc(*stagings, sizeof(commit_node_t *) * project->n_total_branch);
+		memset(*stagings + *n_stagings, 0, sizeof(commit_node_t *) * (project->n_total_branch - *n_stagings));
+		*n_stagings = project->n_total_branch;
+	}
+	if ((*stagings)[branch_idx] == NULL) {
+		(*stagings)[branch_idx] = branch_staging(project, branch_idx);
 	}
-	
-	// If the branch name already exists, return -2.
-	int is_exist = check_exist_branch(helper, branch_name);
-	if (is_exist == 0) {
-		return -2;
+	return (*stagings)[branch_idx];
+}
+
+// The staging area a commit of the stream works on, with an index of its files by path. At the
+// start of a commit the staging area has the files of its parent in the same order, so a file
+// below the parent's count stands for the parent's file at the same index. Files the stream
+// removes stay in place, with their content, until the commit ends.
+#define IMPORT_TOUCHED 0x1
+#define IMPORT_REMOVED 0x2
+
+typedef struct import_files{
+	// Staging area the index is for, NULL once its files were replaced.
+	commit_node_t *staging;
+	size_t *index;
+	size_t index_cap;
+	// IMPORT_TOUCHED and IMPORT_REMOVED for every file of the staging area.
+	unsigned char *flags;
+	size_t flags_cap;
+	// Files the commit touched, once each.
+	size_t *touched;
+	size_t n_touched;
+	size_t touched_cap;
+	int has_removed;
+}import_files_t;
+
+static void import_files_grow(import_files_t *files, size_t n_files) {
+	if (n_files <= files->flags_cap) {
+		return;
 	}
-	
-	// If there are uncommitted changes, return -3.
-	int is_changed = check_change(helper);
-	if (is_changed == 1) {
-		return -3;
+	size_t cap = (files->flags_cap == 0) ? 64 : files->flags_cap;
+	while (cap < n_files) {
+		cap *= 2;
 	}
-	
-	project_t *project = (project_t*)helper;
-	commit_node_t *node = project->current_node->prev;
-	
-	node->n_next_commit++;
-	if (node->n_next_commit == 1) {
-		node->next = (commit_node_t **)malloc(sizeof(commit_node_t *) * node->n_next_commit);
-	}else {
-		node->next = (commit_node_t **)realloc(node->next, sizeof(commit_node_t *) * node->n_next_commit);
+	files->flags = (unsigned char *)realloc(files->flags, cap);
+	memset(files->flags + files->flags_cap, 0, cap - files->flags_cap);
+	files->flags_cap = cap;
+}
+
+// Let files describe the staging area. The index is only built again for another staging area.
+static void import_files_use(import_files_t *files, commit_node_t *staging) {
+	if (files->staging == staging) {
+		return;
 	}
-	
-	node->next[node->n_next_commit - 1] = branch_node_copy(node, branch_name); // get_node_copy returns copy with 'malloc' performed
-	add_branch_table(helper);
-	
-    return 0;
+	files->staging = staging;
+	file_index_build(&files->index, &files->index_cap, staging->tracked_files, staging->n_tracked_files);
+	import_files_grow(files, staging->n_tracked_files);
 }
 
-int svc_checkout(void *helper, char *branch_name) {
-	// If branch_name is NULL, return -1.
-	if (branch_name == NULL) {
-		return -1;
+static void import_files_touch(import_files_t *files, size_t file_idx) {
+	if (files->flags[file_idx] & IMPORT_TOUCHED) {
+		return;
 	}
-	
-	// If no such branch exists, return -1.
-	int check_exist = check_exist_branch(helper, branch_name);
-	if (check_exist != 0) {
-		return -1;
+	files->flags[file_idx] |= IMPORT_TOUCHED;
+	if (files->n_touched == files->touched_cap) {
+		files->touched_cap = (files->touched_cap == 0) ? 16 : files->touched_cap * 2;
+		files->touched = (size_t *)realloc(files->touched, sizeof(size_t) * files->touched_cap);
 	}
-	
-	// If there are uncommitted changes, return -2.
-	int is_changed = check_change(helper);
-	if (is_changed == 1) {
-		return -2;
+	files->touched[files->n_touched++] = file_idx;
+}
+
+// Let the branch's staging area continue from parent with the parent's files, like svc_reset().
+// A branch that does not exist is created there. With has_parent 0 the branch stays where it is.
+// Changes in the staging area are dropped. Return the staging area, or NULL if the branch name
+// is not valid.
+static commit_node_t *import_place_branch(project_t *project, char *branch_name, commit_node_t *parent, int has_parent, commit_node_t ***stagings, size_t *n_stagings, import_files_t *import_files) {
+	if (check_valid_barnch_name(branch_name) == 0 || strlen(branch_name) >= BRANCH_NAME_LEN) {
+		return NULL;
 	}
 	
-	project_t *project = (project_t*)helper;
-	commit_node_t *current_node = project->current_node;
-	int is_exist = 0;
-	
-	// Find the branch's root node from the branch table.
-	for (int branch_idx = 0; branch_idx < project->n_total_branch; branch_idx++) {
-		is_exist = strcmp(project->branch_table[branch_idx].branch_name, branch_name);
-		if (is_exist == 0) {
-			current_node = project->branch_table[branch_idx].branch_address;
+	commit_node_t *staging;
+	if (check_exist_branch(project, branch_name) != 0) {
+		if (parent == NULL) {
+			staging = commit_node_init();
+		}else {
+			staging = node_clone(project, parent);
+			staging->branch_name = (char *)malloc(sizeof(char) * BRANCH_NAME_LEN);
+			parent->n_next_commit++;
+			if (parent->n_next_commit == 1) {
+				parent->next = (commit_node_t **)malloc(sizeof(commit_node_t *) * parent->n_next_commit);
+			}else {
+				parent->next = (commit_node_t **)realloc(parent->next, sizeof(commit_node_t *) * parent->n_next_commit);
+			}
+			parent->next[parent->n_next_commit - 1] = staging;
 		}
+		strcpy(staging->branch_name, branch_name);
+		project->branch_table = grow_table(project, project->branch_table, project->n_total_branch, &project->branch_table_cap, sizeof(branch_table_t));
+		project->branch_table[project->n_total_branch].branch_name = staging->branch_name;
+		project->branch_table[project->n_total_branch].branch_address = staging;
+		project->n_total_branch++;
+		publish_snapshot(project);
+		return staging;
 	}
 	
-	// Set current node to the staging area of the branch.
-	while (current_node->commit_id != NULL) {
-		if (current_node->next[0] != NULL) {
-			current_node = current_node->next[0];
-		}
+	staging = import_staging(project, stagings, n_stagings, branch_index(project, branch_name));
+	if (has_parent == 0) {
+		parent = staging->prev;
 	}
-	
-	// Make it the active branch.
-	project->current_node = current_node;
-	
-    return 0;
+	if (staging->prev == parent && import_same_files(staging, parent)) {
+		return staging;
+	}
+	size_t n_files = (parent == NULL) ? 0 : parent->n_tracked_files;
+	tracked_file_t *files = (tracked_file_t *)malloc(sizeof(tracked_file_t) * (n_files + 1));
+	for (size_t file_idx = 0; file_idx < n_files; file_idx++) {
+		stored_file_share(&files[file_idx], &parent->tracked_files[file_idx]);
+	}
+	cleanup_files(staging->n_tracked_files, staging->tracked_files);
+	free(staging->tracked_files);
+	staging->tracked_files = files;
+	staging->n_tracked_files = n_files;
+	staging->prev = parent;
+	if (import_files->staging == staging) {
+		import_files->staging = NULL;
+	}
+	return staging;
 }
 
-char **list_branches(void *helper, int *n_branches) {
-	// If n_branches is NULL, return NULL
-	if (n_branches ==NULL) {
-		return NULL;
+// Add or replace a file of the staging area with content. Takes over content.
+static void import_put_file(import_files_t *files, char *file_name, unsigned char *content, size_t content_len) {
+	commit_node_t *staging = files->staging;
+	tracked_file_t *file = file_index_find(files->index, files->index_cap, staging->tracked_files, file_name);
+	if (file != NULL) {
+		content_release(file);
+		file->base = NULL;
+	}else {
+		staging->n_tracked_files++;
+		if (staging->n_tracked_files == 1) {
+			staging->tracked_files = (tracked_file_t *)malloc(sizeof(tracked_file_t) * staging->n_tracked_files);
+		}else {
+			staging->tracked_files = (tracked_file_t *)realloc(staging->tracked_files, sizeof(tracked_file_t) * staging->n_tracked_files);
+		}
+		file = &staging->tracked_files[staging->n_tracked_files - 1];
+		file->file_name = malloc(sizeof(char) * FILE_NAME_LEN);
+		strcpy(file->file_name, file_name);
+		file->content_state = CONTENT_HEAP;
+		file->spill_offset = -1;
+		file->lru_prev = NULL;
+		file->lru_next = NULL;
+		file->pins = 0;
+		file->base = NULL;
+		if (staging->n_tracked_files * 2 > files->index_cap) {
+			file_index_build(&files->index, &files->index_cap, staging->tracked_files, staging->n_tracked_files);
+		}else {
+			file_index_insert(files->index, files->index_cap, staging->tracked_files, staging->n_tracked_files - 1);
+		}
+		import_files_grow(files, staging->n_tracked_files);
 	}
+	size_t file_idx = file - staging->tracked_files;
+	files->flags[file_idx] &= ~IMPORT_REMOVED;
+	import_files_touch(files, file_idx);
+	content[content_len] = '\0';
+	file->content = content;
+	file->content_len = content_len;
 	
-	project_t *project = (project_t*)helper;
-	char **list_branches = NULL;
-	size_t total_branch = project->n_total_branch;
-	
-	int malloc_size = (sizeof(char*) * total_branch);
-	list_branches = malloc(malloc_size);
-	
-	for (int branch_idx = 0; branch_idx < total_branch; branch_idx++) {
-		char * branch_name = project->branch_table[branch_idx].branch_name;
-		printf("%s\n", branch_name);
-		list_branches[branch_idx] = branch_name;
+	// Calculate hash value of the file_path, then of the content, like hash_file().
+	unsigned int hash = 0;
+	for (const char *ptr = file_name; *ptr != '\0'; ptr++) {
+		hash += *ptr;
+		hash = (hash % 1000);
 	}
-	*n_branches = total_branch;
-	
-	return list_branches;
+	file->fingerprint = fingerprint_content(content, content_len, &hash);
+	file->hash = hash;
 }
 
-int svc_add(void *helper, char *file_name) {
-	// If file_name is NULL, return -1 and do not add it to version control.
-	if (file_name == NULL) {
-		return -1;
+static void import_remove_file(import_files_t *files, char *file_name) {
+	tracked_file_t *file = file_index_find(files->index, files->index_cap, files->staging->tracked_files, file_name);
+	if (file == NULL) {
+		return;
 	}
-	
-	project_t *project = (project_t*)helper;
-	commit_node_t *node = project->current_node;
+	size_t file_idx = file - files->staging->tracked_files;
+	files->flags[file_idx] |= IMPORT_REMOVED;
+	files->has_removed = 1;
+	import_files_touch(files, file_idx);
+}
 
-	// If a file with this name is already being tracked in the current branch, return -2.
-	if (node->tracked_files != NULL) {
-		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
-			int is_exist = strcmp(node->tracked_files[file_idx].file_name, file_name);
-			if (is_exist == 0) {
-				return -2;
-			}
+// Set the actions of the staging area for the files the commit touched, against its parent, then
+// drop the removed files.
+static void import_actions(import_files_t *files) {
+	commit_node_t *staging = files->staging;
+	commit_node_t *parent = staging->prev;
+	size_t n_parent_files = (parent == NULL) ? 0 : parent->n_tracked_files;
+	for (size_t touched_idx = 0; touched_idx < files->n_touched; touched_idx++) {
+		size_t file_idx = files->touched[touched_idx];
+		tracked_file_t *file = (files->flags[file_idx] & IMPORT_REMOVED) ? NULL : &staging->tracked_files[file_idx];
+		tracked_file_t *parent_file = (file_idx < n_parent_files) ? &parent->tracked_files[file_idx] : NULL;
+		if (files->has_removed == 0) {
+			files->flags[file_idx] = 0;
+		}
+		if (file == NULL && parent_file == NULL) {
+			continue;
+		}
+		if (file != NULL && parent_file != NULL && file->fingerprint == parent_file->fingerprint && file->hash == parent_file->hash) {
+			continue;
+		}
+		
+		staging->n_actions++;
+		if (staging->n_actions == 1) {
+			staging->actions = (action_info_t *)malloc(sizeof(action_info_t) * staging->n_actions);
+		}else {
+			staging->actions = (action_info_t *)realloc(staging->actions, sizeof(action_info_t) * staging->n_actions);
+		}
+		action_info_t *action = &staging->actions[staging->n_actions - 1];
+		if (file == NULL) {
+			action->action = ACTION_REMOVE;
+			action->file_name = parent_file->file_name;
+			action->hash = parent_file->hash;
+			action->old_hash = 0;
+		}else if (parent_file == NULL) {
+			action->action = ACTION_ADD;
+			action->file_name = file->file_name;
+			action->hash = file->hash;
+			action->old_hash = 0;
+		}else {
+			action->action = ACTION_MODIFY;
+			action->file_name = file->file_name;
+			action->hash = file->hash;
+			action->old_hash = parent_file->hash;
 		}
 	}
-	
-	// If this file does not exist, return -3.
-	FILE * fptr;	
-	fptr = fopen(file_name, "r");
-	if (fptr == NULL) {
-		return -3;
+	files->n_touched = 0;
+	if (files->has_removed == 0) {
+		return;
 	}
-	fclose(fptr);
 	
-	node->n_tracked_files++;
-	if (node->n_tracked_files == 1) {
-		node->tracked_files = (tracked_file_t*)malloc(sizeof(tracked_file_t) * node->n_tracked_files);
-	}else {
-		node->tracked_files = (tracked_file_t*)realloc(node->tracked_files, sizeof(tracked_file_t) * node->n_tracked_files);
+	// Keep the order of the other files, which the actions point into.
+	size_t n_kept = 0;
+	for (size_t file_idx = 0; file_idx < staging->n_tracked_files; file_idx++) {
+		if (files->flags[file_idx] & IMPORT_REMOVED) {
+			content_release(&staging->tracked_files[file_idx]);
+			free(staging->tracked_files[file_idx].file_name);
+		}else {
+			staging->tracked_files[n_kept++] = staging->tracked_files[file_idx];
+		}
+		files->flags[file_idx] = 0;
 	}
-	tracked_file_t *tracked_files = &node->tracked_files[node->n_tracked_files - 1];
-	tracked_files->file_name = malloc(sizeof(char) * FILE_NAME_LEN);
-	strcpy(tracked_files->file_name, file_name);
-	tracked_files->content = file_content_copy(file_name);
-	unsigned int hash = hash_file(helper, file_name);
-	tracked_files->hash = hash;
-	
-	return hash;
+	staging->n_tracked_files = n_kept;
+	file_index_build(&files->index, &files->index_cap, staging->tracked_files, staging->n_tracked_files);
+	files->has_removed = 0;
 }
 
-int svc_rm(void *helper, char *file_name) {
-	// If file_name is NULL, return -1.
-	if (file_name == NULL) {
+// Load a history from a stream in the format above, without touching the working tree. Files
+// are hashed from the stream's contents and commits are made in memory. The current branch
+// stays the current branch, but its staging area may move to the branch's new last commit.
+// Uncommitted changes of a branch the stream commits to are dropped. An import is not
+// journaled, so it is refused while a journal is open.
+// Return the number of commits made. If fd is negative or a journal is open, return -1. If the
+// stream is malformed or can not be read, return -2. The commits made before stay.
+int svc_import_stream(void *helper, int fd) {
+	TRACE_SCOPE("svc_import_stream", NULL, TRACE_NONE, TRACE_NONE);
+	project_t *project = (project_t*)helper;
+	commit_queue_wait(project);
+	if (fd < 0 || project->journal != NULL) {
 		return -1;
 	}
 	
-	project_t *project = (project_t*)helper;
-	commit_node_t *node = project->current_node;
+	import_reader_t reader = {fd, (unsigned char *)malloc(IMPORT_BUF_LEN), 0, 0, 0};
+	commit_node_t **marks = NULL;
+	size_t n_marks = 0;
+	size_t marks_cap = 0;
+	import_files_t files = {0};
+	commit_node_t **stagings = NULL;
+	size_t n_stagings = 0;
+	char *current_branch = project->current_node->branch_name;
+	int in_memory = project->in_memory;
+	project->in_memory = 1;
+	
+	int n_imported = 0;
+	int is_bad = 0;
+	// Branch of the commit being read, and its staging area once a command needs it.
+	char *commit_branch = NULL;
+	commit_node_t *staging = NULL;
+	commit_node_t *parent = NULL;
+	int has_from = 0;
+	char *message = NULL;
+	char *line;
+	while (is_bad == 0 && (line = import_line(&reader)) != NULL) {
+		if (commit_branch == NULL) {
+			if (strncmp(line, "commit ", 7) == 0) {
+				commit_branch = strdup(line + 7);
+				parent = NULL;
+				has_from = 0;
+			}else if (strncmp(line, "branch ", 7) == 0) {
+				char *branch_name = strdup(line + 7);
+				line = import_line(&reader);
+				is_bad = (line == NULL || strncmp(line, "from ", 5) != 0 || import_ref(project, line + 5, marks, n_marks, &parent) != 0 || import_place_branch(project, branch_name, parent, 1, &stagings, &n_stagings, &files) == NULL);
+				free(branch_name);
+			}else {
+				is_bad = 1;
+			}
+			continue;
+		}
+		if (strncmp(line, "from ", 5) == 0 && staging == NULL && has_from == 0) {
+			is_bad = (import_ref(project, line + 5, marks, n_marks, &parent) != 0);
+			has_from = 1;
+			continue;
+		}
 		
-	// If the file with the given name is not being tracked in the current branch and SVC is not tracking any files, return -2.
-	if (node->n_tracked_files == 0 && node->tracked_files == NULL) {
-		return -2;
-	}
-
-	// If the file with the given name is not being tracked in the current branch, return -2. 
-	if (node->tracked_files != NULL) {
-		int is_exist = -1;
-		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
-			is_exist = strcmp(node->tracked_files[file_idx].file_name, file_name);
-			if (is_exist == 0) {
-				break;
+		// The other commands of a commit work on its staging area.
+		if (staging == NULL) {
+			staging = import_place_branch(project, commit_branch, parent, has_from, &stagings, &n_stagings, &files);
+			if (staging == NULL) {
+				is_bad = 1;
+				continue;
 			}
+			import_files_use(&files, staging);
 		}
-		if (is_exist != 0) {
-			return -2;
+		size_t len;
+		char *rest;
+		if (strncmp(line, "message ", 8) == 0 && message == NULL && import_len(line + 8, &len, &rest) == 0 && *rest == '\0') {
+			message = (char *)malloc(len + 1);
+			is_bad = (import_bytes(&reader, (unsigned char *)message, len) != 0 || memchr(message, '\0', len) != NULL);
+			message[len] = '\0';
+		}else if (strncmp(line, "M ", 2) == 0 && import_len(line + 2, &len, &rest) == 0 && *rest != '\0' && strlen(rest) < FILE_NAME_LEN) {
+			// Reading the content may move the line.
+			char *path = strdup(rest);
+			unsigned char *content = (unsigned char *)malloc(len + 1);
+			is_bad = (import_bytes(&reader, content, len) != 0);
+			if (is_bad == 0) {
+				import_put_file(&files, path, content, len);
+			}else {
+				free(content);
+			}
+			free(path);
+		}else if (strncmp(line, "D ", 2) == 0 && line[2] != '\0' && strlen(line + 2) < FILE_NAME_LEN) {
+			import_remove_file(&files, line + 2);
+		}else if (strcmp(line, "end") == 0 && message != NULL) {
+			import_actions(&files);
+			commit_node_t *commit = staging->prev;
+			if (staging->n_actions > 0) {
+				project->current_node = staging;
+				project->head = staging->prev;
+				commit_staging(project, message, NULL, 0);
+				commit = project->head;
+				uint32_t branch_idx = branch_index(project, commit->branch_name);
+				import_staging(project, &stagings, &n_stagings, branch_idx);
+				stagings[branch_idx] = project->current_node;
+				// The new staging area has the commit's files in the same order.
+				files.staging = project->current_node;
+				n_imported++;
+			}
+			if (n_marks == marks_cap) {
+				marks_cap = (marks_cap == 0) ? 1024 : marks_cap * 2;
+				marks = (commit_node_t **)realloc(marks, sizeof(commit_node_t *) * marks_cap);
+			}
+			marks[n_marks++] = commit;
+			free(message);
+			message = NULL;
+			free(commit_branch);
+			commit_branch = NULL;
+			staging = NULL;
+		}else {
+			is_bad = 1;
 		}
 	}
-	
-	// Allocate memroy for temp array that holds copy of tracked files.
-	tracked_file_t *temp = (tracked_file_t*)malloc(sizeof(tracked_file_t) * node->n_tracked_files);
-	// Index of the file that will be removed.
-	int matched_file_index = -1;
-	// Keep the number of tracked files before removing the file.
-	int original_len = node->n_tracked_files;
-	unsigned int last_knwon_hash = 0;
-	
-	// Find index of the file that will be removed and keep its hash value.
-	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
-		matched_file_index = strcmp(node->tracked_files[file_idx].file_name, file_name);
-		if (matched_file_index == 0) {
-			matched_file_index = file_idx;
-			last_knwon_hash = node->tracked_files[file_idx].hash;
-			// Free file name.
-			free(node->tracked_files[file_idx].file_name);
-			// Free file content.
-			free(node->tracked_files[file_idx].content);
-			break;
-		}
+	if (reader.error != 0 || commit_branch != NULL) {
+		is_bad = 1;
 	}
 	
-	// Copy tracked files into the temp array.
-	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
-		memcpy(&temp[file_idx], &project->current_node->tracked_files[file_idx], sizeof(tracked_file_t));
+	// A commit that was cut short leaves its staging area as it was before.
+	if (staging != NULL) {
+		import_place_branch(project, staging->branch_name, staging->prev, 1, &stagings, &n_stagings, &files);
 	}
+	free(commit_branch);
+	free(stagings);
+	free(files.index);
+	free(files.flags);
+	free(files.touched);
+	free(message);
+	free(marks);
+	free(reader.buf);
+	
+	project->in_memory = in_memory;
+	project->current_node = branch_staging(project, branch_index(project, current_branch));
+	project->head = project->current_node->prev;
+	project->watch_overflow = 1;
+	trace_scope.files = n_imported;
+	
+	return is_bad ? -2 : n_imported;
+}
 
-	// Reallocate a new tracked files array.
-	node->n_tracked_files--;
-	node->tracked_files = (tracked_file_t*)realloc(node->tracked_files, sizeof(tracked_file_t) * node->n_tracked_files);	
-	int file_idx = 0;
+// Write the files that differ between a commit and its parent as M and D commands.
+static void export_changes(project_t *project, format_buf_t *out, commit_node_t *node) {
+	tracked_file_t **files = sorted_tracked_files(node);
+	tracked_file_t **parent_files = NULL;
+	size_t n_parent_files = 0;
+	if (node->prev != NULL) {
+		parent_files = sorted_tracked_files(node->prev);
+		n_parent_files = node->prev->n_tracked_files;
+	}
 	
-	// Copy temp array into the new tracked files array except the index of the file that will be removed.
-	if (node->n_tracked_files > 0) {
-		for (int temp_idx = 0; temp_idx < original_len; temp_idx++) {
-			if (temp_idx == matched_file_index) {
+	size_t file_idx = 0;
+	size_t parent_idx = 0;
+	while (file_idx < node->n_tracked_files || parent_idx < n_parent_files) {
+		int order;
+		if (file_idx == node->n_tracked_files) {
+			order = 1;
+		}else if (parent_idx == n_parent_files) {
+			order = -1;
+		}else {
+			order = strcmp(files[file_idx]->file_name, parent_files[parent_idx]->file_name);
+		}
+		
+		if (order > 0) {
+			format_str(out, "D ");
+			format_str(out, parent_files[parent_idx++]->file_name);
+			format_put(out, "\n", 1);
+			continue;
+		}
+		tracked_file_t *file = files[file_idx++];
+		if (order == 0) {
+			tracked_file_t *parent_file = parent_files[parent_idx++];
+			if (file->fingerprint == parent_file->fingerprint && file->hash == parent_file->hash) {
 				continue;
 			}
-			memcpy(&project->current_node->tracked_files[file_idx], &temp[temp_idx], sizeof(tracked_file_t));
-			file_idx++;
 		}
+		content_pin(project);
+		unsigned char *content = content_get(project, file);
+		size_t content_len = (content == NULL) ? 0 : file->content_len;
+		format_str(out, "M ");
+		format_int(out, content_len, 0);
+		format_put(out, " ", 1);
+		format_str(out, file->file_name);
+		format_put(out, "\n", 1);
+		format_put(out, (const char *)content, content_len);
+		format_put(out, "\n", 1);
+		content_unpin(project);
 	}
-	free(temp);
 	
-    return last_knwon_hash;
+	free(files);
+	free(parent_files);
 }
 
-int svc_reset(void *helper, char *commit_id) {
-	// If commit_id is NULL, return -1.
-	if (commit_id == NULL) {
-		return -1;
-	}
-	
-	commit_node_t *commit = get_commit(helper, commit_id);
-	
-	// If no commit with the given id exists, return -2. 
-	if (commit == NULL) {
-		return -2;
-	}
+// Write a commit as a mark of the stream, :0 for no commit.
+static void export_ref(project_t *project, format_buf_t *out, commit_node_t *node) {
+	format_put(out, ":", 1);
+	format_int(out, (node == NULL) ? 0 : (long)project_commit_idx(project, node) + 1, 0);
+}
 
+// Write the whole history as an import stream: every commit in commit order with the files
+// it changed against its parent, then where every branch continues from. Uncommitted changes
+// are not written. Return 0, or -1 if writing failed.
+int svc_export_stream(void *helper, int fd) {
+	TRACE_SCOPE("svc_export_stream", NULL, TRACE_NONE, TRACE_NONE);
 	project_t *project = (project_t*)helper;
-	project->current_node = commit;
+	commit_queue_wait(project);
+	commit_meta_t *meta = &project->commits;
+	format_buf_t out = {malloc(1 << 20), 0, 1 << 20, fd, 0, 0};
 	
-    return 0;
+	for (uint32_t commit_idx = 0; commit_idx < project->n_total_commit && out.error == 0; commit_idx++) {
+		commit_node_t *node = meta->nodes[commit_idx];
+		char *message = meta->messages + meta->message_offs[commit_idx];
+		format_str(&out, "commit ");
+		format_str(&out, node->branch_name);
+		format_str(&out, "\nfrom ");
+		export_ref(project, &out, node->prev);
+		format_str(&out, "\nmessage ");
+		format_int(&out, strlen(message), 0);
+		format_put(&out, "\n", 1);
+		format_str(&out, message);
+		format_put(&out, "\n", 1);
+		export_changes(project, &out, node);
+		format_str(&out, "end\n");
+	}
+	for (size_t branch_idx = 0; branch_idx < project->n_total_branch; branch_idx++) {
+		format_str(&out, "branch ");
+		format_str(&out, project->branch_table[branch_idx].branch_name);
+		format_str(&out, "\nfrom ");
+		export_ref(project, &out, branch_staging(project, branch_idx)->prev);
+		format_put(&out, "\n", 1);
+	}
+	trace_scope.bytes = out.total;
+	
+	format_flush(&out);
+	free(out.data);
+	return (out.error == 0) ? 0 : -1;
 }
 
 char *svc_merge(void *helper, char *branch_name, struct resolution *resolutions, int n_resolutions) {
+	TRACE_SCOPE("svc_merge", branch_name, TRACE_NONE, TRACE_NONE);
 	project_t *project = (project_t*)helper;
+	commit_queue_wait(project);
 	
 	if (branch_name == NULL) {
 		printf("Invalid branch name\n");
@@ -913,45 +7521,87 @@ char *svc_merge(void *helper, char *branch_name, struct resolution *resolutions,
     return NULL;
 }
 
-void dump_node(commit_node_t *node) {
+// Print the id and message of a node. A staging area has neither.
+static void dump_commit_header(project_t *project, commit_node_t *node) {
+	if (node->commit_seq == COMMIT_NONE) {
+		printf("Commit[(null)]: null\n");
+	}else {
+		commit_meta_t *meta = &project->commits;
+		uint32_t commit_idx = project_commit_idx(project, node);
+		printf("Commit[%s]: %s\n", commit_hex(meta, commit_idx), meta->messages + meta->message_offs[commit_idx]);
+	}
+}
+
+// Actions of a node: from the commit metadata once committed, the node's own before.
+static size_t dump_commit_actions(project_t *project, commit_node_t *node, action_info_t **actions) {
+	if (node->commit_seq == COMMIT_NONE) {
+		*actions = node->actions;
+		return node->n_actions;
+	}
+	uint32_t commit_idx = project_commit_idx(project, node);
+	*actions = &project->commits.actions[project->commits.action_starts[commit_idx]];
+	return project->commits.action_counts[commit_idx];
+}
+
+void dump_node(project_t *project, commit_node_t *node) {
 	if (node == NULL) {
 		return;
 	}
 
-	printf("Commit[%s]: %s\n", node->commit_id, node->message == NULL ? "null" : node->message);
-	printf("branch: %s\n", node->branch_name);
-	//printf("address: %p\n", node);
-	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
-		const tracked_file_t *file = &node->tracked_files[file_idx];
-		printf("	File[%d]: [Hash:%04u] %s\n", file_idx, file->hash, file->file_name);
-	}
+	// Walk the tree depth first with an explicit stack, long histories would overflow the call stack.
+	size_t n_stack = 1;
+	size_t stack_cap = 64;
+	commit_node_t **stack = (commit_node_t **)malloc(sizeof(commit_node_t *) * stack_cap);
+	stack[0] = node;
 	
+	while (n_stack > 0) {
+		node = stack[--n_stack];
+		
+		dump_commit_header(project, node);
+		action_info_t *actions = NULL;
+		size_t n_actions = dump_commit_actions(project, node, &actions);
+		printf("branch: %s\n", node->branch_name);
+		//printf("address: %p\n", node);
+		for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
+			const tracked_file_t *file = &node->tracked_files[file_idx];
+			printf("	File[%d]: [Hash:%04u] %s\n", file_idx, file->hash, file->file_name);
+		}
+		
+		
+		for (int action_idx = 0; action_idx < n_actions; action_idx++) {
+			const action_info_t *action_inf = &actions[action_idx];
+			char action_char = '+';
+			if (action_inf->action == ACTION_REMOVE) {
+				action_char = '-';
+			} else if (action_inf->action == ACTION_MODIFY) {
+				action_char = '/';
+			}
 	
-	for (int action_idx = 0; action_idx < node->n_actions; action_idx++) {
-		const action_info_t *action_inf = &node->actions[action_idx];
-		char action_char = '+';
-		if (action_inf->action == ACTION_REMOVE) {
-			action_char = '-';
-		} else if (action_inf->action == ACTION_MODIFY) {
-			action_char = '/';
+			printf("	Act[%d]: %c %s\n", action_idx, action_char, action_inf->file_name);
+		}
+		printf("\n");
+		
+		// Push the children in reverse so the first one is dumped first.
+		for (int next_idx = (int)node->n_next_commit - 1; next_idx >= 0; next_idx--) {
+			if (n_stack == stack_cap) {
+				stack_cap *= 2;
+				stack = (commit_node_t **)realloc(stack, sizeof(commit_node_t *) * stack_cap);
+			}
+			stack[n_stack++] = node->next[next_idx];
 		}
-
-		printf("	Act[%d]: %c %s\n", action_idx, action_char, action_inf->file_name);
 	}
-	printf("\n");
 	
-	for (int next_idx = 0; next_idx < node->n_next_commit; next_idx++) {
-		dump_node(node->next[next_idx]);
-	}
-
+	free(stack);
 }
 
-void dump_head(commit_node_t *node) {
+void dump_head(project_t *project, commit_node_t *node) {
 	if (node == NULL) {
 		return;
 	}
 
-	printf("Commit[%s]: %s\n", node->commit_id, node->message == NULL ? "null" : node->message);
+	dump_commit_header(project, node);
+	action_info_t *actions = NULL;
+	size_t n_actions = dump_commit_actions(project, node, &actions);
 	printf("branch: %s\n", node->branch_name);
 	
 	for (int file_idx = 0; file_idx < node->n_tracked_files; file_idx++) {
@@ -960,8 +7610,8 @@ void dump_head(commit_node_t *node) {
 	}
 	
 	
-	for (int action_idx = 0; action_idx < node->n_actions; action_idx++) {
-		const action_info_t *action_inf = &node->actions[action_idx];
+	for (int action_idx = 0; action_idx < n_actions; action_idx++) {
+		const action_info_t *action_inf = &actions[action_idx];
 		char action_char = '+';
 		if (action_inf->action == ACTION_REMOVE) {
 			action_char = '-';
@@ -977,15 +7627,18 @@ void dump_head(commit_node_t *node) {
 void dump(project_t *helper) {
 	printf("=====================================\n");
 	commit_node_t *node = ((project_t *)helper)->root_node;
-	dump_node(node);
+	dump_node(helper, node);
 	
 	//printf("HEAD:\n");
-	//dump_head(helper->head);
+	//dump_head(helper, helper->head);
 	
 	printf("\n");
 	
 }
 
+// Example run on the files of the working directory. Builds that link svc.c into another
+// program (the daemon, the tests) define SVC_NO_MAIN.
+#ifndef SVC_NO_MAIN
 int main(){
 	void *helper = svc_init();
 	project_t *project = helper;
@@ -1055,3 +7708,4 @@ int main(){
 	//free(prev_commit_ids);
 	cleanup(helper);
 }
+#endif
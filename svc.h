@@ -5,10 +5,37 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <linux/falloc.h>
 
 #define COMMIT_ID_LEN 7
 #define FILE_NAME_LEN 261
 #define BRANCH_NAME_LEN 51
+// Maximum number of dirty paths kept before falling back to a full scan.
+#define WATCH_DIRTY_MAX 4096
+// Maximum number of threads that can read the commit and branch tables at the same time.
+#define EPOCH_MAX_READERS 64
+// Size in 64 bit words of the per-commit Bloom filter over changed paths.
+#define PATH_BLOOM_WORDS 4
+// Commit index of the staging area, or "no commit" in the commit metadata.
+#define COMMIT_NONE UINT32_MAX
+// Number of hex commit ids per block of the id string arena.
+#define COMMIT_HEX_CHUNK 4096
 
 typedef struct resolution {
     // NOTE: DO NOT MODIFY THIS STRUCT
@@ -29,48 +56,375 @@ typedef struct action_info {
     unsigned int old_hash;
 }action_info_t;
 
+typedef enum content_state {
+    CONTENT_HEAP = 0,
+    CONTENT_SPILLED = 1,
+    CONTENT_MAPPED = 2
+}content_state_t;
+
 typedef struct tracked_file {
     char *file_name; 
     unsigned char *content;
+    size_t content_len;
     unsigned int hash;
+    uint64_t fingerprint;
+    content_state_t content_state;
+    off_t spill_offset;
+    struct tracked_file *lru_prev;
+    struct tracked_file *lru_next;
+    // Views from svc_read_file() on the content. A pinned content is kept off the LRU list.
+    unsigned int pins;
+    // The committed file whose content this one shares, or NULL if it holds its own. A shared
+    // content is only ever read through content_get().
+    struct tracked_file *base;
 }tracked_file_t;
 
 typedef struct commit_node {
     char *branch_name;
-    char *message;
-    char *commit_id;
+    // Sequence number of the commit, COMMIT_NONE while the node is a staging area. It never
+    // changes, node_commit_idx() finds the commit's position in a snapshot's metadata.
+    uint32_t commit_seq;
     tracked_file_t *tracked_files;
     size_t n_tracked_files;
     struct commit_node **next;
     size_t n_next_commit;
     struct commit_node *prev;
+    // Actions of the staging area. On commit they move into the commit metadata.
     action_info_t *actions;
     size_t n_actions;
 }commit_node_t;
 
-typedef struct commit_table{
-    char *commit_id;
-    commit_node_t *commit_address;
-}commit_table_t;
+// Commit metadata in commit order, one entry per commit in each of the parallel arrays.
+// Ids are kept as numbers and only formatted as hex at the API boundary.
+typedef struct commit_meta{
+    uint32_t *ids;
+    // Index of the previous commit, COMMIT_NONE for the first one.
+    uint32_t *parents;
+    // Index into the branch table.
+    uint32_t *branches;
+    // Offset of the null terminated message in the message arena.
+    uint32_t *message_offs;
+    // Range of the commit's actions in the action arena.
+    uint32_t *action_starts;
+    uint32_t *action_counts;
+    uint64_t *path_blooms;
+    commit_node_t **nodes;
+    // Sequence numbers of the commits, ascending. The same as the index until a squash.
+    uint32_t *seqs;
+    size_t cap;
+    char *messages;
+    size_t messages_len;
+    size_t messages_cap;
+    action_info_t *actions;
+    size_t n_actions;
+    size_t actions_cap;
+    // Hex ids handed out to callers by sequence number, in blocks that never move. hex_chunks[0]
+    // holds the block of sequence number hex_chunk_base * COMMIT_HEX_CHUNK, and a block that no
+    // commit uses any more is NULL, see squash_compact_meta().
+    char **hex_chunks;
+    size_t n_hex_chunks;
+    size_t hex_chunk_base;
+}commit_meta_t;
 
 typedef struct branch_table{
     char *branch_name;
     commit_node_t *branch_address;
 }branch_table_t;
 
+// Commits whose actions touched a path, in commit order.
+typedef struct path_log{
+    char *file_name;
+    uint32_t *commits;
+    size_t n_commits;
+    size_t commits_cap;
+}path_log_t;
+
+// Immutable view of the commit and branch tables published by the writer.
+typedef struct project_snapshot{
+    commit_meta_t commits;
+    size_t n_total_commit;
+    atomic_uint *commit_index;
+    size_t commit_index_cap;
+    branch_table_t *branch_table;
+    size_t n_total_branch;
+}project_snapshot_t;
+
+// File hash remembered together with the stat information it was computed for.
+typedef struct hash_cache_entry{
+    char *file_name;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    unsigned int hash;
+    uint64_t fingerprint;
+}hash_cache_entry_t;
+
+typedef struct retired_item{
+    void *ptr;
+    unsigned long epoch;
+}retired_item_t;
+
+typedef enum journal_op {
+    JOURNAL_OP_ADD = 1,
+    JOURNAL_OP_RM = 2,
+    JOURNAL_OP_COMMIT = 3,
+    JOURNAL_OP_BRANCH = 4,
+    JOURNAL_OP_CHECKOUT = 5,
+    JOURNAL_OP_RESET = 6,
+    JOURNAL_OP_CHERRY_PICK = 7,
+    JOURNAL_OP_REBASE = 8,
+    JOURNAL_OP_SQUASH = 9
+}journal_op_t;
+
+// Append-only log of the mutating operations. Records are appended to pending by the writer and
+// written with one fdatasync() per batch by the flusher thread.
+typedef struct journal{
+    int fd;
+    long window_us;
+    // Operations are not logged while paused, e.g. while the journal is replayed.
+    int paused;
+    pthread_t flusher;
+    int has_flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t synced;
+    unsigned char *pending;
+    size_t pending_len;
+    size_t pending_cap;
+    // The flusher's buffer, swapped with pending when a batch is taken.
+    unsigned char *spare;
+    size_t spare_cap;
+    size_t record_start;
+    unsigned long appended;
+    unsigned long durable;
+    int sync_requested;
+    int stop;
+    int error;
+}journal_t;
+
+// Called on the commit thread with the id of a queued commit, or NULL if nothing was committed.
+typedef void (*svc_commit_callback_t)(void *ctx, char *commit_id);
+
+typedef struct commit_job{
+    char *message;
+    svc_commit_callback_t callback;
+    void *ctx;
+    // Names of the files staged when the commit was queued, and the working directory their
+    // paths are relative to (NULL if the backend is not local).
+    char **file_names;
+    size_t n_files;
+    char *dir;
+}commit_job_t;
+
+// Commits queued by svc_commit_async(). One thread makes them in order.
+typedef struct commit_queue{
+    pthread_t thread;
+    // Held by the commit thread while it adds a commit, and by the calls that change the staging
+    // area without waiting for the queue.
+    pthread_mutex_t write_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    commit_job_t *jobs;
+    size_t n_jobs;
+    size_t next_job;
+    size_t jobs_cap;
+    int running;
+    int stop;
+}commit_queue_t;
+
+typedef enum svc_status_type {
+    STATUS_ADDED = 1,
+    STATUS_REMOVED = 2,
+    STATUS_MODIFIED = 3,
+    STATUS_DELETED = 4
+}svc_status_type_t;
+
+// A changed file reported by svc_status().
+typedef struct svc_status_entry{
+    char *file_name;
+    svc_status_type_t status;
+}svc_status_entry_t;
+
+// What svc_fsck() verifies.
+typedef enum svc_fsck_check {
+    FSCK_GRAPH = 1,
+    FSCK_IDS = 2,
+    FSCK_CONTENT = 4
+}svc_fsck_check_t;
+
+#define FSCK_ALL (FSCK_GRAPH | FSCK_IDS | FSCK_CONTENT)
+
+typedef enum svc_fsck_kind {
+    // The commit metadata, the commit id index or the node links disagree about a commit.
+    FSCK_BAD_LINK = 1,
+    // A branch does not lead to a staging area of its own.
+    FSCK_BAD_BRANCH = 2,
+    // An action does not agree with the files of its commit.
+    FSCK_BAD_ACTION = 3,
+    // The commit id is not the one computed from the message and the actions.
+    FSCK_BAD_ID = 4,
+    // A stored content does not match its hash or fingerprint.
+    FSCK_BAD_CONTENT = 5
+}svc_fsck_kind_t;
+
+// A problem found by svc_fsck().
+typedef struct svc_fsck_problem{
+    svc_fsck_kind_t kind;
+    // Id of the commit, empty for a branch problem.
+    char commit_id[COMMIT_ID_LEN];
+    // The file, or the branch for FSCK_BAD_BRANCH. NULL if the problem is about the whole commit.
+    char *name;
+}svc_fsck_problem_t;
+
+// Outcome of adding one file with svc_add_tree().
+typedef struct svc_add_result{
+    char *file_name;
+    // Hash of the file, like svc_add() returns, or a negative error code.
+    int status;
+}svc_add_result_t;
+
+// Read-only view of a stored file content, see svc_read_file().
+typedef struct svc_blob_view{
+    const unsigned char *data;
+    size_t len;
+    // The stored file that is pinned, for svc_release_file().
+    void *file;
+}svc_blob_view_t;
+
+// Receives the chunks of svc_read_file_chunks(). Return nonzero to stop.
+typedef int (*svc_chunk_callback_t)(void *ctx, const unsigned char *data, size_t len);
+
+// Kind of a directory entry reported by svc_fs_t.list.
+typedef enum svc_fs_type {
+    SVC_FS_FILE = 1,
+    SVC_FS_DIR = 2,
+    // Symbolic links and special files, they are not followed.
+    SVC_FS_OTHER = 3
+}svc_fs_type_t;
+
+// Receives the entries of a directory, without "." and "..".
+typedef void (*svc_fs_entry_callback_t)(void *arg, const char *name, svc_fs_type_t type);
+
+// Capabilities of a storage backend, in svc_fs_t.flags.
+// The paths are files of the local file system, relative to the current working directory,
+// so they can be watched with inotify and resolved to absolute paths.
+#define SVC_FS_LOCAL 0x1
+
+// Storage of the working tree, see svc_init_ex(). Paths are the ones given to the API, relative
+// to the working directory. Every function gets ctx as its first argument and may be called
+// from several threads at once. The journal and the spill file are always on the local disk.
+typedef struct svc_fs{
+    void *ctx;
+    // Like stat(2). Return 0, or -1 if nothing exists at the path.
+    int (*stat)(void *ctx, const char *path, struct stat *st);
+    // Open the file for reading, or if for_write is set create or truncate it, creating missing
+    // directories. Return a handle, or -1.
+    int (*open)(void *ctx, const char *path, int for_write);
+    // Like read(2) and write(2) on a handle, from and at the current position.
+    ssize_t (*read)(void *ctx, int handle, void *buf, size_t len);
+    ssize_t (*write)(void *ctx, int handle, const void *buf, size_t len);
+    int (*close)(void *ctx, int handle);
+    // Like unlink(2).
+    int (*unlink)(void *ctx, const char *path);
+    // Call entry for each entry of the directory. Return 0, or -1 if it can not be read.
+    int (*list)(void *ctx, const char *dir, svc_fs_entry_callback_t entry, void *arg);
+    // SVC_FS_* capabilities, 0 if the backend has none.
+    unsigned int flags;
+}svc_fs_t;
+
+// A watched directory as tracked paths spell it. Tracked paths keep the spelling they were added
+// with, so "d/" and "./d/" are two entries for one directory, chained by its wd.
+typedef struct watch_dir{
+    int wd;
+    // Prefix of the tracked paths up to and including the last slash, "" for the working directory.
+    char *dir_name;
+    // Next entry with the same wd, or -1.
+    int next_same_wd;
+}watch_dir_t;
+
 typedef struct project {
     commit_node_t *current_node;
     commit_node_t *head;
     commit_node_t *root_node;
-    commit_table_t *commit_table;
+    commit_meta_t commits;
     size_t n_total_commit;
+    atomic_uint *commit_index;
+    size_t commit_index_cap;
     branch_table_t *branch_table;
     size_t n_total_branch;
+    size_t branch_table_cap;
+    _Atomic(project_snapshot_t *) snapshot;
+    atomic_ulong global_epoch;
+    atomic_ulong reader_epoch[EPOCH_MAX_READERS];
+    retired_item_t *retired;
+    size_t n_retired;
+    path_log_t *path_logs;
+    size_t n_path_logs;
+    size_t path_logs_cap;
+    size_t memory_budget;
+    size_t resident_bytes;
+    int content_pins;
+    // Views from svc_read_file() that are still held, over all files.
+    int n_file_pins;
+    int spill_fd;
+    off_t spill_end;
+    tracked_file_t *lru_head;
+    tracked_file_t *lru_tail;
+    hash_cache_entry_t *hash_cache;
+    size_t n_hash_cache;
+    size_t hash_cache_cap;
+    int watch_fd;
+    watch_dir_t *watch_dirs;
+    size_t n_watch_dirs;
+    // Indexes of watch_dirs by wd (first entry only) and by dir_name, both at most half full.
+    // Slots hold the entry index plus one.
+    size_t *watch_wd_index;
+    size_t *watch_name_index;
+    size_t watch_index_cap;
+    char **dirty_files;
+    size_t n_dirty_files;
+    // Set over dirty_files, slots hold the dirty file index plus one.
+    size_t *dirty_index;
+    size_t dirty_index_cap;
+    int watch_overflow;
+    // Path indexes of the staging area and the head files, and the number of staged files that
+    // are not in the head with the same content. See staging_sync().
+    size_t *staging_index;
+    size_t staging_index_cap;
+    size_t *head_index;
+    size_t head_index_cap;
+    size_t n_staging_changed;
+    // What the indexes were built for. staging_invalidate() forces a rebuild.
+    int staging_synced;
+    commit_node_t *synced_node;
+    commit_node_t *synced_head;
+    tracked_file_t *synced_files;
+    size_t synced_n_files;
+    journal_t *journal;
+    // Set while commits are built from stored contents and hashes only. The working tree is not read.
+    int in_memory;
+    commit_queue_t *commit_queue;
+    // Names of files of squashed commits that actions of retained commits still point to.
+    char **squash_names;
+    size_t n_squash_names;
+    // Working tree storage, copied from svc_init_ex().
+    svc_fs_t fs;
 }project_t;
 
 
 void *svc_init(void);
 
+void *svc_init_ex(const svc_fs_t *fs);
+
+const svc_fs_t *svc_fs_posix(void);
+
+svc_fs_t *svc_fs_memory_create(void);
+
+void svc_fs_memory_free(svc_fs_t *fs);
+
 void cleanup(void *helper);
 
 int hash_file(void *helper, char *file_path);
@@ -83,12 +437,22 @@ char **get_prev_commits(void *helper, void *commit, int *n_prev);
 
 void print_commit(void *helper, char *commit_id);
 
+void fprint_commit(void *helper, char *commit_id, FILE *stream);
+
+size_t svc_format_commit(void *helper, char *commit_id, char *buf, size_t buf_len);
+
+int svc_print_commit_fd(void *helper, char *commit_id, int fd);
+
+int svc_export_log(void *helper, int fd);
+
 int svc_branch(void *helper, char *branch_name);
 
 int svc_checkout(void *helper, char *branch_name);
 
 char **list_branches(void *helper, int *n_branches);
 
+char **svc_list_branches(void *helper, int *n_branches);
+
 int svc_add(void *helper, char *file_name);
 
 int svc_rm(void *helper, char *file_name);
@@ -97,4 +461,46 @@ int svc_reset(void *helper, char *commit_id);
 
 char *svc_merge(void *helper, char *branch_name, resolution *resolutions, int n_resolutions);
 
+int svc_watch(void *helper, int enable);
+
+char **svc_path_log(void *helper, void *commit, char *path, int *n_commits);
+
+int svc_diff(void *helper, char *from_id, char *to_id, int fd);
+
+int svc_set_memory_budget(void *helper, size_t budget, char *spill_dir);
+
+int svc_archive(void *helper, char *commit_id, int fd);
+
+int svc_journal_open(void *helper, char *path, long window_us);
+
+int svc_journal_sync(void *helper);
+
+svc_add_result_t *svc_add_tree(void *helper, char *dir, char **filter, int *n_results);
+
+int svc_status(void *helper, svc_status_entry_t **out, int *n_out);
+
+char *svc_cherry_pick(void *helper, char *commit_id);
+
+int svc_rebase(void *helper, char *onto_branch);
+
+int svc_commit_async(void *helper, char *message, svc_commit_callback_t callback, void *ctx);
+
+int svc_fsck(void *helper, int checks, svc_fsck_problem_t **out, int *n_out);
+
+int svc_read_file(void *helper, char *commit_id, char *path, svc_blob_view_t *view);
+
+void svc_release_file(void *helper, svc_blob_view_t *view);
+
+int svc_read_file_chunks(void *helper, char *commit_id, char *path, size_t chunk_len, svc_chunk_callback_t callback, void *ctx);
+
+int svc_squash_before(void *helper, char *commit_id);
+
+int svc_import_stream(void *helper, int fd);
+
+int svc_export_stream(void *helper, int fd);
+
+int svc_trace_start(size_t ring_events);
+
+int svc_trace_stop(int fd);
+
 #endif
@@ -0,0 +1,551 @@
+// For accept4().
+#define _GNU_SOURCE
+#include "svcd.h"
+
+// Project kept resident by the daemon, together with the directory its paths are relative to.
+typedef struct svcd_repo {
+	void *helper;
+	int dir_fd;
+}svcd_repo_t;
+
+typedef struct svcd_conn {
+	int fd;
+	unsigned char *in;
+	size_t in_len;
+	size_t in_cap;
+	unsigned char *out;
+	size_t out_len;
+	size_t out_cap;
+	size_t out_off;
+}svcd_conn_t;
+
+// Make sure the buffer can hold `need` bytes.
+static unsigned char *buf_reserve(unsigned char *buf, size_t *cap, size_t need) {
+	if (need <= *cap) {
+		return buf;
+	}
+
+	size_t new_cap = (*cap == 0) ? 4096 : *cap;
+	while (new_cap < need) {
+		new_cap *= 2;
+	}
+	*cap = new_cap;
+
+	return (unsigned char *)realloc(buf, new_cap);
+}
+
+// Write the whole buffer to a blocking descriptor.
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n_written = write(fd, buf, len);
+		if (n_written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n_written;
+		len -= n_written;
+	}
+	return 0;
+}
+
+// Read exactly `len` bytes from a blocking descriptor.
+static int read_all(int fd, unsigned char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n_read = read(fd, buf, len);
+		if (n_read == 0) {
+			return -1;
+		}
+		if (n_read < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n_read;
+		len -= n_read;
+	}
+	return 0;
+}
+
+// Append one length-prefixed string to a frame under construction.
+static void put_item(unsigned char **buf, size_t *len, size_t *cap, const char *item) {
+	uint32_t item_len = (item == NULL) ? SVCD_NULL_ARG : (uint32_t)strlen(item);
+	size_t data_len = (item == NULL) ? 0 : item_len;
+
+	*buf = buf_reserve(*buf, cap, *len + sizeof(uint32_t) + data_len);
+	memcpy(*buf + *len, &item_len, sizeof(uint32_t));
+	memcpy(*buf + *len + sizeof(uint32_t), item, data_len);
+	*len += sizeof(uint32_t) + data_len;
+}
+
+// Start a response frame in the connection's output buffer and return its offset.
+static size_t begin_response(svcd_conn_t *conn) {
+	size_t frame_off = conn->out_len;
+	conn->out = buf_reserve(conn->out, &conn->out_cap, conn->out_len + SVCD_HEADER_LEN);
+	conn->out_len += SVCD_HEADER_LEN;
+	return frame_off;
+}
+
+// Fill in the header of the response frame started at `frame_off`.
+static void end_response(svcd_conn_t *conn, size_t frame_off, int status, uint32_t seq) {
+	svcd_response_header_t header;
+	header.len = conn->out_len - frame_off - SVCD_HEADER_LEN;
+	header.status = status;
+	header.seq = seq;
+	memcpy(conn->out + frame_off, &header, SVCD_HEADER_LEN);
+}
+
+// Run one request against the resident repositories and append its response.
+// Return 1 if the daemon was asked to shut down.
+static int dispatch(svcd_repo_t *repos, svcd_conn_t *conn, svcd_request_header_t *header, char **args, int n_args) {
+	size_t frame_off = begin_response(conn);
+	int status = SVCD_ERR_REQUEST;
+	char *arg = (n_args > 0) ? args[0] : NULL;
+
+	if (header->op == SVCD_OP_INIT) {
+		for (int repo_idx = 0; repo_idx < SVCD_MAX_REPOS; repo_idx++) {
+			if (repos[repo_idx].helper != NULL) {
+				continue;
+			}
+			int dir_fd = open(arg == NULL ? "." : arg, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (dir_fd >= 0) {
+				repos[repo_idx].helper = svc_init();
+				repos[repo_idx].dir_fd = dir_fd;
+				status = repo_idx;
+			}
+			break;
+		}
+		end_response(conn, frame_off, status, header->seq);
+		return 0;
+	}
+
+	if (header->op == SVCD_OP_SHUTDOWN) {
+		end_response(conn, frame_off, 0, header->seq);
+		return 1;
+	}
+
+	// Paths in requests are relative to the directory the project was opened in.
+	if (header->repo >= SVCD_MAX_REPOS || repos[header->repo].helper == NULL || fchdir(repos[header->repo].dir_fd) != 0) {
+		end_response(conn, frame_off, SVCD_ERR_REQUEST, header->seq);
+		return 0;
+	}
+
+	void *helper = repos[header->repo].helper;
+
+	if (header->op == SVCD_OP_CLEANUP) {
+		cleanup(helper);
+		close(repos[header->repo].dir_fd);
+		repos[header->repo].helper = NULL;
+		status = 0;
+	}else if (header->op == SVCD_OP_HASH_FILE) {
+		status = hash_file(helper, arg);
+	}else if (header->op == SVCD_OP_COMMIT) {
+		char *commit_id = svc_commit(helper, arg);
+		status = (commit_id == NULL) ? -1 : 0;
+		if (commit_id != NULL) {
+			put_item(&conn->out, &conn->out_len, &conn->out_cap, commit_id);
+		}
+	}else if (header->op == SVCD_OP_GET_COMMIT) {
+		status = (get_commit(helper, arg) == NULL) ? -1 : 0;
+	}else if (header->op == SVCD_OP_PREV_COMMITS) {
+		int n_prev = 0;
+		char **prev_commits = get_prev_commits(helper, get_commit(helper, arg), &n_prev);
+		for (int prev_idx = 0; prev_idx < n_prev; prev_idx++) {
+			put_item(&conn->out, &conn->out_len, &conn->out_cap, prev_commits[prev_idx]);
+		}
+		free(prev_commits);
+		status = n_prev;
+	}else if (header->op == SVCD_OP_PRINT_COMMIT) {
+		char data[8192];
+		char *text = data;
+		size_t text_len = svc_format_commit(helper, arg, data, sizeof(data));
+		if (text_len >= sizeof(data)) {
+			text = (char *)malloc(text_len + 1);
+			svc_format_commit(helper, arg, text, text_len + 1);
+		}
+		put_item(&conn->out, &conn->out_len, &conn->out_cap, text);
+		if (text != data) {
+			free(text);
+		}
+		status = 0;
+	}else if (header->op == SVCD_OP_BRANCH) {
+		status = svc_branch(helper, arg);
+	}else if (header->op == SVCD_OP_CHECKOUT) {
+		status = svc_checkout(helper, arg);
+	}else if (header->op == SVCD_OP_LIST_BRANCHES) {
+		int n_branches = 0;
+		char **branch_names = svc_list_branches(helper, &n_branches);
+		for (int branch_idx = 0; branch_idx < n_branches; branch_idx++) {
+			put_item(&conn->out, &conn->out_len, &conn->out_cap, branch_names[branch_idx]);
+		}
+		free(branch_names);
+		status = n_branches;
+	}else if (header->op == SVCD_OP_ADD) {
+		status = svc_add(helper, arg);
+	}else if (header->op == SVCD_OP_RM) {
+		status = svc_rm(helper, arg);
+	}else if (header->op == SVCD_OP_RESET) {
+		status = svc_reset(helper, arg);
+	}else if (header->op == SVCD_OP_MERGE) {
+		// Arguments after the branch name are (file_name, resolved_file) pairs.
+		int n_resolutions = (n_args - 1) / 2;
+		resolution *resolutions = (resolution *)malloc(sizeof(resolution) * (n_resolutions + 1));
+		for (int res_idx = 0; res_idx < n_resolutions; res_idx++) {
+			resolutions[res_idx].file_name = args[1 + res_idx * 2];
+			resolutions[res_idx].resolved_file = args[2 + res_idx * 2];
+		}
+		char *commit_id = svc_merge(helper, arg, resolutions, n_resolutions);
+		status = (commit_id == NULL) ? -1 : 0;
+		if (commit_id != NULL) {
+			put_item(&conn->out, &conn->out_len, &conn->out_cap, commit_id);
+		}
+		free(resolutions);
+	}
+
+	end_response(conn, frame_off, status, header->seq);
+	return 0;
+}
+
+// Run every complete request in the connection's input buffer, in order.
+// Return -1 on a malformed frame, 1 if the daemon was asked to shut down, 0 otherwise.
+static int process_input(svcd_repo_t *repos, svcd_conn_t *conn) {
+	size_t pos = 0;
+	int result = 0;
+
+	while (result == 0 && conn->in_len - pos >= SVCD_HEADER_LEN) {
+		svcd_request_header_t header;
+		memcpy(&header, conn->in + pos, SVCD_HEADER_LEN);
+		if (header.len > SVCD_MAX_FRAME) {
+			return -1;
+		}
+		// Wait for the rest of the frame.
+		if (conn->in_len - pos - SVCD_HEADER_LEN < header.len) {
+			break;
+		}
+
+		unsigned char *payload = conn->in + pos + SVCD_HEADER_LEN;
+		char *args[SVCD_MAX_ARGS];
+		int n_args = 0;
+		size_t arg_pos = 0;
+		int is_malformed = 0;
+
+		while (arg_pos < header.len) {
+			uint32_t arg_len;
+			if (n_args == SVCD_MAX_ARGS || header.len - arg_pos < sizeof(uint32_t)) {
+				is_malformed = 1;
+				break;
+			}
+			memcpy(&arg_len, payload + arg_pos, sizeof(uint32_t));
+			arg_pos += sizeof(uint32_t);
+			if (arg_len == SVCD_NULL_ARG) {
+				args[n_args++] = NULL;
+				continue;
+			}
+			if (header.len - arg_pos < arg_len) {
+				is_malformed = 1;
+				break;
+			}
+			args[n_args++] = strndup((char *)payload + arg_pos, arg_len);
+			arg_pos += arg_len;
+		}
+
+		if (is_malformed == 1) {
+			size_t frame_off = begin_response(conn);
+			end_response(conn, frame_off, SVCD_ERR_REQUEST, header.seq);
+		}else {
+			result = dispatch(repos, conn, &header, args, n_args);
+		}
+
+		for (int arg_idx = 0; arg_idx < n_args; arg_idx++) {
+			free(args[arg_idx]);
+		}
+		pos += SVCD_HEADER_LEN + header.len;
+	}
+
+	// Keep the partial frame at the front of the buffer.
+	memmove(conn->in, conn->in + pos, conn->in_len - pos);
+	conn->in_len -= pos;
+
+	return result;
+}
+
+// Send as much of the pending output as the socket takes. Return -1 if the peer is gone.
+static int flush_output(svcd_conn_t *conn) {
+	while (conn->out_off < conn->out_len) {
+		ssize_t n_written = write(conn->fd, conn->out + conn->out_off, conn->out_len - conn->out_off);
+		if (n_written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		conn->out_off += n_written;
+	}
+	conn->out_off = 0;
+	conn->out_len = 0;
+	return 0;
+}
+
+static void close_conn(svcd_conn_t *conn) {
+	close(conn->fd);
+	free(conn->in);
+	free(conn->out);
+	memset(conn, 0, sizeof(svcd_conn_t));
+	conn->fd = -1;
+}
+
+// Serve the SVC API on a Unix domain socket until a client sends SVCD_OP_SHUTDOWN.
+// Projects stay resident between requests, so their hash caches stay warm.
+// Return 0 on a clean shutdown, -1 if the socket could not be set up.
+int svcd_serve(const char *socket_path) {
+	if (socket_path == NULL || strlen(socket_path) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+		return -1;
+	}
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (listen_fd < 0) {
+		return -1;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	unlink(socket_path);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0) {
+		close(listen_fd);
+		return -1;
+	}
+
+	svcd_repo_t repos[SVCD_MAX_REPOS];
+	memset(repos, 0, sizeof(repos));
+	svcd_conn_t conns[SVCD_MAX_CLIENTS];
+	memset(conns, 0, sizeof(conns));
+	for (int conn_idx = 0; conn_idx < SVCD_MAX_CLIENTS; conn_idx++) {
+		conns[conn_idx].fd = -1;
+	}
+	struct pollfd pfds[SVCD_MAX_CLIENTS + 1];
+	int is_running = 1;
+
+	while (is_running == 1) {
+		pfds[0].fd = listen_fd;
+		pfds[0].events = POLLIN;
+		for (int conn_idx = 0; conn_idx < SVCD_MAX_CLIENTS; conn_idx++) {
+			pfds[conn_idx + 1].fd = conns[conn_idx].fd;
+			pfds[conn_idx + 1].events = POLLIN | (conns[conn_idx].out_len > 0 ? POLLOUT : 0);
+			pfds[conn_idx + 1].revents = 0;
+		}
+
+		if (poll(pfds, SVCD_MAX_CLIENTS + 1, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (client_fd >= 0) {
+				int conn_idx = 0;
+				while (conn_idx < SVCD_MAX_CLIENTS && conns[conn_idx].fd >= 0) {
+					conn_idx++;
+				}
+				if (conn_idx == SVCD_MAX_CLIENTS) {
+					close(client_fd);
+				}else {
+					conns[conn_idx].fd = client_fd;
+				}
+			}
+		}
+
+		for (int conn_idx = 0; conn_idx < SVCD_MAX_CLIENTS && is_running == 1; conn_idx++) {
+			svcd_conn_t *conn = &conns[conn_idx];
+			short revents = pfds[conn_idx + 1].revents;
+			if (conn->fd < 0 || revents == 0) {
+				continue;
+			}
+
+			if (revents & (POLLIN | POLLHUP | POLLERR)) {
+				conn->in = buf_reserve(conn->in, &conn->in_cap, conn->in_len + 65536);
+				ssize_t n_read = read(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len);
+				if (n_read == 0 || (n_read < 0 && errno != EAGAIN && errno != EINTR)) {
+					close_conn(conn);
+					continue;
+				}
+				if (n_read > 0) {
+					conn->in_len += n_read;
+					// Every pipelined request that arrived is answered before the next poll.
+					int result = process_input(repos, conn);
+					if (result < 0) {
+						close_conn(conn);
+						continue;
+					}
+					if (result == 1) {
+						is_running = 0;
+					}
+				}
+			}
+
+			if (flush_output(conn) < 0) {
+				close_conn(conn);
+			}
+		}
+	}
+
+	for (int conn_idx = 0; conn_idx < SVCD_MAX_CLIENTS; conn_idx++) {
+		if (conns[conn_idx].fd >= 0) {
+			// Let the client that asked for the shutdown see its answer.
+			fcntl(conns[conn_idx].fd, F_SETFL, 0);
+			flush_output(&conns[conn_idx]);
+			close_conn(&conns[conn_idx]);
+		}
+	}
+	for (int repo_idx = 0; repo_idx < SVCD_MAX_REPOS; repo_idx++) {
+		if (repos[repo_idx].helper != NULL) {
+			cleanup(repos[repo_idx].helper);
+			close(repos[repo_idx].dir_fd);
+		}
+	}
+	close(listen_fd);
+	unlink(socket_path);
+
+	return 0;
+}
+
+svcd_client_t *svcd_connect(const char *socket_path) {
+	if (socket_path == NULL || strlen(socket_path) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+		return NULL;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	svcd_client_t *client = (svcd_client_t *)malloc(sizeof(svcd_client_t));
+	client->fd = fd;
+	client->next_seq = 1;
+	client->buf = NULL;
+	client->buf_cap = 0;
+	client->items = NULL;
+	client->items_cap = 0;
+	return client;
+}
+
+void svcd_close(svcd_client_t *client) {
+	if (client == NULL) {
+		return;
+	}
+	close(client->fd);
+	free(client->buf);
+	free(client->items);
+	free(client);
+}
+
+// Queue a request without waiting for the answer. Several requests may be sent before their
+// responses are read, they are answered in order. Return the request's sequence number, or -1.
+int svcd_send(svcd_client_t *client, svcd_op_t op, int repo, int n_args, char **args) {
+	if (client == NULL || n_args < 0 || n_args > SVCD_MAX_ARGS) {
+		return -1;
+	}
+
+	unsigned char *frame = NULL;
+	size_t frame_len = SVCD_HEADER_LEN;
+	size_t frame_cap = 0;
+	frame = buf_reserve(frame, &frame_cap, frame_len);
+	for (int arg_idx = 0; arg_idx < n_args; arg_idx++) {
+		put_item(&frame, &frame_len, &frame_cap, args[arg_idx]);
+	}
+
+	svcd_request_header_t header;
+	header.len = frame_len - SVCD_HEADER_LEN;
+	header.op = op;
+	header.repo = repo;
+	header.seq = client->next_seq++;
+	memcpy(frame, &header, SVCD_HEADER_LEN);
+
+	int result = write_all(client->fd, frame, frame_len);
+	free(frame);
+
+	return (result == 0) ? (int)header.seq : -1;
+}
+
+// Read the next response. Return 0, or -1 if the connection failed.
+int svcd_recv(svcd_client_t *client, svcd_response_t *response) {
+	if (client == NULL || response == NULL) {
+		return -1;
+	}
+
+	svcd_response_header_t header;
+	if (read_all(client->fd, (unsigned char *)&header, SVCD_HEADER_LEN) != 0 || header.len > SVCD_MAX_FRAME) {
+		return -1;
+	}
+	client->buf = buf_reserve(client->buf, &client->buf_cap, header.len + 1);
+	if (read_all(client->fd, client->buf, header.len) != 0) {
+		return -1;
+	}
+
+	response->status = header.status;
+	response->seq = header.seq;
+	response->n_items = 0;
+
+	// Each string is moved over its own length prefix so it can be terminated in place.
+	size_t pos = 0;
+	while (header.len - pos >= sizeof(uint32_t)) {
+		uint32_t item_len;
+		memcpy(&item_len, client->buf + pos, sizeof(uint32_t));
+		if (item_len == SVCD_NULL_ARG) {
+			item_len = 0;
+		}
+		if (header.len - pos - sizeof(uint32_t) < item_len) {
+			return -1;
+		}
+		memmove(client->buf + pos, client->buf + pos + sizeof(uint32_t), item_len);
+		client->buf[pos + item_len] = '\0';
+
+		if (response->n_items == client->items_cap) {
+			client->items_cap = (client->items_cap == 0) ? 16 : client->items_cap * 2;
+			client->items = (char **)realloc(client->items, sizeof(char *) * client->items_cap);
+		}
+		client->items[response->n_items++] = (char *)client->buf + pos;
+		pos += sizeof(uint32_t) + item_len;
+	}
+	response->items = client->items;
+
+	return 0;
+}
+
+// Send one request and wait for its response.
+int svcd_call(svcd_client_t *client, svcd_op_t op, int repo, int n_args, char **args, svcd_response_t *response) {
+	if (svcd_send(client, op, repo, n_args, args) < 0) {
+		return -1;
+	}
+	return svcd_recv(client, response);
+}
+
+// Standalone daemon: svcd <socket path>. Programs that embed the daemon or only use the
+// client define SVCD_NO_MAIN.
+#ifndef SVCD_NO_MAIN
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <socket path>\n", argv[0]);
+		return 2;
+	}
+	if (svcd_serve(argv[1]) != 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,84 @@
+#ifndef svcd_h
+#define svcd_h
+
+#include "svc.h"
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Frames on the socket are a fixed header followed by `len` bytes of payload.
+// Request payload: arguments, each as a 4 byte length followed by the bytes.
+// Response payload: result strings, encoded the same way.
+// Every integer is in host byte order, the socket is local only.
+#define SVCD_HEADER_LEN 12
+#define SVCD_MAX_FRAME (16 * 1024 * 1024)
+#define SVCD_MAX_ARGS 64
+#define SVCD_MAX_REPOS 64
+#define SVCD_MAX_CLIENTS 256
+// Argument length that stands for a NULL pointer.
+#define SVCD_NULL_ARG 0xFFFFFFFFu
+// Status of a response to a request the daemon could not run (unknown op, bad repo, malformed frame).
+#define SVCD_ERR_REQUEST -100
+
+typedef enum svcd_op {
+    SVCD_OP_INIT = 1,
+    SVCD_OP_CLEANUP = 2,
+    SVCD_OP_HASH_FILE = 3,
+    SVCD_OP_COMMIT = 4,
+    SVCD_OP_GET_COMMIT = 5,
+    SVCD_OP_PREV_COMMITS = 6,
+    SVCD_OP_PRINT_COMMIT = 7,
+    SVCD_OP_BRANCH = 8,
+    SVCD_OP_CHECKOUT = 9,
+    SVCD_OP_LIST_BRANCHES = 10,
+    SVCD_OP_ADD = 11,
+    SVCD_OP_RM = 12,
+    SVCD_OP_RESET = 13,
+    SVCD_OP_MERGE = 14,
+    SVCD_OP_SHUTDOWN = 15
+}svcd_op_t;
+
+typedef struct svcd_request_header {
+    uint32_t len;
+    uint16_t op;
+    uint16_t repo;
+    uint32_t seq;
+}svcd_request_header_t;
+
+typedef struct svcd_response_header {
+    uint32_t len;
+    int32_t status;
+    uint32_t seq;
+}svcd_response_header_t;
+
+typedef struct svcd_response {
+    int status;
+    uint32_t seq;
+    // Result strings. They point into the client's buffer and stay valid until the next svcd_recv().
+    char **items;
+    int n_items;
+}svcd_response_t;
+
+typedef struct svcd_client {
+    int fd;
+    uint32_t next_seq;
+    unsigned char *buf;
+    size_t buf_cap;
+    char **items;
+    size_t items_cap;
+}svcd_client_t;
+
+int svcd_serve(const char *socket_path);
+
+svcd_client_t *svcd_connect(const char *socket_path);
+
+void svcd_close(svcd_client_t *client);
+
+int svcd_send(svcd_client_t *client, svcd_op_t op, int repo, int n_args, char **args);
+
+int svcd_recv(svcd_client_t *client, svcd_response_t *response);
+
+int svcd_call(svcd_client_t *client, svcd_op_t op, int repo, int n_args, char **args, svcd_response_t *response);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef svc_test_h
+#define svc_test_h
+
+// Helpers shared by the tests. Every test is its own program that runs in a fresh temporary
+// directory and exits with 1 if a check failed.
+#include "../svc.h"
+
+static int test_failed;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		test_failed = 1; \
+	} \
+} while (0)
+
+// Move into a new empty directory, so relative paths in the tests do not touch the source tree.
+static inline void test_enter_tmp_dir(void) {
+	char dir_name[] = "/tmp/svc_test_XXXXXX";
+	if (mkdtemp(dir_name) == NULL || chdir(dir_name) != 0) {
+		perror("test directory");
+		exit(1);
+	}
+}
+
+static inline void test_write_file(const char *file_name, const char *content) {
+	FILE *fptr = fopen(file_name, "w");
+	if (fptr == NULL) {
+		perror(file_name);
+		exit(1);
+	}
+	fputs(content, fptr);
+	fclose(fptr);
+}
+
+// Read a whole file into a new null-terminated string, or return NULL if it can not be opened.
+static inline char *test_read_file(const char *file_name) {
+	FILE *fptr = fopen(file_name, "r");
+	if (fptr == NULL) {
+		return NULL;
+	}
+	fseek(fptr, 0, SEEK_END);
+	long len = ftell(fptr);
+	fseek(fptr, 0, SEEK_SET);
+	char *content = (char *)malloc(len + 1);
+	content[fread(content, 1, len, fptr)] = '\0';
+	fclose(fptr);
+	return content;
+}
+
+static inline int test_finish(const char *name) {
+	printf("%s: %s\n", name, (test_failed == 1) ? "FAILED" : "ok");
+	return test_failed;
+}
+
+#endif
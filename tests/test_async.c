@@ -0,0 +1,81 @@
+#include "test.h"
+
+// Queued commits give the same history as synchronous ones, even if files are staged or the
+// working directory changes before the commit thread gets to them.
+#define N_FILES 200
+
+static void store_id(void *ctx, char *commit_id) {
+	strcpy((char *)ctx, (commit_id == NULL) ? "" : commit_id);
+}
+
+static void stage_files(void *helper) {
+	char file_name[32];
+	for (int file_idx = 0; file_idx < N_FILES; file_idx++) {
+		sprintf(file_name, "f%03d.txt", file_idx);
+		svc_add(helper, file_name);
+	}
+}
+
+int main(void) {
+	test_enter_tmp_dir();
+	char *dir = getcwd(NULL, 0);
+	static char content[65536];
+	char file_name[32];
+	for (int file_idx = 0; file_idx < N_FILES; file_idx++) {
+		memset(content, 'a' + file_idx % 26, sizeof(content) - 1);
+		sprintf(file_name, "f%03d.txt", file_idx);
+		test_write_file(file_name, content);
+	}
+	test_write_file("late.txt", "late\n");
+
+	void *sync_helper = svc_init();
+	stage_files(sync_helper);
+	char sync_first[COMMIT_ID_LEN];
+	strcpy(sync_first, svc_commit(sync_helper, "first"));
+	svc_add(sync_helper, "late.txt");
+	char *sync_second = svc_commit(sync_helper, "second");
+	CHECK(sync_second != NULL);
+
+	void *helper = svc_init();
+	stage_files(helper);
+	char first[COMMIT_ID_LEN] = "none";
+	char second[COMMIT_ID_LEN] = "none";
+	char third[COMMIT_ID_LEN] = "none";
+	CHECK(svc_commit_async(helper, "first", store_id, first) == 0);
+	// Staged for the next commit, not the queued one.
+	CHECK(svc_add(helper, "late.txt") >= 0);
+	// The queued commit still reads its files from where it was queued.
+	CHECK(chdir("/") == 0);
+	usleep(20000);
+	CHECK(chdir(dir) == 0);
+	CHECK(svc_commit_async(helper, "second", store_id, second) == 0);
+	CHECK(svc_commit_async(helper, "nothing", store_id, third) == 0);
+
+	// svc_status() waits for the queue.
+	svc_status_entry_t *entries;
+	int n_entries;
+	CHECK(svc_status(helper, &entries, &n_entries) == 0 && n_entries == 0);
+	free(entries);
+	CHECK(strcmp(first, sync_first) == 0);
+	CHECK(strcmp(second, sync_second) == 0);
+	CHECK(strcmp(third, "") == 0);
+
+	char expected[65536];
+	char text[65536];
+	svc_format_commit(sync_helper, sync_first, expected, sizeof(expected));
+	svc_format_commit(helper, first, text, sizeof(text));
+	CHECK(strcmp(text, expected) == 0);
+	svc_format_commit(sync_helper, sync_second, expected, sizeof(expected));
+	svc_format_commit(helper, second, text, sizeof(text));
+	CHECK(strcmp(text, expected) == 0);
+
+	svc_fsck_problem_t *problems;
+	int n_problems;
+	CHECK(svc_fsck(helper, FSCK_ALL, &problems, &n_problems) == 0);
+	free(problems);
+
+	cleanup(helper);
+	cleanup(sync_helper);
+	free(dir);
+	return test_finish("test_async");
+}
@@ -0,0 +1,97 @@
+#include "test.h"
+
+// svc_diff() output applied with patch(1) to the old files has to give the new files.
+#define N_FILES 8
+#define N_ROUNDS 20
+
+// Lines from a small alphabet, so that the old and new versions share many lines.
+static void random_content(char *buf, int n_lines) {
+	buf[0] = '\0';
+	for (int line_idx = 0; line_idx < n_lines; line_idx++) {
+		char line[16];
+		sprintf(line, "line %d\n", rand() % 12);
+		strcat(buf, line);
+	}
+}
+
+// Insert, delete and change random lines.
+static void mutate_content(const char *old, char *buf) {
+	buf[0] = '\0';
+	const char *line = old;
+	while (*line != '\0') {
+		const char *end = strchr(line, '\n') + 1;
+		int op = rand() % 8;
+		if (op == 0) {
+			strcat(buf, "inserted\n");
+		}
+		if (op == 1) {
+			strcat(buf, "changed\n");
+		}else if (op != 2) {
+			strncat(buf, line, end - line);
+		}
+		line = end;
+	}
+}
+
+int main(void) {
+	if (system("command -v patch > /dev/null 2>&1") != 0) {
+		printf("test_diff: skipped, patch(1) not found\n");
+		return 0;
+	}
+	test_enter_tmp_dir();
+	srand(31);
+
+	for (int round = 0; round < N_ROUNDS; round++) {
+		CHECK(system("rm -rf old new.patch a b && mkdir old a") == 0);
+		void *helper = svc_init();
+		static char content[N_FILES][4096];
+		char file_name[32];
+		for (int file_idx = 0; file_idx < N_FILES; file_idx++) {
+			random_content(content[file_idx], 1 + rand() % 60);
+			sprintf(file_name, "a/f%d.txt", file_idx);
+			test_write_file(file_name, content[file_idx]);
+			svc_add(helper, file_name);
+		}
+		char from_id[7];
+		strcpy(from_id, svc_commit(helper, "old"));
+		CHECK(system("cp -r a old/") == 0);
+
+		// Modify every file but the last two, remove one and add one.
+		for (int file_idx = 0; file_idx < N_FILES - 2; file_idx++) {
+			char new_content[8192];
+			mutate_content(content[file_idx], new_content);
+			sprintf(file_name, "a/f%d.txt", file_idx);
+			test_write_file(file_name, new_content);
+		}
+		sprintf(file_name, "a/f%d.txt", N_FILES - 1);
+		svc_rm(helper, file_name);
+		remove(file_name);
+		test_write_file("a/new.txt", "added\nfile\n");
+		svc_add(helper, "a/new.txt");
+		char *to_id = svc_commit(helper, "new");
+		CHECK(to_id != NULL);
+
+		int fd = open("new.patch", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		CHECK(svc_diff(helper, from_id, to_id, fd) == 0);
+		close(fd);
+		CHECK(system("cd old && patch -s -p1 -E < ../new.patch") == 0);
+
+		for (int file_idx = 0; file_idx < N_FILES; file_idx++) {
+			char old_name[32];
+			sprintf(file_name, "a/f%d.txt", file_idx);
+			sprintf(old_name, "old/a/f%d.txt", file_idx);
+			char *expected = test_read_file(file_name);
+			char *patched = test_read_file(old_name);
+			CHECK((expected == NULL) == (patched == NULL));
+			CHECK(expected == NULL || patched == NULL || strcmp(expected, patched) == 0);
+			free(expected);
+			free(patched);
+		}
+		char *added = test_read_file("old/a/new.txt");
+		CHECK(added != NULL && strcmp(added, "added\nfile\n") == 0);
+		free(added);
+		cleanup(helper);
+	}
+
+	return test_finish("test_diff");
+}
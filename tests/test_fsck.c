@@ -0,0 +1,44 @@
+#include "test.h"
+
+// Histories made through the API pass fsck.
+static int n_problems_of(void *helper) {
+	svc_fsck_problem_t *problems;
+	int n_problems;
+	CHECK(svc_fsck(helper, FSCK_ALL, &problems, &n_problems) >= 0);
+	for (int problem_idx = 0; problem_idx < n_problems; problem_idx++) {
+		fprintf(stderr, "fsck: %d %s %s\n", problems[problem_idx].kind, problems[problem_idx].commit_id, problems[problem_idx].name == NULL ? "" : problems[problem_idx].name);
+	}
+	free(problems);
+	return n_problems;
+}
+
+int main(void) {
+	test_enter_tmp_dir();
+	void *helper = svc_init();
+	test_write_file("a.txt", "1\n");
+	svc_add(helper, "a.txt");
+	CHECK(svc_commit(helper, "first") != NULL);
+
+	// The staging area of dev was copied before a.txt changed on master.
+	CHECK(svc_branch(helper, "dev") == 0);
+	test_write_file("a.txt", "2\n");
+	CHECK(svc_commit(helper, "on master") != NULL);
+	CHECK(svc_checkout(helper, "dev") == 0);
+	// a.txt is the same as in the head, so only the refreshed hash of the staged file changes.
+	CHECK(svc_commit(helper, "on dev") == NULL);
+	CHECK(n_problems_of(helper) == 0);
+	test_write_file("b.txt", "b\n");
+	svc_add(helper, "b.txt");
+	char *commit_id = svc_commit(helper, "on dev");
+	CHECK(commit_id != NULL);
+	CHECK(n_problems_of(helper) == 0);
+
+	// The committed a.txt has the content it was hashed from.
+	svc_blob_view_t view;
+	CHECK(commit_id != NULL && svc_read_file(helper, commit_id, "a.txt", &view) == 0);
+	CHECK(view.len == 2 && memcmp(view.data, "2\n", 2) == 0);
+	svc_release_file(helper, &view);
+
+	cleanup(helper);
+	return test_finish("test_fsck");
+}
@@ -0,0 +1,65 @@
+#include "test.h"
+
+// A project on the in-memory working tree: staging, status, commits and fsck never touch the
+// disk, and svc_watch() is refused because the backend is not local.
+static void memfs_write(svc_fs_t *fs, const char *path, const char *content) {
+	int handle = fs->open(fs->ctx, path, 1);
+	CHECK(handle >= 0);
+	CHECK(fs->write(fs->ctx, handle, content, strlen(content)) == (ssize_t)strlen(content));
+	fs->close(fs->ctx, handle);
+}
+
+static int status_of(void *helper, const char *file_name) {
+	svc_status_entry_t *entries;
+	int n_entries;
+	CHECK(svc_status(helper, &entries, &n_entries) == 0);
+	int status = 0;
+	for (int entry_idx = 0; entry_idx < n_entries; entry_idx++) {
+		if (strcmp(entries[entry_idx].file_name, file_name) == 0) {
+			status = entries[entry_idx].status;
+		}
+	}
+	free(entries);
+	return status;
+}
+
+int main(void) {
+	test_enter_tmp_dir();
+	svc_fs_t *fs = svc_fs_memory_create();
+	CHECK((fs->flags & SVC_FS_LOCAL) == 0);
+	CHECK((svc_fs_posix()->flags & SVC_FS_LOCAL) != 0);
+	void *helper = svc_init_ex(fs);
+	CHECK(svc_watch(helper, 1) == -1);
+
+	memfs_write(fs, "a.txt", "a\n");
+	memfs_write(fs, "dir/b.txt", "b\n");
+	CHECK(svc_add(helper, "a.txt") >= 0);
+	CHECK(svc_add(helper, "dir/b.txt") >= 0);
+	CHECK(svc_add(helper, "missing.txt") == -3);
+	// Nothing was written to the real directory.
+	CHECK(access("a.txt", F_OK) != 0);
+	CHECK(svc_commit(helper, "first") != NULL);
+	CHECK(status_of(helper, "a.txt") == 0);
+
+	memfs_write(fs, "a.txt", "changed\n");
+	CHECK(status_of(helper, "a.txt") == STATUS_MODIFIED);
+	fs->unlink(fs->ctx, "dir/b.txt");
+	CHECK(status_of(helper, "dir/b.txt") == STATUS_DELETED);
+	memfs_write(fs, "c.txt", "c\n");
+	CHECK(svc_add(helper, "c.txt") >= 0);
+	CHECK(status_of(helper, "c.txt") == STATUS_ADDED);
+	char *commit_id = svc_commit(helper, "second");
+	CHECK(commit_id != NULL);
+	char text[1024];
+	svc_format_commit(helper, commit_id, text, sizeof(text));
+	CHECK(strstr(text, "    / a.txt") != NULL && strstr(text, "    - dir/b.txt") != NULL && strstr(text, "    + c.txt") != NULL);
+
+	svc_fsck_problem_t *problems;
+	int n_problems;
+	CHECK(svc_fsck(helper, FSCK_ALL, &problems, &n_problems) == 0 && n_problems == 0);
+	free(problems);
+
+	cleanup(helper);
+	svc_fs_memory_free(fs);
+	return test_finish("test_memfs");
+}
@@ -0,0 +1,40 @@
+#include "test.h"
+
+// fprint_commit() on streams without a file descriptor writes the same text as
+// svc_format_commit(), also when the text is longer than the formatting buffer.
+int main(void) {
+	test_enter_tmp_dir();
+	void *helper = svc_init();
+	char file_name[32];
+	for (int file_idx = 0; file_idx < 400; file_idx++) {
+		sprintf(file_name, "file_%03d.txt", file_idx);
+		test_write_file(file_name, file_name);
+		svc_add(helper, file_name);
+	}
+	char *commit_id = svc_commit(helper, "many files");
+	CHECK(commit_id != NULL);
+
+	size_t expected_len = svc_format_commit(helper, commit_id, NULL, 0);
+	CHECK(expected_len > 8192);
+	char *expected = (char *)malloc(expected_len + 1);
+	svc_format_commit(helper, commit_id, expected, expected_len + 1);
+
+	char *text = NULL;
+	size_t text_len = 0;
+	FILE *stream = open_memstream(&text, &text_len);
+	fprint_commit(helper, commit_id, stream);
+	fclose(stream);
+	CHECK(text_len == expected_len && memcmp(text, expected, expected_len) == 0);
+	free(text);
+
+	char buf[64];
+	memset(buf, 0, sizeof(buf));
+	stream = fmemopen(buf, sizeof(buf), "w");
+	fprint_commit(helper, "bad id", stream);
+	fclose(stream);
+	CHECK(strcmp(buf, "Invalid commit id\n") == 0);
+
+	free(expected);
+	cleanup(helper);
+	return test_finish("test_print");
+}
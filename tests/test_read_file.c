@@ -0,0 +1,51 @@
+#include "test.h"
+
+// A view from svc_read_file() keeps its own content in memory, while the other contents still
+// follow the memory budget.
+#define N_FILES 20
+#define FILE_LEN 4096
+
+int main(void) {
+	test_enter_tmp_dir();
+	void *helper = svc_init();
+	project_t *project = (project_t *)helper;
+	static char content[N_FILES][FILE_LEN + 1];
+	char file_name[32];
+	for (int file_idx = 0; file_idx < N_FILES; file_idx++) {
+		memset(content[file_idx], 'a' + file_idx, FILE_LEN);
+		sprintf(file_name, "f%02d.txt", file_idx);
+		test_write_file(file_name, content[file_idx]);
+		svc_add(helper, file_name);
+	}
+	char commit_id[COMMIT_ID_LEN];
+	strcpy(commit_id, svc_commit(helper, "first"));
+	size_t budget = 3 * (FILE_LEN + 1);
+	CHECK(svc_set_memory_budget(helper, budget, ".") == 0);
+
+	svc_blob_view_t pinned;
+	CHECK(svc_read_file(helper, commit_id, "f00.txt", &pinned) == 0);
+	// Squashing would free the content under the view.
+	CHECK(svc_squash_before(helper, commit_id) == -2);
+	for (int file_idx = 1; file_idx < N_FILES; file_idx++) {
+		svc_blob_view_t view;
+		sprintf(file_name, "f%02d.txt", file_idx);
+		CHECK(svc_read_file(helper, commit_id, file_name, &view) == 0);
+		CHECK(view.len == FILE_LEN && memcmp(view.data, content[file_idx], FILE_LEN) == 0);
+		svc_release_file(helper, &view);
+		// The pinned content counts, the others are spilled down to the budget.
+		CHECK(project->resident_bytes <= budget + FILE_LEN + 1);
+	}
+	CHECK(pinned.len == FILE_LEN && memcmp(pinned.data, content[0], FILE_LEN) == 0);
+
+	// Two views of the same file pin it twice.
+	svc_blob_view_t again;
+	CHECK(svc_read_file(helper, commit_id, "f00.txt", &again) == 0);
+	svc_release_file(helper, &pinned);
+	CHECK(memcmp(again.data, content[0], FILE_LEN) == 0);
+	svc_release_file(helper, &again);
+	CHECK(project->n_file_pins == 0);
+	CHECK(project->resident_bytes <= budget);
+
+	cleanup(helper);
+	return test_finish("test_read_file");
+}
@@ -0,0 +1,61 @@
+#include "test.h"
+
+// A replayed commit has the message and the paths of its source, but its id has to lead to the
+// replayed commit and from there to its new parents. A replay that is refused changes nothing.
+static char *commit_file(void *helper, char *file_name, char *message) {
+	test_write_file(file_name, message);
+	svc_add(helper, file_name);
+	return svc_commit(helper, message);
+}
+
+int main(void) {
+	test_enter_tmp_dir();
+	void *helper = svc_init();
+	CHECK(commit_file(helper, "a.txt", "base") != NULL);
+	CHECK(svc_branch(helper, "dev") == 0);
+	CHECK(svc_checkout(helper, "dev") == 0);
+	char *dev1 = commit_file(helper, "b.txt", "dev 1");
+	char *dev2 = commit_file(helper, "c.txt", "dev 2");
+	CHECK(svc_checkout(helper, "master") == 0);
+	char *master1 = commit_file(helper, "d.txt", "master 1");
+	CHECK(dev1 != NULL && dev2 != NULL && master1 != NULL);
+	
+	char *picked = svc_cherry_pick(helper, dev2);
+	CHECK(picked != NULL && strcmp(picked, dev2) != 0);
+	CHECK(get_commit(helper, picked) != get_commit(helper, dev2));
+	int n_prev;
+	char **prev_commits = get_prev_commits(helper, get_commit(helper, picked), &n_prev);
+	CHECK(n_prev >= 1 && strcmp(prev_commits[0], master1) == 0);
+	free(prev_commits);
+	
+	// dev 2 is already on master, so only dev 1 is replayed.
+	CHECK(svc_checkout(helper, "dev") == 0);
+	CHECK(svc_rebase(helper, "master") == 1);
+	char *after = commit_file(helper, "e.txt", "after rebase");
+	CHECK(after != NULL);
+	prev_commits = get_prev_commits(helper, get_commit(helper, after), &n_prev);
+	CHECK(n_prev >= 2);
+	if (n_prev >= 2) {
+		CHECK(strcmp(prev_commits[0], dev1) != 0 && get_commit(helper, prev_commits[0]) != get_commit(helper, dev1));
+		CHECK(strcmp(prev_commits[1], picked) == 0);
+	}
+	free(prev_commits);
+	
+	// A refused replay leaves the head that the next commit is compared with alone.
+	CHECK(svc_checkout(helper, "master") == 0);
+	project_t *project = (project_t *)helper;
+	commit_node_t *head = project->head;
+	test_write_file("a.txt", "uncommitted");
+	CHECK(svc_cherry_pick(helper, dev1) == NULL);
+	CHECK(project->head == head);
+	CHECK(svc_rebase(helper, "dev") == -2);
+	CHECK(project->head == head);
+	
+	svc_fsck_problem_t *problems;
+	int n_problems;
+	CHECK(svc_fsck(helper, FSCK_ALL, &problems, &n_problems) == 0 && n_problems == 0);
+	free(problems);
+	cleanup(helper);
+	
+	return test_finish("test_replay");
+}
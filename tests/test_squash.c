@@ -0,0 +1,115 @@
+#include "test.h"
+
+#include <sys/stat.h>
+
+// Retained commits have to print the same after svc_squash_before(), and the history behind the
+// first commit has to be gone. Id strings of dropped commits are freed with them, so the ids are
+// copied when they are handed out.
+#define N_COMMITS 6
+
+// A history that keeps committing and is squashed now and then has to keep a bounded footprint:
+// blocks of id strings and the space of spilled contents are given back. Ids only depend on the
+// sum of the message's bytes modulo 1000, so the messages are runs of 'a' of different lengths,
+// and no two commits of a round get the same id.
+#define N_ROUNDS 10
+#define ROUND_COMMITS 900
+#define CONTENT_LEN 1000
+
+// Overwrite the file in place, with content of one length, so the commits do not wait for the
+// file system to flush a truncated file.
+static void write_in_place(const char *file_name, const char *content) {
+	FILE *fptr = fopen(file_name, "r+");
+	CHECK(fptr != NULL);
+	fputs(content, fptr);
+	fclose(fptr);
+}
+
+static void check_footprint(void) {
+	void *helper = svc_init();
+	project_t *project = (project_t *)helper;
+	CHECK(svc_set_memory_budget(helper, 1, ".") == 0);
+	char content[CONTENT_LEN + 16];
+	char message[1001];
+	char last_id[COMMIT_ID_LEN];
+	memset(content, 'x', CONTENT_LEN);
+	memset(message, 'a', sizeof(message));
+	sprintf(content + CONTENT_LEN, "%05d\n", 0);
+	test_write_file("b.txt", content);
+	svc_add(helper, "b.txt");
+	int n_commits = 0;
+	for (int round = 0; round < N_ROUNDS; round++) {
+		for (int commit_idx = 0; commit_idx < ROUND_COMMITS; commit_idx++) {
+			n_commits++;
+			sprintf(content + CONTENT_LEN, "%05d\n", n_commits);
+			write_in_place("b.txt", content);
+			message[n_commits % 1000 + 1] = '\0';
+			char *commit_id = svc_commit(helper, message);
+			message[n_commits % 1000 + 1] = 'a';
+			CHECK(commit_id != NULL && get_commit(helper, commit_id) == project->current_node->prev);
+			strcpy(last_id, (commit_id == NULL) ? "" : commit_id);
+		}
+		CHECK(svc_squash_before(helper, last_id) == ((round == 0) ? ROUND_COMMITS - 1 : ROUND_COMMITS));
+		CHECK(project->commits.n_hex_chunks <= 2);
+	}
+	// Without giving space back the spill file would hold every content ever committed. Blocks
+	// a punched range shares with a content that stays are kept, a few for every squash.
+	struct stat st;
+	CHECK(fstat(project->spill_fd, &st) == 0);
+	CHECK(st.st_size >= (off_t)N_ROUNDS * ROUND_COMMITS * CONTENT_LEN);
+	CHECK((off_t)st.st_blocks * 512 <= (off_t)N_ROUNDS * 4 * 4096);
+	CHECK(get_commit(helper, last_id) != NULL);
+	cleanup(helper);
+}
+
+int main(void) {
+	test_enter_tmp_dir();
+	void *helper = svc_init();
+	char commit_ids[N_COMMITS][COMMIT_ID_LEN];
+	char before[N_COMMITS][1024];
+	char content[16];
+	char message[16];
+	test_write_file("a.txt", "0\n");
+	svc_add(helper, "a.txt");
+	for (int commit_idx = 0; commit_idx < N_COMMITS; commit_idx++) {
+		sprintf(content, "%d\n", commit_idx + 1);
+		test_write_file("a.txt", content);
+		// Ids only depend on the message and the paths.
+		sprintf(message, "change %d", commit_idx + 1);
+		char *commit_id = svc_commit(helper, message);
+		CHECK(commit_id != NULL);
+		strcpy(commit_ids[commit_idx], (commit_id == NULL) ? "" : commit_id);
+	}
+	for (int commit_idx = 0; commit_idx < N_COMMITS; commit_idx++) {
+		svc_format_commit(helper, commit_ids[commit_idx], before[commit_idx], sizeof(before[commit_idx]));
+	}
+
+	CHECK(svc_squash_before(helper, commit_ids[3]) == 3);
+	// More commits publish new snapshots, so the memory the squash retired is freed by now.
+	test_write_file("a.txt", "last\n");
+	CHECK(svc_commit(helper, "last") != NULL);
+
+	char after[1024];
+	for (int commit_idx = 0; commit_idx < N_COMMITS; commit_idx++) {
+		svc_format_commit(helper, commit_ids[commit_idx], after, sizeof(after));
+		if (commit_idx < 3) {
+			CHECK(get_commit(helper, commit_ids[commit_idx]) == NULL);
+			CHECK(strcmp(after, "Invalid commit id\n") == 0);
+		}else {
+			CHECK(strcmp(after, before[commit_idx]) == 0);
+		}
+	}
+	int n_prev;
+	char **prev_commits = get_prev_commits(helper, get_commit(helper, commit_ids[5]), &n_prev);
+	CHECK(n_prev == 2 && strcmp(prev_commits[0], commit_ids[4]) == 0 && strcmp(prev_commits[1], commit_ids[3]) == 0);
+	free(prev_commits);
+
+	svc_fsck_problem_t *problems;
+	int n_problems;
+	CHECK(svc_fsck(helper, FSCK_ALL, &problems, &n_problems) == 0 && n_problems == 0);
+	free(problems);
+	cleanup(helper);
+
+	check_footprint();
+
+	return test_finish("test_squash");
+}
@@ -0,0 +1,55 @@
+#include "test.h"
+
+// A history exported, imported into a new project and exported again has to give the same
+// stream, byte for byte.
+static char *export_to_string(void *helper, const char *file_name) {
+	int fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	CHECK(svc_export_stream(helper, fd) == 0);
+	close(fd);
+	return test_read_file(file_name);
+}
+
+int main(void) {
+	test_enter_tmp_dir();
+	void *helper = svc_init();
+	char file_name[16];
+	for (int file_idx = 0; file_idx < 20; file_idx++) {
+		sprintf(file_name, "f%02d", file_idx);
+		test_write_file(file_name, file_name);
+		svc_add(helper, file_name);
+	}
+	test_write_file("a.txt", "1\n");
+	svc_add(helper, "a.txt");
+	int n_commits = (svc_commit(helper, "first") != NULL);
+
+	// dev starts from the first commit, and a.txt changes on master before dev commits.
+	CHECK(svc_branch(helper, "dev") == 0);
+	test_write_file("a.txt", "2\n");
+	n_commits += (svc_commit(helper, "on master") != NULL);
+	CHECK(svc_checkout(helper, "dev") == 0);
+	test_write_file("b.txt", "b\n");
+	svc_add(helper, "b.txt");
+	n_commits += (svc_commit(helper, "on dev") != NULL);
+	svc_rm(helper, "f03");
+	test_write_file("f04", "changed\n");
+	n_commits += (svc_commit(helper, "remove and change") != NULL);
+	CHECK(svc_checkout(helper, "master") == 0);
+	test_write_file("a.txt", "3\n");
+	n_commits += (svc_commit(helper, "on master again") != NULL);
+	CHECK(n_commits == 5);
+
+	char *first = export_to_string(helper, "first.stream");
+	cleanup(helper);
+
+	helper = svc_init();
+	int fd = open("first.stream", O_RDONLY);
+	CHECK(svc_import_stream(helper, fd) == n_commits);
+	close(fd);
+	char *second = export_to_string(helper, "second.stream");
+	CHECK(first != NULL && second != NULL && strcmp(first, second) == 0);
+	free(first);
+	free(second);
+	cleanup(helper);
+
+	return test_finish("test_stream");
+}
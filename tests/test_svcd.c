@@ -0,0 +1,105 @@
+#include "test.h"
+#include "../svcd.h"
+#include <sys/wait.h>
+
+// Requests sent to a daemon in a child process give the same results as direct calls, also when
+// several are sent before any response is read.
+#define N_PIPELINED 32
+static char *call(svcd_client_t *client, svcd_op_t op, int repo, char *arg, svcd_response_t *response) {
+	char *args[1] = {arg};
+	CHECK(svcd_call(client, op, repo, 1, args, response) == 0);
+	return (response->n_items > 0) ? response->items[0] : NULL;
+}
+
+int main(void) {
+	test_enter_tmp_dir();
+	char socket_path[128];
+	CHECK(getcwd(socket_path, sizeof(socket_path) - 8) != NULL);
+	strcat(socket_path, "/sock");
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		_exit(svcd_serve(socket_path) == 0 ? 0 : 1);
+	}
+	svcd_client_t *client = NULL;
+	for (int try_idx = 0; try_idx < 200 && client == NULL; try_idx++) {
+		client = svcd_connect(socket_path);
+		if (client == NULL) {
+			usleep(10000);
+		}
+	}
+	CHECK(client != NULL);
+	if (client == NULL) {
+		kill(pid, SIGKILL);
+		return test_finish("test_svcd");
+	}
+
+	svcd_response_t response;
+	test_write_file("a.txt", "1\n");
+	char *dir = getcwd(NULL, 0);
+	call(client, SVCD_OP_INIT, 0, dir, &response);
+	int repo = response.status;
+	CHECK(repo >= 0);
+	// A project that runs the same calls directly has to give the same answers.
+	void *helper = svc_init();
+	call(client, SVCD_OP_ADD, repo, "a.txt", &response);
+	CHECK(response.status == svc_add(helper, "a.txt"));
+	char commit_id[COMMIT_ID_LEN];
+	char *item = call(client, SVCD_OP_COMMIT, repo, "first", &response);
+	CHECK(response.status == 0 && item != NULL && strlen(item) == COMMIT_ID_LEN - 1);
+	strcpy(commit_id, item != NULL ? item : "");
+
+	CHECK(strcmp(commit_id, svc_commit(helper, "first")) == 0);
+	char expected[4096];
+	svc_format_commit(helper, commit_id, expected, sizeof(expected));
+	item = call(client, SVCD_OP_PRINT_COMMIT, repo, commit_id, &response);
+	CHECK(item != NULL && strcmp(item, expected) == 0);
+	cleanup(helper);
+
+	call(client, SVCD_OP_BRANCH, repo, "dev", &response);
+	CHECK(response.status == 0);
+	call(client, SVCD_OP_LIST_BRANCHES, repo, NULL, &response);
+	CHECK(response.status == 2 && response.n_items == 2);
+	CHECK(response.n_items == 2 && strcmp(response.items[0], "master") == 0 && strcmp(response.items[1], "dev") == 0);
+
+	// Pipelined requests are run and answered in the order they were sent, each response with the
+	// sequence number svcd_send() returned for its request. The second add sees the first one.
+	int seqs[N_PIPELINED + 4];
+	int expected_status[N_PIPELINED + 4];
+	char file_names[N_PIPELINED][16];
+	char *args[1];
+	int n_sent = 0;
+	for (int file_idx = 0; file_idx < N_PIPELINED; file_idx++) {
+		char content[32];
+		sprintf(file_names[file_idx], "p%d.txt", file_idx);
+		sprintf(content, "%d\n", file_idx * 7919);
+		test_write_file(file_names[file_idx], content);
+		args[0] = file_names[file_idx];
+		expected_status[n_sent] = hash_file(NULL, file_names[file_idx]);
+		seqs[n_sent++] = svcd_send(client, SVCD_OP_HASH_FILE, repo, 1, args);
+	}
+	test_write_file("b.txt", "2\n");
+	args[0] = "b.txt";
+	expected_status[n_sent] = hash_file(NULL, "b.txt");
+	seqs[n_sent++] = svcd_send(client, SVCD_OP_ADD, repo, 1, args);
+	expected_status[n_sent] = -2;
+	seqs[n_sent++] = svcd_send(client, SVCD_OP_ADD, repo, 1, args);
+	expected_status[n_sent] = SVCD_ERR_REQUEST;
+	seqs[n_sent++] = svcd_send(client, SVCD_OP_HASH_FILE, SVCD_MAX_REPOS - 1, 1, args);
+	args[0] = "second";
+	expected_status[n_sent] = 0;
+	seqs[n_sent++] = svcd_send(client, SVCD_OP_COMMIT, repo, 1, args);
+	for (int sent_idx = 0; sent_idx < n_sent; sent_idx++) {
+		CHECK(seqs[sent_idx] > 0 && (sent_idx == 0 || seqs[sent_idx] == seqs[sent_idx - 1] + 1));
+		CHECK(svcd_recv(client, &response) == 0);
+		CHECK(response.seq == (uint32_t)seqs[sent_idx] && response.status == expected_status[sent_idx]);
+	}
+	CHECK(response.n_items == 1 && strlen(response.items[0]) == COMMIT_ID_LEN - 1);
+
+	call(client, SVCD_OP_SHUTDOWN, 0, NULL, &response);
+	svcd_close(client);
+	int wait_status;
+	CHECK(waitpid(pid, &wait_status, 0) == pid && WIFEXITED(wait_status) && WEXITSTATUS(wait_status) == 0);
+	free(dir);
+	return test_finish("test_svcd");
+}
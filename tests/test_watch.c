@@ -0,0 +1,94 @@
+#include "test.h"
+
+// Change checks with and without watch mode have to find the same changes: modified files,
+// files swapped for others at the same count, and files removed on disk.
+static void count_actions(void *helper, char *commit_id, int *n_add, int *n_modify, int *n_remove) {
+	char buf[4096];
+	*n_add = 0;
+	*n_modify = 0;
+	*n_remove = 0;
+	size_t len = svc_format_commit(helper, commit_id, buf, sizeof(buf));
+	CHECK(len > 0 && len < sizeof(buf));
+	for (char *line = strtok(buf, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+		*n_add += (strncmp(line, "    + ", 6) == 0);
+		*n_modify += (strncmp(line, "    / ", 6) == 0);
+		*n_remove += (strncmp(line, "    - ", 6) == 0);
+	}
+}
+
+static void run(int watch) {
+	void *helper = svc_init();
+	if (watch == 1 && svc_watch(helper, 1) != 0) {
+		printf("test_watch: inotify not available, watch mode skipped\n");
+		cleanup(helper);
+		return;
+	}
+	int n_add, n_modify, n_remove;
+	char file_name[16];
+	for (int file_idx = 0; file_idx < 50; file_idx++) {
+		sprintf(file_name, "f%02d", file_idx);
+		test_write_file(file_name, file_name);
+		svc_add(helper, file_name);
+	}
+	char *commit_id = svc_commit(helper, "base");
+	CHECK(commit_id != NULL);
+	CHECK(svc_commit(helper, "nothing") == NULL);
+
+	// One modified file.
+	test_write_file("f07", "changed");
+	commit_id = svc_commit(helper, "modify");
+	CHECK(commit_id != NULL);
+	count_actions(helper, commit_id, &n_add, &n_modify, &n_remove);
+	CHECK(n_add == 0 && n_modify == 1 && n_remove == 0);
+	CHECK(svc_commit(helper, "nothing") == NULL);
+
+	// Same number of files, different names.
+	svc_rm(helper, "f03");
+	test_write_file("g00", "new");
+	svc_add(helper, "g00");
+	commit_id = svc_commit(helper, "swap");
+	CHECK(commit_id != NULL);
+	count_actions(helper, commit_id, &n_add, &n_modify, &n_remove);
+	CHECK(n_add == 1 && n_modify == 0 && n_remove == 1);
+
+	// Written back with the committed content is no change.
+	test_write_file("f08", "changed");
+	test_write_file("f08", "f08");
+	CHECK(svc_commit(helper, "same") == NULL);
+
+	// Deleted on disk.
+	remove("f09");
+	commit_id = svc_commit(helper, "delete");
+	CHECK(commit_id != NULL);
+	count_actions(helper, commit_id, &n_add, &n_modify, &n_remove);
+	CHECK(n_add == 0 && n_modify == 0 && n_remove == 1);
+
+	// Paths spelled with "./", also in a directory that another path spells without it.
+	CHECK(system("mkdir d") == 0);
+	test_write_file("h.txt", "h");
+	svc_add(helper, "./h.txt");
+	test_write_file("d/a", "a");
+	svc_add(helper, "d/a");
+	test_write_file("d/b", "b");
+	svc_add(helper, "./d/b");
+	CHECK(svc_commit(helper, "spelled") != NULL);
+	test_write_file("h.txt", "h changed");
+	commit_id = svc_commit(helper, "modify h");
+	CHECK(commit_id != NULL);
+	count_actions(helper, commit_id, &n_add, &n_modify, &n_remove);
+	CHECK(n_add == 0 && n_modify == 1 && n_remove == 0);
+	test_write_file("d/b", "b changed");
+	commit_id = svc_commit(helper, "modify b");
+	CHECK(commit_id != NULL);
+	count_actions(helper, commit_id, &n_add, &n_modify, &n_remove);
+	CHECK(n_add == 0 && n_modify == 1 && n_remove == 0);
+	cleanup(helper);
+	CHECK(system("rm -rf f?? g?? h.txt d") == 0);
+}
+
+int main(void) {
+	test_enter_tmp_dir();
+	run(0);
+	run(1);
+	return test_finish("test_watch");
+}